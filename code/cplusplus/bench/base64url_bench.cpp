@@ -0,0 +1,51 @@
+#include "bench.hpp"
+#include "base64url.hpp"
+#include "legacy.hpp"
+#include <cstdio>
+#include <random>
+#include <string>
+
+// base64url encode and decode at token-sized inputs, the shared codec
+// (whichever kernel it picked on this CPU) against the byte-at-a-time
+// JWT functions it replaced. "new" writes into a reused buffer the way
+// JWT::create and JWT::verify do; the legacy functions return a string.
+//
+//   base64url_bench [--sizes=30,48,64,96,128,160,200]
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> sizes = args.list("sizes", {30, 48, 64, 96, 128, 160, 200});
+
+    std::mt19937_64 rng(1);
+    std::printf("kernel: %s; nanoseconds per call\n", base64url::implementation());
+    std::printf("%6s %14s %10s %8s %14s %10s %8s\n", "bytes", "legacy encode", "encode", "speedup",
+                "legacy decode", "decode", "speedup");
+    for (std::size_t size : sizes) {
+        std::string input(size, '\0');
+        for (char& c : input) {
+            c = static_cast<char>(rng());
+        }
+        std::string encoded = legacy::base64_encode(input);
+        std::string out(base64url::encoded_size(size) + 64, '\0');
+
+        double legacy_encode = bench::ns_per_call([&] {
+            std::string s = legacy::base64_encode(input);
+            bench::keep(s);
+        });
+        double encode = bench::ns_per_call([&] {
+            base64url::encode(input.data(), input.size(), out.data());
+            bench::keep(out);
+        });
+        double legacy_decode = bench::ns_per_call([&] {
+            std::string s = legacy::base64_decode(encoded);
+            bench::keep(s);
+        });
+        double decode = bench::ns_per_call([&] {
+            std::ptrdiff_t n = base64url::decode(encoded, out.data(), out.size());
+            bench::keep(n);
+            bench::keep(out);
+        });
+        std::printf("%6zu %14.1f %10.1f %7.1fx %14.1f %10.1f %7.1fx\n", size, legacy_encode, encode,
+                    legacy_encode / encode, legacy_decode, decode, legacy_decode / decode);
+    }
+}
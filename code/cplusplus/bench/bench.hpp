@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Small helpers shared by the benchmarks. Each bench is a plain
+// executable that prints one row per measurement; options are given as
+// --name=value and every one has a default sized for a quick run.
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+
+    inline double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Keeps the compiler from dropping the computation of value
+    template<class T>
+    inline void keep(const T& value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    // Calls f in growing batches until min_seconds have passed and
+    // returns the mean nanoseconds per call
+    template<class F>
+    double ns_per_call(F&& f, double min_seconds = 0.3) {
+        std::size_t batch = 16;
+        for (;;) {
+            auto start = Clock::now();
+            for (std::size_t i = 0; i < batch; ++i) {
+                f();
+            }
+            double elapsed = seconds_since(start);
+            if (elapsed >= min_seconds) {
+                return elapsed * 1e9 / static_cast<double>(batch);
+            }
+            batch *= elapsed < min_seconds / 16 ? 16 : 2;
+        }
+    }
+
+    // Latency samples in nanoseconds
+    class Latencies {
+    public:
+        void add(std::uint64_t ns) { samples_.push_back(ns); }
+        void add(Clock::duration d) {
+            add(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+        }
+        void merge(const Latencies& other) {
+            samples_.insert(samples_.end(), other.samples_.begin(), other.samples_.end());
+        }
+        std::size_t size() const { return samples_.size(); }
+
+        // p in [0, 100]; sorts on first use after adding
+        double percentile_us(double p) {
+            if (samples_.empty()) {
+                return 0;
+            }
+            if (!sorted_) {
+                std::sort(samples_.begin(), samples_.end());
+                sorted_ = true;
+            }
+            auto rank = static_cast<std::size_t>(p / 100 * static_cast<double>(samples_.size() - 1) + 0.5);
+            return static_cast<double>(samples_[rank]) / 1e3;
+        }
+
+    private:
+        std::vector<std::uint64_t> samples_;
+        bool sorted_ = false;
+    };
+
+    class Args {
+    public:
+        Args(int argc, char** argv) : argc_(argc), argv_(argv) {}
+
+        std::string get(const char* name, const std::string& fallback) const {
+            std::string prefix = std::string("--") + name + "=";
+            for (int i = 1; i < argc_; ++i) {
+                if (std::strncmp(argv_[i], prefix.c_str(), prefix.size()) == 0) {
+                    return argv_[i] + prefix.size();
+                }
+            }
+            return fallback;
+        }
+
+        std::uint64_t get(const char* name, std::uint64_t fallback) const {
+            std::string value = get(name, std::string());
+            return value.empty() ? fallback : std::strtoull(value.c_str(), nullptr, 10);
+        }
+
+        double get(const char* name, double fallback) const {
+            std::string value = get(name, std::string());
+            return value.empty() ? fallback : std::strtod(value.c_str(), nullptr);
+        }
+
+        // Comma-separated numbers, e.g. --threads=1,2,4
+        std::vector<std::uint64_t> list(const char* name, const std::vector<std::uint64_t>& fallback) const {
+            std::string value = get(name, std::string());
+            if (value.empty()) {
+                return fallback;
+            }
+            std::vector<std::uint64_t> out;
+            const char* p = value.c_str();
+            while (*p) {
+                char* end;
+                std::uint64_t n = std::strtoull(p, &end, 10);
+                if (end == p) {
+                    break;
+                }
+                out.push_back(n);
+                p = *end == ',' ? end + 1 : end;
+            }
+            return out;
+        }
+
+    private:
+        int argc_;
+        char** argv_;
+    };
+
+    // Resident set size of this process in bytes, from /proc
+    inline std::size_t resident_bytes() {
+        std::FILE* f = std::fopen("/proc/self/statm", "r");
+        if (!f) {
+            return 0;
+        }
+        unsigned long pages = 0, resident = 0;
+        int n = std::fscanf(f, "%lu %lu", &pages, &resident);
+        std::fclose(f);
+        return n == 2 ? resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) : 0;
+    }
+
+    // A fresh directory under $TMPDIR (or --dir, when given), removed
+    // with everything in it on destruction
+    class TempDir {
+    public:
+        explicit TempDir(const std::string& parent = std::string()) {
+            std::string base = parent;
+            if (base.empty()) {
+                const char* tmp = std::getenv("TMPDIR");
+                base = tmp && *tmp ? tmp : "/tmp";
+            }
+            std::string pattern = base + "/auth_bench.XXXXXX";
+            if (!mkdtemp(pattern.data())) {
+                std::perror("mkdtemp");
+                std::exit(1);
+            }
+            path_ = pattern;
+        }
+        ~TempDir() {
+            std::error_code ignored;
+            std::filesystem::remove_all(path_, ignored);
+        }
+        TempDir(const TempDir&) = delete;
+        TempDir& operator=(const TempDir&) = delete;
+
+        const std::string& path() const { return path_; }
+        std::string file(const char* name) const { return path_ + "/" + name; }
+
+    private:
+        std::string path_;
+    };
+
+    inline std::string user_email(std::size_t i) {
+        return "user" + std::to_string(i) + "@example.com";
+    }
+}
@@ -0,0 +1,62 @@
+#include "bench.hpp"
+#include "credentials_body.hpp"
+#include <cstdio>
+#include <nlohmann/json.hpp>
+#include <string>
+
+// Parse throughput for /register and /login bodies: nlohmann::json::parse
+// plus the two string copies the handlers used to make, against
+// credentials_body::parse. Bodies range from what test/auth_test.ts sends
+// to long fields, escapes and pretty-printed whitespace.
+
+namespace {
+    using json = nlohmann::json;
+
+    bool with_nlohmann(const std::string& body, std::string& email, std::string& password) {
+        try {
+            json data = json::parse(body);
+            email = data["email"];
+            password = data["password"];
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    void row(const char* name, const std::string& body) {
+        std::string email, password;
+        credentials_body::Fields fields;
+        std::string scratch;
+        if (!with_nlohmann(body, email, password) || !credentials_body::parse(body, fields, scratch) ||
+            fields.email != email || fields.password != password) {
+            std::fprintf(stderr, "parsers disagree on the %s body\n", name);
+            std::exit(1);
+        }
+        double before = bench::ns_per_call([&] {
+            bool ok = with_nlohmann(body, email, password);
+            bench::keep(ok);
+            bench::keep(email);
+            bench::keep(password);
+        });
+        double after = bench::ns_per_call([&] {
+            bool ok = credentials_body::parse(body, fields, scratch);
+            bench::keep(ok);
+            bench::keep(fields);
+        });
+        std::printf("%-16s %6zu %10.1f %8.0f %10.1f %8.0f %7.1fx\n", name, body.size(), before,
+                    static_cast<double>(body.size()) * 1e3 / before, after,
+                    static_cast<double>(body.size()) * 1e3 / after, before / after);
+    }
+}
+
+int main() {
+    std::printf("kernel: %s; ns per body (MB/s)\n", credentials_body::implementation());
+    std::printf("%-16s %6s %19s %19s %8s\n", "body", "bytes", "nlohmann", "credentials_body", "speedup");
+    row("test suite", R"({"email":"user123@example.com","password":"password"})");
+    row("spaced", "{\n  \"email\": \"user123@example.com\",\n  \"password\": \"password\"\n}\n");
+    row("escaped", R"({"email":"café@example.com","password":"p\"a\\ss\/w€rd"})");
+    row("long password", R"({"email":"user123@example.com","password":")" + std::string(200, 'p') + "\"}");
+    row("extra members", R"({"client":{"name":"app","version":[1,2,3]},"email":"user123@example.com",)"
+                         R"("remember":true,"password":"password","ttl":3600.5})");
+    row("max email", R"({"email":")" + std::string(242, 'e') + R"(@example.com","password":"password"})");
+}
@@ -0,0 +1,119 @@
+#include "bench.hpp"
+#include "snapshot_saver.hpp"
+#include "user_store.hpp"
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Login latency while the user table is snapshotted. --readers threads
+// log in as random existing users and one thread keeps registering new
+// ones (so the parent dirties pages and pays copy-on-write faults), first
+// with nothing else going on, then during save_snapshot in the serving
+// process (each shard copied under its write lock), then during a
+// SnapshotSaver fork. The "pause" column is how long the call that starts
+// the save blocked; for the fork that is the writer pause around fork().
+//
+//   fork_snapshot_bench [--users=2000000] [--readers=2] [--dir=PATH]
+//
+// The request's table is --users=20000000, which needs the memory for it
+// twice over in the worst case.
+
+namespace {
+    std::string password_for(std::size_t i) {
+        return "password" + std::to_string(i);
+    }
+
+    // Fresh emails for the registering thread, unique across phases
+    std::atomic<std::size_t> next_new{0};
+
+    // Runs action while the readers and the writer are busy
+    void measure(const char* phase, UserStore& store, std::size_t users, std::size_t readers,
+                 const std::function<double()>& action) {
+        std::atomic<bool> running{true};
+        std::vector<bench::Latencies> latencies(readers);
+        std::vector<std::thread> threads;
+        for (std::size_t r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                std::mt19937_64 rng(r);
+                while (running.load(std::memory_order_relaxed)) {
+                    std::size_t u = rng() % users;
+                    std::string email = bench::user_email(u);
+                    std::string password = password_for(u);
+                    auto start = bench::Clock::now();
+                    bool ok = store.authenticate_user(email, password);
+                    latencies[r].add(bench::Clock::now() - start);
+                    bench::keep(ok);
+                }
+            });
+        }
+        threads.emplace_back([&] {
+            while (running.load(std::memory_order_relaxed)) {
+                std::size_t i = next_new.fetch_add(1);
+                store.add_user("new" + bench::user_email(i), password_for(i));
+            }
+        });
+
+        auto start = bench::Clock::now();
+        double pause_ms = action();
+        double elapsed = bench::seconds_since(start);
+        running.store(false);
+        for (std::thread& t : threads) {
+            t.join();
+        }
+
+        bench::Latencies all;
+        for (const bench::Latencies& l : latencies) {
+            all.merge(l);
+        }
+        std::printf("%-14s %8.2f %9.2f %10zu %9.2f %9.2f %9.1f %9.1f\n", phase, elapsed, pause_ms, all.size(),
+                    all.percentile_us(50), all.percentile_us(99), all.percentile_us(99.9),
+                    all.percentile_us(100));
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::size_t users = std::max<std::uint64_t>(1, args.get("users", std::uint64_t{2000000}));
+    std::size_t readers = args.get("readers", std::uint64_t{2});
+    bench::TempDir dir(args.get("dir", std::string()));
+    std::string path = dir.file("users.snapshot");
+
+    auto store = std::make_shared<UserStore>();
+    store->reserve(users);
+    for (std::size_t i = 0; i < users; ++i) {
+        store->add_user(bench::user_email(i), password_for(i));
+    }
+    SnapshotSaver saver(store, path);
+
+    double in_process_seconds = 0;
+    std::printf("%zu users, %zu login threads, 1 registering thread; latencies in microseconds\n", users,
+                readers);
+    std::printf("%-14s %8s %9s %10s %9s %9s %9s %9s\n", "phase", "seconds", "pause ms", "logins", "p50", "p99",
+                "p99.9", "max");
+    measure("in-process", *store, users, readers, [&] {
+        auto start = bench::Clock::now();
+        store->save_snapshot(path);
+        in_process_seconds = bench::seconds_since(start);
+        return in_process_seconds * 1e3;
+    });
+    // Idle for as long as the save took, so the rows compare like with like
+    measure("idle", *store, users, readers, [&] {
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::max(in_process_seconds, 0.5)));
+        return 0.0;
+    });
+    measure("fork", *store, users, readers, [&] {
+        auto start = bench::Clock::now();
+        if (!saver.start()) {
+            std::fprintf(stderr, "snapshot already running\n");
+        }
+        double pause_ms = bench::seconds_since(start) * 1e3;
+        while (saver.running()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return pause_ms;
+    });
+}
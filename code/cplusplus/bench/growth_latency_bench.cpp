@@ -0,0 +1,96 @@
+#include "bench.hpp"
+#include "legacy.hpp"
+#include "user_store.hpp"
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Login latency while one thread registers --users new accounts as fast
+// as it can, so the table grows the whole time. --readers threads log in
+// as a fixed set of existing users throughout and time every call. Runs
+// the single-mutex map it replaced (which rehashes in one go under its
+// lock), the store growing incrementally, and the store pre-sized with
+// reserve as AUTH_EXPECTED_USERS does. With fewer cores than threads,
+// the scheduler's time slices set the far tail for every store; the
+// maximum still shows a stop-the-world rehash.
+//
+//   growth_latency_bench [--users=2000000] [--readers=2]
+//
+// The request's ramp is --users=10000000.
+
+namespace {
+    constexpr std::size_t kExisting = 1024;
+
+    std::string password_for(std::size_t i) {
+        return "password" + std::to_string(i);
+    }
+
+    template<class Store>
+    void run(const char* name, Store& store, std::size_t users, std::size_t readers) {
+        for (std::size_t i = 0; i < kExisting; ++i) {
+            store.add_user("existing" + bench::user_email(i), password_for(i));
+        }
+
+        std::atomic<bool> ramping{true};
+        std::vector<bench::Latencies> latencies(readers);
+        std::vector<std::thread> threads;
+        for (std::size_t r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                std::mt19937_64 rng(r);
+                bench::Latencies& out = latencies[r];
+                while (ramping.load(std::memory_order_relaxed)) {
+                    std::size_t u = rng() % kExisting;
+                    std::string email = "existing" + bench::user_email(u);
+                    std::string password = password_for(u);
+                    auto start = bench::Clock::now();
+                    bool ok = store.authenticate_user(email, password);
+                    out.add(bench::Clock::now() - start);
+                    bench::keep(ok);
+                }
+            });
+        }
+
+        auto start = bench::Clock::now();
+        for (std::size_t i = 0; i < users; ++i) {
+            store.add_user(bench::user_email(i), password_for(i));
+        }
+        double ramp = bench::seconds_since(start);
+        ramping.store(false);
+        for (std::thread& t : threads) {
+            t.join();
+        }
+
+        bench::Latencies all;
+        for (const bench::Latencies& l : latencies) {
+            all.merge(l);
+        }
+        std::printf("%-24s %8.2f %10zu %9.2f %9.2f %9.2f %9.1f %9.1f\n", name, ramp, all.size(),
+                    all.percentile_us(50), all.percentile_us(99), all.percentile_us(99.9),
+                    all.percentile_us(99.99), all.percentile_us(100));
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::size_t users = args.get("users", std::uint64_t{2000000});
+    std::size_t readers = args.get("readers", std::uint64_t{2});
+
+    std::printf("%zu registrations, %zu login threads; latencies in microseconds\n", users, readers);
+    std::printf("%-24s %8s %10s %9s %9s %9s %9s %9s\n", "store", "ramp s", "logins", "p50", "p99", "p99.9",
+                "p99.99", "max");
+    {
+        legacy::UserStore store;
+        run("unordered_map (before)", store, users, readers);
+    }
+    {
+        UserStore store;
+        run("incremental growth", store, users, readers);
+    }
+    {
+        UserStore store;
+        store.reserve(users + kExisting);
+        run("reserved up front", store, users, readers);
+    }
+}
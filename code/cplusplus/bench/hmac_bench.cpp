@@ -0,0 +1,68 @@
+#include "bench.hpp"
+#include "crypto.hpp"
+#include "hmac.hpp"
+#include "legacy.hpp"
+#include <cstdio>
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <random>
+#include <string>
+
+// HMAC-SHA256 per call at 20-300 byte messages: OpenSSL's one-shot
+// HMAC(), which redoes the key schedule and sets up a context every time,
+// against crypto::HmacSha256, which absorbs the key once and only hashes
+// the message. The last row is a password check end to end, the legacy
+// hex-string hash_password against crypto::hash_password.
+//
+//   hmac_bench [--sizes=20,32,64,100,200,300]
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> sizes = args.list("sizes", {20, 32, 64, 100, 200, 300});
+    static const char* kKey = "your-256-bit-secret";
+    crypto::HmacSha256 key(kKey);
+
+    std::mt19937_64 rng(1);
+    std::printf("SHA-256 kernel: %s; nanoseconds per call\n", sha256::implementation());
+    std::printf("%-16s %12s %14s %8s\n", "message", "HMAC()", "HmacSha256", "speedup");
+    for (std::size_t size : sizes) {
+        std::string message(size, '\0');
+        for (char& c : message) {
+            c = static_cast<char>(rng());
+        }
+        unsigned char expected[EVP_MAX_MD_SIZE];
+        unsigned int expected_len;
+        HMAC(EVP_sha256(), kKey, std::strlen(kKey), reinterpret_cast<const unsigned char*>(message.data()),
+             message.size(), expected, &expected_len);
+        if (std::memcmp(key.mac(message).data(), expected, crypto::kDigestSize) != 0) {
+            std::fprintf(stderr, "HmacSha256 disagrees with OpenSSL at %zu bytes\n", size);
+            return 1;
+        }
+
+        double one_shot = bench::ns_per_call([&] {
+            unsigned char out[EVP_MAX_MD_SIZE];
+            unsigned int out_len;
+            HMAC(EVP_sha256(), kKey, std::strlen(kKey), reinterpret_cast<const unsigned char*>(message.data()),
+                 message.size(), out, &out_len);
+            bench::keep(out);
+        });
+        double midstate = bench::ns_per_call([&] {
+            unsigned char out[crypto::kDigestSize];
+            key.mac(message.data(), message.size(), out);
+            bench::keep(out);
+        });
+        std::printf("%10zu bytes %12.1f %14.1f %7.1fx\n", size, one_shot, midstate, one_shot / midstate);
+    }
+
+    std::string password = "correct horse battery staple";
+    double legacy_hash = bench::ns_per_call([&] {
+        std::string h = legacy::hash_password(password);
+        bench::keep(h);
+    });
+    double hash = bench::ns_per_call([&] {
+        crypto::Digest d = crypto::hash_password(password);
+        bench::keep(d);
+    });
+    std::printf("%-16s %12.1f %14.1f %7.1fx\n", "hash_password", legacy_hash, hash, legacy_hash / hash);
+}
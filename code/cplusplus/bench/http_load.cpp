@@ -0,0 +1,475 @@
+#include "bench.hpp"
+#include "jwt.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <string_view>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Closed-loop HTTP/1.1 load against a running auth_service. Every
+// keep-alive connection sends --depth pipelined requests, waits for all
+// of their responses and sends the next batch; latency is from a batch
+// going out to each response coming back. Several workloads can share one
+// run and are reported separately, e.g. --requests=404:8,login:64 times
+// 404s on 8 connections while 64 others keep logins (and so the password
+// KDF) busy. Kinds:
+//
+//   login     POST /login, each connection as one of --users accounts
+//             (default one per connection, so concurrent logins are not
+//             folded into one hash by the login coalescer); registered
+//             first if need be
+//   register  POST /register with a fresh email every time
+//   404       GET of a path that does not exist
+//   delete    DELETE /delete with a valid token for a user that does not
+//             exist, i.e. the full token check without changing anything
+//
+// Connections are spread over --threads client threads, each with its
+// own epoll set. Beyond about 25k connections one source address runs out
+// of ports, so against a server on loopback connections round-robin over
+// 127.0.0.1-127.0.0.N with N from --source-ips (default: enough for the
+// connection count). The open file limit is raised to fit; the server
+// needs the same (ulimit -n).
+//
+//   http_load [--requests=login:64] [--depth=1] [--threads=1] [--seconds=5]
+//             [--warmup=1] [--host=127.0.0.1] [--port=3000]
+//             [--users=N] [--source-ips=N]
+
+namespace {
+    struct Workload {
+        std::string kind;
+        std::size_t connections;
+    };
+
+    struct Options {
+        std::vector<Workload> workloads;
+        std::size_t depth;
+        std::size_t threads;
+        double seconds;
+        double warmup;
+        std::string host;
+        unsigned short port;
+        std::size_t source_ips;
+    };
+
+    struct Stats {
+        bench::Latencies latencies;
+        std::map<int, std::uint64_t> statuses;
+        std::uint64_t closed = 0;
+    };
+
+    std::string post(const char* target, const std::string& body) {
+        return std::string("POST ") + target + " HTTP/1.1\r\nHost: localhost\r\n"
+               "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+               "\r\n\r\n" + body;
+    }
+
+    std::string credentials(const std::string& email, const std::string& password) {
+        return "{\"email\":\"" + email + "\",\"password\":\"" + password + "\"}";
+    }
+
+    std::string login_email(std::size_t user) {
+        return "load-" + bench::user_email(user);
+    }
+
+    // Builds the requests of one workload
+    class RequestSource {
+    public:
+        RequestSource(const std::string& kind, std::size_t users) {
+            if (kind == "login") {
+                for (std::size_t u = 0; u < users; ++u) {
+                    fixed_.push_back(post("/login", credentials(login_email(u), "password")));
+                }
+            } else if (kind == "404") {
+                fixed_.push_back("GET /no-such-path HTTP/1.1\r\nHost: localhost\r\n\r\n");
+            } else if (kind == "delete") {
+                fixed_.push_back("DELETE /delete HTTP/1.1\r\nHost: localhost\r\nAuthorization: Bearer " +
+                                 JWT::create("nobody@load.invalid") + "\r\n\r\n");
+            } else if (kind != "register") {
+                std::fprintf(stderr, "unknown request kind '%s'\n", kind.c_str());
+                std::exit(2);
+            }
+        }
+
+        // slot numbers the connections of this workload
+        void append_next(std::size_t slot, std::string& out) {
+            if (!fixed_.empty()) {
+                out += fixed_[slot % fixed_.size()];
+                return;
+            }
+            std::size_t n = counter_.fetch_add(1, std::memory_order_relaxed);
+            out += post("/register", credentials("load" + std::to_string(getpid()) + "-" + bench::user_email(n),
+                                                 "password"));
+        }
+
+    private:
+        std::vector<std::string> fixed_;
+        std::atomic<std::size_t> counter_{0};
+    };
+
+    struct Connection {
+        int fd = -1;
+        std::size_t workload = 0;
+        std::size_t slot = 0;
+        std::size_t source_ip = 0;
+        std::string in;
+        std::string out;
+        std::size_t written = 0;
+        std::size_t outstanding = 0;
+        bench::Clock::time_point sent;
+    };
+
+    sockaddr_in address(const std::string& host, unsigned short port) {
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &a.sin_addr) != 1) {
+            std::fprintf(stderr, "not an IPv4 address: %s\n", host.c_str());
+            std::exit(2);
+        }
+        return a;
+    }
+
+    int connect_to(const Options& options, std::size_t source_ip) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            std::perror("socket");
+            std::exit(1);
+        }
+        if (options.source_ips > 1) {
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+            sockaddr_in local{};
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(0x7f000001 + static_cast<std::uint32_t>(source_ip));
+            if (::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+                std::perror("bind");
+                std::exit(1);
+            }
+        }
+        sockaddr_in remote = address(options.host, options.port);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) != 0) {
+            std::perror("connect");
+            std::exit(1);
+        }
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        return fd;
+    }
+
+    // Length of the complete response at the start of in, 0 if there is
+    // not one yet; sets status
+    std::size_t complete_response(std::string_view in, int& status) {
+        std::size_t header_end = in.find("\r\n\r\n");
+        if (header_end == std::string_view::npos) {
+            return 0;
+        }
+        // The header block ends in \r\n\r\n, so none of these parse past it
+        status = header_end > 12 ? std::atoi(in.data() + 9) : 0;
+        std::size_t body = 0;
+        for (std::size_t line = in.find("\r\n"); line < header_end; line = in.find("\r\n", line + 2)) {
+            static const char kName[] = "content-length:";
+            if (strncasecmp(in.data() + line + 2, kName, sizeof(kName) - 1) == 0) {
+                body = std::strtoull(in.data() + line + 2 + sizeof(kName) - 1, nullptr, 10);
+                break;
+            }
+        }
+        std::size_t total = header_end + 4 + body;
+        return in.size() >= total ? total : 0;
+    }
+
+    // One blocking request, for setup; returns the status
+    int request_once(const Options& options, const std::string& request) {
+        int fd = connect_to(options, 0);
+        std::size_t sent = 0;
+        while (sent < request.size()) {
+            ssize_t n = ::write(fd, request.data() + sent, request.size() - sent);
+            if (n <= 0) {
+                std::perror("write");
+                std::exit(1);
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+        std::string in;
+        int status = 0;
+        char buffer[4096];
+        while (complete_response(in, status) == 0) {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                break;
+            }
+            in.append(buffer, static_cast<std::size_t>(n));
+        }
+        ::close(fd);
+        return status;
+    }
+
+    class Client {
+    public:
+        Client(const Options& options, std::deque<RequestSource>& sources)
+            : options_(options), sources_(sources), stats_(sources.size()) {
+            epoll_ = ::epoll_create1(0);
+        }
+
+        ~Client() {
+            for (Connection& c : connections_) {
+                ::close(c.fd);
+            }
+            ::close(epoll_);
+        }
+
+        void add(std::size_t workload, std::size_t slot, std::size_t source_ip) {
+            Connection c;
+            c.workload = workload;
+            c.slot = slot;
+            c.source_ip = source_ip;
+            c.fd = connect_to(options_, source_ip);
+            connections_.push_back(std::move(c));
+        }
+
+        void run(bench::Clock::time_point measure_from, bench::Clock::time_point until) {
+            for (std::size_t i = 0; i < connections_.size(); ++i) {
+                Connection& c = connections_[i];
+                ::fcntl(c.fd, F_SETFL, O_NONBLOCK);
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.u64 = i;
+                ::epoll_ctl(epoll_, EPOLL_CTL_ADD, c.fd, &event);
+                send_batch(i);
+            }
+            std::vector<epoll_event> events(1024);
+            while (bench::Clock::now() < until) {
+                int n = ::epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), 50);
+                for (int e = 0; e < n; ++e) {
+                    std::size_t i = events[e].data.u64;
+                    if (events[e].events & EPOLLOUT) {
+                        flush(i);
+                    }
+                    if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                        receive(i, measure_from);
+                    }
+                }
+            }
+        }
+
+        const std::vector<Stats>& stats() const { return stats_; }
+
+    private:
+        void send_batch(std::size_t i) {
+            Connection& c = connections_[i];
+            c.out.clear();
+            c.written = 0;
+            for (std::size_t d = 0; d < options_.depth; ++d) {
+                sources_[c.workload].append_next(c.slot, c.out);
+            }
+            c.outstanding = options_.depth;
+            c.sent = bench::Clock::now();
+            flush(i);
+        }
+
+        void flush(std::size_t i) {
+            Connection& c = connections_[i];
+            while (c.written < c.out.size()) {
+                ssize_t n = ::write(c.fd, c.out.data() + c.written, c.out.size() - c.written);
+                if (n < 0) {
+                    if (errno == EAGAIN) {
+                        watch(i, EPOLLIN | EPOLLOUT);
+                    }
+                    return;
+                }
+                c.written += static_cast<std::size_t>(n);
+            }
+            watch(i, EPOLLIN);
+        }
+
+        void watch(std::size_t i, std::uint32_t mask) {
+            epoll_event event{};
+            event.events = mask;
+            event.data.u64 = i;
+            ::epoll_ctl(epoll_, EPOLL_CTL_MOD, connections_[i].fd, &event);
+        }
+
+        void receive(std::size_t i, bench::Clock::time_point measure_from) {
+            Connection& c = connections_[i];
+            Stats& stats = stats_[c.workload];
+            char buffer[65536];
+            ssize_t n;
+            while ((n = ::read(c.fd, buffer, sizeof(buffer))) > 0) {
+                c.in.append(buffer, static_cast<std::size_t>(n));
+            }
+            auto now = bench::Clock::now();
+            std::size_t consumed = 0;
+            int status = 0;
+            while (std::size_t size = complete_response(std::string_view(c.in).substr(consumed), status)) {
+                consumed += size;
+                if (now >= measure_from) {
+                    stats.latencies.add(now - c.sent);
+                    ++stats.statuses[status];
+                }
+                --c.outstanding;
+            }
+            c.in.erase(0, consumed);
+            if (n == 0 || (n < 0 && errno != EAGAIN)) {
+                // The server hung up: count it and start over on a new
+                // connection
+                ++stats.closed;
+                ::epoll_ctl(epoll_, EPOLL_CTL_DEL, c.fd, nullptr);
+                ::close(c.fd);
+                c.fd = connect_to(options_, c.source_ip);
+                ::fcntl(c.fd, F_SETFL, O_NONBLOCK);
+                c.in.clear();
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.u64 = i;
+                ::epoll_ctl(epoll_, EPOLL_CTL_ADD, c.fd, &event);
+                send_batch(i);
+                return;
+            }
+            if (c.outstanding == 0) {
+                send_batch(i);
+            }
+        }
+
+        const Options& options_;
+        std::deque<RequestSource>& sources_;
+        std::vector<Connection> connections_;
+        std::vector<Stats> stats_;
+        int epoll_ = -1;
+    };
+
+    void raise_file_limit(std::size_t needed) {
+        rlimit limit{};
+        ::getrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur >= needed) {
+            return;
+        }
+        limit.rlim_cur = needed;
+        limit.rlim_max = std::max<rlim_t>(limit.rlim_max, needed);
+        if (::setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            ::getrlimit(RLIMIT_NOFILE, &limit);
+            limit.rlim_cur = limit.rlim_max;
+            ::setrlimit(RLIMIT_NOFILE, &limit);
+            std::fprintf(stderr, "warning: open file limit is %llu, %zu needed\n",
+                         static_cast<unsigned long long>(limit.rlim_max), needed);
+        }
+    }
+
+    std::vector<Workload> parse_workloads(const std::string& spec) {
+        std::vector<Workload> out;
+        std::size_t start = 0;
+        while (start < spec.size()) {
+            std::size_t end = spec.find(',', start);
+            std::string item = spec.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            std::size_t colon = item.find(':');
+            Workload w{item.substr(0, colon), 1};
+            if (colon != std::string::npos) {
+                w.connections = std::strtoull(item.c_str() + colon + 1, nullptr, 10);
+            }
+            out.push_back(w);
+            start = end == std::string::npos ? spec.size() : end + 1;
+        }
+        return out;
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    Options options;
+    options.workloads = parse_workloads(args.get("requests", std::string("login:64")));
+    options.depth = std::max<std::uint64_t>(1, args.get("depth", std::uint64_t{1}));
+    options.threads = std::max<std::uint64_t>(1, args.get("threads", std::uint64_t{1}));
+    options.seconds = args.get("seconds", 5.0);
+    options.warmup = args.get("warmup", 1.0);
+    options.host = args.get("host", std::string("127.0.0.1"));
+    options.port = static_cast<unsigned short>(args.get("port", std::uint64_t{3000}));
+
+    std::size_t total = 0;
+    for (const Workload& w : options.workloads) {
+        total += w.connections;
+    }
+    // Other loopback addresses only reach a server on loopback
+    bool loopback = options.host.compare(0, 4, "127.") == 0;
+    options.source_ips = loopback ? std::max<std::uint64_t>(1, args.get("source-ips", std::uint64_t{total / 25000 + 1}))
+                                  : 1;
+    raise_file_limit(total + 64);
+
+    // Not movable (the register counter is atomic), hence a deque
+    std::deque<RequestSource> sources;
+    for (const Workload& w : options.workloads) {
+        std::size_t users = std::max<std::uint64_t>(1, args.get("users", std::uint64_t{w.connections}));
+        sources.emplace_back(w.kind, users);
+        if (w.kind == "login") {
+            // 200 the first time, 409 once they exist
+            for (std::size_t u = 0; u < users; ++u) {
+                request_once(options, post("/register", credentials(login_email(u), "password")));
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Client>> clients;
+    for (std::size_t t = 0; t < options.threads; ++t) {
+        clients.push_back(std::make_unique<Client>(options, sources));
+    }
+    auto connect_start = bench::Clock::now();
+    std::size_t n = 0;
+    for (std::size_t w = 0; w < options.workloads.size(); ++w) {
+        for (std::size_t i = 0; i < options.workloads[w].connections; ++i, ++n) {
+            clients[n % options.threads]->add(w, i, n % options.source_ips);
+        }
+    }
+    std::printf("%zu connections (opened in %.1f s), %zu client threads, depth %zu, %.1f s after %.1f s warmup\n",
+                total, bench::seconds_since(connect_start), options.threads, options.depth, options.seconds,
+                options.warmup);
+
+    auto start = bench::Clock::now();
+    auto measure_from = start + std::chrono::duration_cast<bench::Clock::duration>(
+        std::chrono::duration<double>(options.warmup));
+    auto until = measure_from + std::chrono::duration_cast<bench::Clock::duration>(
+        std::chrono::duration<double>(options.seconds));
+    std::vector<std::thread> threads;
+    for (auto& client : clients) {
+        threads.emplace_back([&client, measure_from, until] { client->run(measure_from, until); });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    std::printf("%-10s %6s %12s %10s %10s %10s %10s  %s\n", "requests", "conns", "requests/s", "p50 us",
+                "p99 us", "p99.9 us", "max us", "statuses");
+    for (std::size_t w = 0; w < options.workloads.size(); ++w) {
+        Stats all;
+        for (auto& client : clients) {
+            const Stats& s = client->stats()[w];
+            all.latencies.merge(s.latencies);
+            for (const auto& [status, count] : s.statuses) {
+                all.statuses[status] += count;
+            }
+            all.closed += s.closed;
+        }
+        std::string statuses;
+        for (const auto& [status, count] : all.statuses) {
+            statuses += std::to_string(status) + "=" + std::to_string(count) + " ";
+        }
+        if (all.closed) {
+            statuses += "closed=" + std::to_string(all.closed);
+        }
+        std::printf("%-10s %6zu %12.0f %10.0f %10.0f %10.0f %10.0f  %s\n", options.workloads[w].kind.c_str(),
+                    options.workloads[w].connections, static_cast<double>(all.latencies.size()) / options.seconds,
+                    all.latencies.percentile_us(50), all.latencies.percentile_us(99),
+                    all.latencies.percentile_us(99.9), all.latencies.percentile_us(100), statuses.c_str());
+    }
+}
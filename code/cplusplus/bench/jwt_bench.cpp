@@ -0,0 +1,64 @@
+#include "bench.hpp"
+#include "jwt.hpp"
+#include "legacy.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Tokens minted and verified per second on one core: the nlohmann-based
+// JWT::create/verify this tree started with, JWT::create returning a
+// string, and JWT::create into a reused buffer as the login handlers do.
+// Every token is for the same email, so none of this is the token cache.
+//
+//   jwt_bench [--email=user123456@example.com]
+
+namespace {
+    void row(const char* what, double ns, double baseline_ns) {
+        std::printf("%-32s %10.1f %12.0f %8.1fx\n", what, ns, 1e9 / ns, baseline_ns / ns);
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::string email = args.get("email", bench::user_email(123456));
+
+    std::string token = JWT::create(email);
+    std::string legacy_token = legacy::jwt_create(email);
+    std::string verified;
+    if (!legacy::jwt_verify(token, verified) || verified != email || !JWT::verify(legacy_token, verified) ||
+        verified != email) {
+        std::fprintf(stderr, "old and new tokens do not verify against each other\n");
+        return 1;
+    }
+
+    std::printf("%-32s %10s %12s %9s\n", "", "ns/token", "tokens/s", "speedup");
+    double legacy_create = bench::ns_per_call([&] {
+        std::string t = legacy::jwt_create(email);
+        bench::keep(t);
+    });
+    row("create (nlohmann, before)", legacy_create, legacy_create);
+    row("JWT::create -> std::string", bench::ns_per_call([&] {
+        std::string t = JWT::create(email);
+        bench::keep(t);
+    }), legacy_create);
+    std::vector<char> buffer(JWT::max_token_size(email));
+    row("JWT::create into a buffer", bench::ns_per_call([&] {
+        std::size_t n = JWT::create(email, buffer.data());
+        bench::keep(n);
+        bench::keep(buffer);
+    }), legacy_create);
+
+    double legacy_verify = bench::ns_per_call([&] {
+        std::string e;
+        bool ok = legacy::jwt_verify(token, e);
+        bench::keep(ok);
+        bench::keep(e);
+    });
+    row("verify (nlohmann, before)", legacy_verify, legacy_verify);
+    static JWT::Claims claims;
+    row("JWT::verify", bench::ns_per_call([&] {
+        bool ok = JWT::verify(token, claims);
+        bench::keep(ok);
+        bench::keep(claims);
+    }), legacy_verify);
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The implementations this tree replaced, kept so benchmarks can report
+// before and after side by side. Not used by the service.
+namespace legacy {
+    inline std::string hash_password(const std::string& password) {
+        static const char* kKey = "YOUR_SUPER_SECRET";
+        unsigned char hash[EVP_MAX_MD_SIZE];
+        unsigned int hash_len;
+        HMAC(EVP_sha256(), kKey, std::strlen(kKey), reinterpret_cast<const unsigned char*>(password.c_str()),
+             password.length(), hash, &hash_len);
+        std::stringstream ss;
+        ss << std::hex << std::setfill('0');
+        for (unsigned int i = 0; i < hash_len; ++i) {
+            ss << std::setw(2) << static_cast<int>(hash[i]);
+        }
+        return ss.str();
+    }
+
+    // One mutex around a node-based map, held while hashing
+    class UserStore {
+    public:
+        bool add_user(const std::string& email, const std::string& password) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (users_.find(email) != users_.end()) {
+                return false;
+            }
+            users_[email] = hash_password(password);
+            return true;
+        }
+
+        bool authenticate_user(const std::string& email, const std::string& password) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = users_.find(email);
+            if (it == users_.end()) {
+                return false;
+            }
+            return hash_password(password) == it->second;
+        }
+
+        bool delete_user(const std::string& email) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return users_.erase(email) > 0;
+        }
+
+    private:
+        std::unordered_map<std::string, std::string> users_;
+        std::mutex mutex_;
+    };
+
+    // JWT::base64_encode and JWT::base64_decode, a character at a time
+    // into a growing string, the decoder rebuilding its table per call
+    inline std::string base64_encode(const std::string& input) {
+        static const std::string base64_chars =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        std::string ret;
+        int i = 0;
+        unsigned char char_array_3[3];
+        unsigned char char_array_4[4];
+        for (unsigned char c : input) {
+            char_array_3[i++] = c;
+            if (i == 3) {
+                char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+                char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+                char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+                char_array_4[3] = char_array_3[2] & 0x3f;
+                for (i = 0; i < 4; i++) {
+                    ret += base64_chars[char_array_4[i]];
+                }
+                i = 0;
+            }
+        }
+        if (i) {
+            for (int j = i; j < 3; j++) {
+                char_array_3[j] = '\0';
+            }
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            for (int j = 0; j < i + 1; j++) {
+                ret += base64_chars[char_array_4[j]];
+            }
+        }
+        return ret;
+    }
+
+    inline std::string base64_decode(const std::string& encoded_string) {
+        static const std::string base64_chars =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+        std::string ret;
+        std::vector<int> char_map(256, -1);
+        for (std::size_t i = 0; i < base64_chars.length(); i++) {
+            char_map[static_cast<unsigned char>(base64_chars[i])] = static_cast<int>(i);
+        }
+        int i = 0;
+        unsigned char char_array_4[4], char_array_3[3];
+        for (char c : encoded_string) {
+            if (char_map[static_cast<unsigned char>(c)] == -1) {
+                break;
+            }
+            char_array_4[i++] = c;
+            if (i == 4) {
+                for (i = 0; i < 4; i++) {
+                    char_array_4[i] = static_cast<unsigned char>(char_map[char_array_4[i]]);
+                }
+                char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+                char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+                char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+                for (i = 0; i < 3; i++) {
+                    ret += char_array_3[i];
+                }
+                i = 0;
+            }
+        }
+        if (i) {
+            for (int j = 0; j < i; j++) {
+                char_array_4[j] = static_cast<unsigned char>(char_map[char_array_4[j]]);
+            }
+            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
+            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
+            for (int j = 0; j < i - 1; j++) {
+                ret += char_array_3[j];
+            }
+        }
+        return ret;
+    }
+
+    // JWT::create and JWT::verify: two json objects built and dumped per
+    // token, the constant header encoded every time, a one-shot HMAC()
+    // (with a local digest buffer here instead of OpenSSL's static one)
+    inline std::string jwt_signature(const std::string& header_payload) {
+        static const char* kSecret = "your-256-bit-secret";
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len;
+        HMAC(EVP_sha256(), kSecret, std::strlen(kSecret),
+             reinterpret_cast<const unsigned char*>(header_payload.c_str()), header_payload.length(), digest,
+             &digest_len);
+        return std::string(reinterpret_cast<char*>(digest), 32);
+    }
+
+    inline std::string jwt_create(const std::string& email) {
+        using json = nlohmann::json;
+        json header = {{"alg", "HS256"}, {"typ", "JWT"}};
+        auto now = std::chrono::system_clock::now();
+        auto exp = now + std::chrono::hours(24);
+        json payload = {
+            {"email", email},
+            {"iat", std::chrono::system_clock::to_time_t(now)},
+            {"exp", std::chrono::system_clock::to_time_t(exp)},
+        };
+        std::string header_encoded = base64_encode(header.dump());
+        std::string payload_encoded = base64_encode(payload.dump());
+        std::string header_payload = header_encoded + "." + payload_encoded;
+        std::string signature_encoded = base64_encode(jwt_signature(header_payload));
+        return header_payload + "." + signature_encoded;
+    }
+
+    inline bool jwt_verify(const std::string& token, std::string& email) {
+        using json = nlohmann::json;
+        std::size_t first_dot = token.find('.');
+        std::size_t last_dot = token.rfind('.');
+        if (first_dot == std::string::npos || last_dot == std::string::npos || first_dot == last_dot) {
+            return false;
+        }
+        std::string header_payload = token.substr(0, last_dot);
+        std::string provided_sig = base64_decode(token.substr(last_dot + 1));
+        if (provided_sig != jwt_signature(header_payload)) {
+            return false;
+        }
+        std::string payload_str = base64_decode(token.substr(first_dot + 1, last_dot - first_dot - 1));
+        try {
+            json payload = json::parse(payload_str);
+            auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            if (payload["exp"].get<time_t>() < now) {
+                return false;
+            }
+            email = payload["email"].get<std::string>();
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+}
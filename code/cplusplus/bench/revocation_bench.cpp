@@ -0,0 +1,60 @@
+#include "bench.hpp"
+#include "jwt.hpp"
+#include "revocation_list.hpp"
+#include <cstdio>
+#include <string>
+
+// What the revocation check adds to JWT::verify on the /delete path, with
+// --entries other emails revoked. "after revocations" tokens were issued
+// after the latest revocation and skip the lookup; "probed" tokens are
+// older than it, so the table is searched and misses; "revoked" tokens
+// belong to a revoked email and are found.
+//
+//   revocation_bench [--entries=0,1000,100000,1000000]
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> entries = args.list("entries", {0, 1000, 100000, 1000000});
+
+    std::int64_t now = JWT::current_second();
+    std::string email = bench::user_email(0);
+    std::string old_token = JWT::create_at(email, now - 60);
+    std::string revoked_email = "revoked-" + bench::user_email(0);
+    std::string revoked_token = JWT::create_at(revoked_email, now - 60);
+    static JWT::Claims claims;
+
+    double verify = bench::ns_per_call([&] {
+        bool ok = JWT::verify(old_token, claims);
+        bench::keep(ok);
+    });
+    std::printf("JWT::verify alone: %.1f ns; is_revoked in ns (share of verify)\n", verify);
+    std::printf("%10s %20s %20s %20s\n", "entries", "after revocations", "probed", "revoked");
+    for (std::size_t n : entries) {
+        RevocationList list(0);
+        for (std::size_t i = 0; i < n; ++i) {
+            list.revoke("revoked-" + bench::user_email(i), now - 30);
+        }
+        std::string fresh_token = JWT::create_at(email, now);
+        JWT::Claims fresh;
+        JWT::verify(fresh_token, fresh);
+        JWT::Claims old;
+        JWT::verify(old_token, old);
+        JWT::Claims gone;
+        JWT::verify(revoked_token, gone);
+        if (list.is_revoked(fresh.email, fresh.iat) || (n > 0 && list.is_revoked(old.email, old.iat)) ||
+            list.is_revoked(gone.email, gone.iat) != (n > 0)) {
+            std::fprintf(stderr, "unexpected revocation result with %zu entries\n", n);
+            return 1;
+        }
+
+        std::printf("%10zu", n);
+        for (const JWT::Claims* c : {&fresh, &old, &gone}) {
+            double check = bench::ns_per_call([&] {
+                bool revoked = list.is_revoked(c->email, c->iat);
+                bench::keep(revoked);
+            });
+            std::printf(" %12.1f (%4.1f%%)", check, 100 * check / verify);
+        }
+        std::printf("\n");
+    }
+}
@@ -0,0 +1,114 @@
+#include "bench.hpp"
+#include "router.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Dispatch cost of router::Table at 3, 20 and 100 routes against the
+// if/else chain handle_request used to be, written as the equivalent scan
+// of the route list (a chain that tells 404 from 405 compares the path
+// against every route). Requests cycle through every routed path with
+// its method (hit), with a method it does not take (405), and through
+// paths that are not routed at all (404); each kind is timed separately.
+
+namespace {
+    using router::verb;
+
+#define TEN(prefix) prefix "0", prefix "1", prefix "2", prefix "3", prefix "4", \
+                    prefix "5", prefix "6", prefix "7", prefix "8", prefix "9"
+
+    // The service's routes first, then ones like those it may grow
+    constexpr std::string_view kPaths[] = {
+        "/register", "/login", "/delete", "/metrics", "/admin/snapshot", "/admin/import", "/verify", "/refresh",
+        "/logout", "/users/me", TEN("/api/v1/accounts/"), TEN("/api/v1/sessions/"), TEN("/api/v1/tokens/"),
+        TEN("/admin/users/"), TEN("/admin/stats/"), TEN("/oauth/"), TEN("/v2/"), TEN("/internal/health/"),
+        TEN("/x"),
+    };
+    static_assert(std::size(kPaths) == 100);
+
+#undef TEN
+
+    constexpr verb method_for(std::size_t i) {
+        return i % 3 == 0 ? verb::post : i % 3 == 1 ? verb::get : verb::delete_;
+    }
+
+    template<std::size_t N>
+    struct RouteList {
+        router::Route<int> routes[N];
+    };
+
+    template<std::size_t N>
+    constexpr RouteList<N> make_routes() {
+        RouteList<N> list{};
+        for (std::size_t i = 0; i < N; ++i) {
+            list.routes[i] = {kPaths[i], method_for(i), static_cast<int>(i + 1)};
+        }
+        return list;
+    }
+
+    template<std::size_t N>
+    router::Match<int> chain(const RouteList<N>& list, std::string_view path, verb method) {
+        router::Match<int> match;
+        for (const router::Route<int>& r : list.routes) {
+            if (r.path == path) {
+                match.allowed |= router::method_bit(r.method);
+                if (r.method == method) {
+                    match.handler = r.handler;
+                }
+            }
+        }
+        return match;
+    }
+
+    struct Request {
+        std::string path;
+        verb method;
+    };
+
+    template<std::size_t N>
+    void run() {
+        static constexpr RouteList<N> kRoutes = make_routes<N>();
+        static constexpr router::Table<int, N> kTable(kRoutes.routes);
+
+        std::vector<Request> hits, wrong_method, unknown;
+        for (std::size_t i = 0; i < N; ++i) {
+            hits.push_back({std::string(kPaths[i]), method_for(i)});
+            wrong_method.push_back({std::string(kPaths[i]), verb::put});
+            unknown.push_back({std::string(kPaths[i]) + "/x", method_for(i)});
+        }
+        std::printf("%6zu", N);
+        for (const std::vector<Request>* requests : {&hits, &wrong_method, &unknown}) {
+            for (const Request& r : *requests) {
+                router::Match<int> a = kTable.find(r.path, r.method);
+                router::Match<int> b = chain(kRoutes, r.path, r.method);
+                if (a.handler != b.handler || a.allowed != b.allowed) {
+                    std::fprintf(stderr, "\ntable and chain disagree on %s\n", r.path.c_str());
+                    std::exit(1);
+                }
+            }
+            std::size_t i = 0;
+            double table = bench::ns_per_call([&] {
+                const Request& r = (*requests)[i++ % requests->size()];
+                router::Match<int> m = kTable.find(r.path, r.method);
+                bench::keep(m);
+            });
+            i = 0;
+            double scan = bench::ns_per_call([&] {
+                const Request& r = (*requests)[i++ % requests->size()];
+                router::Match<int> m = chain(kRoutes, r.path, r.method);
+                bench::keep(m);
+            });
+            std::printf(" %8.1f %8.1f", table, scan);
+        }
+        std::printf("\n");
+    }
+}
+
+int main() {
+    std::printf("nanoseconds per dispatch, perfect-hash table against an if/else chain\n");
+    std::printf("%6s %17s %17s %17s\n", "", "hit", "405", "404");
+    std::printf("%6s %8s %8s %8s %8s %8s %8s\n", "routes", "table", "chain", "table", "chain", "table", "chain");
+    run<3>();
+    run<20>();
+    run<100>();
+}
@@ -0,0 +1,115 @@
+#include "bench.hpp"
+#include "hmac.hpp"
+#include "sha256.hpp"
+#include <cstdio>
+#include <cstring>
+#include <openssl/sha.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Every SHA-256 compression kernel and every hmac_many kernel this CPU
+// supports, not just the ones picked at startup, with OpenSSL's SHA256()
+// as the reference. Each kernel's output is checked against OpenSSL
+// before it is timed.
+//
+//   sha256_bench [--sizes=32,64,256,1024,16384] [--mac-bytes=32]
+
+namespace {
+    // sha256::hash with the compression function given explicitly
+    void hash_with(const sha256::Kernel& kernel, const unsigned char* p, std::size_t len, unsigned char* out) {
+        std::uint32_t state[8];
+        std::memcpy(state, sha256::kInitialState, sizeof(state));
+        std::size_t full = len / sha256::kBlockSize;
+        kernel.compress(state, p, full);
+
+        unsigned char tail[2 * sha256::kBlockSize] = {};
+        std::size_t rest = len % sha256::kBlockSize;
+        std::memcpy(tail, p + full * sha256::kBlockSize, rest);
+        tail[rest] = 0x80;
+        std::size_t tail_size = rest + 9 <= sha256::kBlockSize ? sha256::kBlockSize : 2 * sha256::kBlockSize;
+        std::uint64_t bits = static_cast<std::uint64_t>(len) * 8;
+        for (int i = 1; i <= 8; ++i) {
+            tail[tail_size - i] = static_cast<unsigned char>(bits >> (8 * (i - 1)));
+        }
+        kernel.compress(state, tail, tail_size / sha256::kBlockSize);
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b) {
+                out[4 * i + b] = static_cast<unsigned char>(state[i] >> (24 - 8 * b));
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> sizes = args.list("sizes", {32, 64, 256, 1024, 16384});
+    std::size_t mac_bytes = args.get("mac-bytes", std::uint64_t{32});
+
+    std::mt19937_64 rng(1);
+    std::vector<unsigned char> data(*std::max_element(sizes.begin(), sizes.end()));
+    for (unsigned char& c : data) {
+        c = static_cast<unsigned char>(rng());
+    }
+    std::vector<sha256::Kernel> kernels = sha256::supported_kernels();
+
+    std::printf("SHA-256, in use: %s; nanoseconds per hash (MB/s)\n", sha256::implementation());
+    std::printf("%8s %20s", "bytes", "openssl");
+    for (const sha256::Kernel& k : kernels) {
+        std::printf(" %20s", k.name);
+    }
+    std::printf("\n");
+    for (std::size_t size : sizes) {
+        unsigned char expected[sha256::kDigestSize];
+        SHA256(data.data(), size, expected);
+        double ns = bench::ns_per_call([&] {
+            unsigned char out[sha256::kDigestSize];
+            SHA256(data.data(), size, out);
+            bench::keep(out);
+        });
+        std::printf("%8zu %11.1f (%6.0f)", size, ns, static_cast<double>(size) * 1e3 / ns);
+        for (const sha256::Kernel& k : kernels) {
+            unsigned char out[sha256::kDigestSize];
+            hash_with(k, data.data(), size, out);
+            if (std::memcmp(out, expected, sizeof(out)) != 0) {
+                std::fprintf(stderr, "\n%s disagrees with OpenSSL at %zu bytes\n", k.name, size);
+                return 1;
+            }
+            ns = bench::ns_per_call([&] {
+                hash_with(k, data.data(), size, out);
+                bench::keep(out);
+            });
+            std::printf(" %11.1f (%6.0f)", ns, static_cast<double>(size) * 1e3 / ns);
+        }
+        std::printf("\n");
+    }
+
+    // hmac_many over a full pass of each kernel's lanes
+    const crypto::HmacSha256& key = crypto::password_key();
+    std::printf("\nhmac_many, in use: %s; %zu-byte messages, nanoseconds per MAC\n",
+                crypto::hmac_many_implementation(), mac_bytes);
+    for (const crypto::MacKernel& k : crypto::supported_mac_kernels()) {
+        std::vector<std::string> messages(k.lanes);
+        std::vector<crypto::Digest> out(k.lanes);
+        std::vector<crypto::MacJob> jobs(k.lanes);
+        for (std::size_t i = 0; i < k.lanes; ++i) {
+            messages[i].resize(mac_bytes);
+            for (char& c : messages[i]) {
+                c = static_cast<char>(rng());
+            }
+            jobs[i] = {&key, messages[i].data(), messages[i].size(), out[i].data()};
+        }
+        k.run(jobs.data(), jobs.size());
+        for (std::size_t i = 0; i < k.lanes; ++i) {
+            if (out[i] != key.mac(messages[i])) {
+                std::fprintf(stderr, "%s lane %zu disagrees with HmacSha256\n", k.name, i);
+                return 1;
+            }
+        }
+        double ns = bench::ns_per_call([&] {
+            k.run(jobs.data(), jobs.size());
+            bench::keep(out);
+        });
+        std::printf("%-12s %2zu lanes %10.1f\n", k.name, k.lanes, ns / static_cast<double>(k.lanes));
+    }
+}
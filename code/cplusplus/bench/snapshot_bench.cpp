@@ -0,0 +1,112 @@
+#include "bench.hpp"
+#include "user_store.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+// Time from process start to the first successful login, booting from a
+// snapshot of --users accounts against replaying the same accounts from
+// the write-ahead log. Both files are built first in a temporary
+// directory under --dir; before each boot they are synced and dropped
+// from the page cache, so "cold" reads them from disk as a restart would
+// (--cache=warm leaves them cached). The snapshot path is what main does:
+// Snapshot::open with one verify thread per hardware thread, then
+// attach_snapshot.
+//
+//   snapshot_bench [--users=1000000] [--dir=PATH] [--cache=cold|warm]
+//
+// The request's measurement is --users=10000000.
+
+namespace {
+    std::string password_for(std::size_t i) {
+        return "password" + std::to_string(i);
+    }
+
+    // Writes back and drops the file's cached pages
+    void evict(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::perror(path.c_str());
+            return;
+        }
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+
+    void report(const char* boot, double load_ms, double first_login_ms, bool ok) {
+        std::printf("%-10s %12.1f %14.3f %14.1f%s\n", boot, load_ms, first_login_ms, load_ms + first_login_ms,
+                    ok ? "" : "  (login FAILED)");
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::size_t users = std::max<std::uint64_t>(1, args.get("users", std::uint64_t{1000000}));
+    bool warm = args.get("cache", std::string("cold")) == "warm";
+    bench::TempDir dir(args.get("dir", std::string()));
+    std::string wal_path = dir.file("users.wal");
+    std::string snapshot_path = dir.file("users.snapshot");
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+    {
+        auto started = bench::Clock::now();
+        UserStore store;
+        store.reserve(users);
+        WriteAheadLog::Options options;
+        options.path = wal_path;
+        options.durability = WriteAheadLog::Durability::Async;
+        store.attach_log(std::make_shared<WriteAheadLog>(options));
+        for (std::size_t i = 0; i < users; ++i) {
+            store.add_user(bench::user_email(i), password_for(i));
+        }
+        double build = bench::seconds_since(started);
+        started = bench::Clock::now();
+        store.save_snapshot(snapshot_path);
+        std::printf("%zu users: registered in %.1f s, snapshot saved in %.1f s\n", users, build,
+                    bench::seconds_since(started));
+    }
+
+    // The last user registered, so the log has to be read to the end
+    std::size_t probe = users - 1;
+    std::string email = bench::user_email(probe);
+    std::string password = password_for(probe);
+
+    std::printf("%s page cache; times in milliseconds\n", warm ? "warm" : "cold");
+    std::printf("%-10s %12s %14s %14s\n", "boot", "load", "first login", "total");
+    {
+        if (!warm) {
+            evict(snapshot_path);
+        }
+        auto started = bench::Clock::now();
+        UserStore store;
+        store.attach_snapshot(Snapshot::open(snapshot_path, threads));
+        double load = bench::seconds_since(started) * 1e3;
+        started = bench::Clock::now();
+        bool ok = store.authenticate_user(email, password);
+        report("snapshot", load, bench::seconds_since(started) * 1e3, ok);
+    }
+    {
+        if (!warm) {
+            evict(wal_path);
+        }
+        auto started = bench::Clock::now();
+        UserStore store;
+        WriteAheadLog::replay(wal_path, [&store](const WriteAheadLog::Record& record) {
+            std::string email(record.email);
+            if (record.type == WriteAheadLog::RecordType::AddUser) {
+                store.restore_user(email, record.credential);
+            } else if (record.type == WriteAheadLog::RecordType::DeleteUser) {
+                store.delete_user(email);
+            }
+        });
+        double load = bench::seconds_since(started) * 1e3;
+        started = bench::Clock::now();
+        bool ok = store.authenticate_user(email, password);
+        report("log replay", load, bench::seconds_since(started) * 1e3, ok);
+    }
+}
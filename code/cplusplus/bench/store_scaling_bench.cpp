@@ -0,0 +1,86 @@
+#include "bench.hpp"
+#include "legacy.hpp"
+#include "user_store.hpp"
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Login throughput of the user store from 1 to 64 threads, against the
+// single-mutex map it replaced. Every thread logs in as random existing
+// users for --seconds per step. Scaling can only show up to the number
+// of cores the machine has.
+//
+//   store_scaling_bench [--users=100000] [--threads=1,2,4,8,16,32,64] [--seconds=0.5]
+
+namespace {
+    std::string password_for(std::size_t i) {
+        return "password" + std::to_string(i);
+    }
+
+    template<class Store>
+    double logins_per_second(Store& store, std::size_t users, std::size_t threads, double seconds) {
+        std::atomic<bool> go{false}, stop{false};
+        std::atomic<std::uint64_t> total{0};
+        std::vector<std::thread> workers;
+        for (std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937_64 rng(t);
+                std::vector<std::pair<std::string, std::string>> picks;
+                for (int i = 0; i < 1024; ++i) {
+                    std::size_t u = rng() % users;
+                    picks.emplace_back(bench::user_email(u), password_for(u));
+                }
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                std::uint64_t done = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    const auto& pick = picks[done & 1023];
+                    bool ok = store.authenticate_user(pick.first, pick.second);
+                    bench::keep(ok);
+                    ++done;
+                }
+                total.fetch_add(done);
+            });
+        }
+        auto start = bench::Clock::now();
+        go.store(true, std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop.store(true);
+        for (std::thread& w : workers) {
+            w.join();
+        }
+        return static_cast<double>(total.load()) / bench::seconds_since(start);
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::size_t users = args.get("users", std::uint64_t{100000});
+    std::vector<std::uint64_t> thread_counts = args.list("threads", {1, 2, 4, 8, 16, 32, 64});
+    double seconds = args.get("seconds", 0.5);
+
+    UserStore store;
+    legacy::UserStore before;
+    for (std::size_t i = 0; i < users; ++i) {
+        store.add_user(bench::user_email(i), password_for(i));
+        before.add_user(bench::user_email(i), password_for(i));
+    }
+
+    std::printf("%zu users, %u hardware threads, %zu shards\n", users, std::thread::hardware_concurrency(),
+                store.shard_count());
+    std::printf("%8s %16s %9s %16s %9s\n", "threads", "before logins/s", "scaling", "after logins/s", "scaling");
+    double before_base = 0, after_base = 0;
+    for (std::uint64_t threads : thread_counts) {
+        double b = logins_per_second(before, users, threads, seconds);
+        double a = logins_per_second(store, users, threads, seconds);
+        if (before_base == 0) {
+            before_base = b;
+            after_base = a;
+        }
+        std::printf("%8llu %16.0f %8.2fx %16.0f %8.2fx\n", static_cast<unsigned long long>(threads), b,
+                    b / before_base, a, a / after_base);
+    }
+}
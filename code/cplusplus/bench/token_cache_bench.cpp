@@ -0,0 +1,84 @@
+#include "bench.hpp"
+#include "jwt.hpp"
+#include "token_cache.hpp"
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+// Token minting as test/auth_bench_worker.ts drives it: each worker
+// registers a user, logs in as that user --logins times back to back,
+// deletes it and moves on to the next. --threads workers run at once, each
+// with its own users, for --users users in total. Runs the minting step of
+// reply_new_token with and without the token cache (invalidated on
+// delete, as handle_delete does) and reports the CPU time spent minting.
+//
+//   token_cache_bench [--users=2000] [--logins=2000] [--threads=4] [--entries=4096]
+
+namespace {
+    double thread_cpu_seconds() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+    }
+
+    struct Result {
+        double wall = 0;
+        double cpu = 0;
+    };
+
+    Result run(TokenCache* cache, std::size_t users, std::size_t logins, std::size_t threads) {
+        std::atomic<std::size_t> next_user{0};
+        std::vector<double> cpu(threads);
+        std::vector<std::thread> workers;
+        auto start = bench::Clock::now();
+        for (std::size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                double cpu_start = thread_cpu_seconds();
+                for (std::size_t u; (u = next_user.fetch_add(1)) < users;) {
+                    std::string email = bench::user_email(u);
+                    for (std::size_t i = 0; i < logins; ++i) {
+                        std::int64_t iat = JWT::current_second();
+                        std::string token = cache ? cache->mint(email, iat) : JWT::create_at(email, iat);
+                        bench::keep(token);
+                    }
+                    if (cache) {
+                        cache->invalidate(email);
+                    }
+                }
+                cpu[t] = thread_cpu_seconds() - cpu_start;
+            });
+        }
+        for (std::thread& w : workers) {
+            w.join();
+        }
+        Result r;
+        r.wall = bench::seconds_since(start);
+        for (double c : cpu) {
+            r.cpu += c;
+        }
+        return r;
+    }
+
+    void row(const char* what, const Result& r, double mints, const Result& baseline) {
+        std::printf("%-18s %10.0f %14.1f %10.1f%%\n", what, mints / r.wall, r.cpu * 1e9 / mints,
+                    100 * (1 - r.cpu / baseline.cpu));
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::size_t users = args.get("users", std::uint64_t{2000});
+    std::size_t logins = args.get("logins", std::uint64_t{2000});
+    std::size_t threads = std::max<std::uint64_t>(1, args.get("threads", std::uint64_t{4}));
+    std::size_t entries = args.get("entries", std::uint64_t{4096});
+    double mints = static_cast<double>(users * logins);
+
+    std::printf("%zu users x %zu logins on %zu threads\n", users, logins, threads);
+    std::printf("%-18s %10s %14s %11s\n", "", "mints/s", "CPU ns/mint", "CPU saved");
+    Result uncached = run(nullptr, users, logins, threads);
+    row("no cache", uncached, mints, uncached);
+    TokenCache cache(entries);
+    row("token cache", run(&cache, users, logins, threads), mints, uncached);
+}
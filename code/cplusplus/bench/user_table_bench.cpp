@@ -0,0 +1,144 @@
+#include "bench.hpp"
+#include "epoch.hpp"
+#include "legacy.hpp"
+#include "password_hash.hpp"
+#include "user_store.hpp"
+#include <malloc.h>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Heap per user, build time and single-thread lookups per second of the
+// flat user table against the std::unordered_map<std::string, std::string>
+// of hex digests it replaced, at each of --users.
+//
+//   user_table_bench [--users=1000000] [--lookups=2000000]
+//
+// The request sizes are --users=1000000,10000000,50000000, which takes
+// tens of gigabytes.
+
+namespace {
+    // Bytes malloc has handed out and not had back, including mmapped
+    // chunks, so the figure does not depend on what the allocator keeps
+    // cached
+    std::size_t heap_in_use() {
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    }
+
+    // Frees whatever earlier tables left waiting out their epochs
+    void drain_epochs() {
+        for (int i = 0; i < 3; ++i) {
+            epoch::collect();
+        }
+    }
+
+    // Best of three passes, as other work on the machine only slows one down
+    template<class Lookup>
+    double lookups_per_second(const std::vector<std::string>& queries, Lookup&& lookup) {
+        double best = 0;
+        for (int pass = 0; pass < 3; ++pass) {
+            std::size_t found = 0;
+            auto start = bench::Clock::now();
+            for (const std::string& email : queries) {
+                found += lookup(email);
+            }
+            best = std::max(best, static_cast<double>(queries.size()) / bench::seconds_since(start));
+            bench::keep(found);
+        }
+        return best;
+    }
+
+    struct Result {
+        double bytes_per_user;
+        double build_seconds;
+        double lookups_per_second;
+    };
+
+    void print(const char* name, std::size_t users, const Result& r) {
+        std::printf("%10zu %-22s %10.1f %10.2f %14.0f\n", users, name, r.bytes_per_user, r.build_seconds,
+                    r.lookups_per_second);
+    }
+
+    std::vector<std::string> random_emails(std::size_t users, std::size_t count) {
+        std::mt19937_64 rng(7);
+        std::vector<std::string> out;
+        out.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            out.push_back(bench::user_email(rng() % users));
+        }
+        return out;
+    }
+
+    Result measure_map(std::size_t users, const std::vector<std::string>& queries) {
+        Result r{};
+        std::string digest = legacy::hash_password("password");
+        std::size_t before = heap_in_use();
+        auto start = bench::Clock::now();
+        {
+            std::unordered_map<std::string, std::string> map;
+            for (std::size_t i = 0; i < users; ++i) {
+                map[bench::user_email(i)] = digest;
+            }
+            r.build_seconds = bench::seconds_since(start);
+            r.bytes_per_user = static_cast<double>(heap_in_use() - before) / static_cast<double>(users);
+
+            r.lookups_per_second = lookups_per_second(queries, [&](const std::string& email) {
+                return map.find(email) != map.end();
+            });
+        }
+        malloc_trim(0);
+        return r;
+    }
+
+    Result measure_store(std::size_t users, bool reserve, const std::vector<std::string>& queries) {
+        Result r{};
+        crypto::Credential credential = crypto::make_credential("password");
+        drain_epochs();
+        std::size_t before = heap_in_use();
+        auto start = bench::Clock::now();
+        {
+            UserStore store;
+            if (reserve) {
+                store.reserve(users);
+            }
+            std::vector<UserStore::NewUser> batch;
+            for (std::size_t i = 0; i < users; ++i) {
+                batch.push_back({bench::user_email(i), credential});
+                if (batch.size() == 65536 || i + 1 == users) {
+                    store.add_users(batch);
+                    batch.clear();
+                }
+            }
+            batch.shrink_to_fit();
+            // Tables outgrown during the build are freed once their epochs
+            // pass; count only what the store still holds
+            drain_epochs();
+            r.build_seconds = bench::seconds_since(start);
+            r.bytes_per_user = static_cast<double>(heap_in_use() - before) / static_cast<double>(users);
+
+            crypto::Credential out;
+            r.lookups_per_second = lookups_per_second(queries, [&](const std::string& email) {
+                return store.lookup_credential(email, out);
+            });
+        }
+        malloc_trim(0);
+        return r;
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> sizes = args.list("users", {1000000});
+    std::size_t lookups = args.get("lookups", std::uint64_t{2000000});
+
+    std::printf("%10s %-22s %10s %10s %14s\n", "users", "table", "bytes/user", "build s", "lookups/s");
+    for (std::uint64_t users : sizes) {
+        std::vector<std::string> queries = random_emails(users, lookups);
+        print("unordered_map (before)", users, measure_map(users, queries));
+        print("flat table", users, measure_store(users, false, queries));
+        print("flat table, reserved", users, measure_store(users, true, queries));
+    }
+}
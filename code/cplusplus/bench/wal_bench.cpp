@@ -0,0 +1,110 @@
+#include "bench.hpp"
+#include "user_store.hpp"
+#include "wal.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Register throughput with the write-ahead log in each durability mode.
+// Every client thread registers fresh users back to back, waiting for
+// each to be acknowledged the way handle_register does before sending
+// its reply. "no log" is the store on its own, for reference. The log
+// lives in a temporary directory under --dir (default $TMPDIR), so point
+// it at the disk the service will use: fdatasync costs are the point.
+//
+//   wal_bench [--clients=1,16,64] [--seconds=2] [--group-delay-us=500] [--dir=PATH]
+
+namespace {
+    // Blocks a client until its record is acknowledged
+    class Waiter {
+    public:
+        void done() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            cv_.notify_one();
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return done_; });
+            done_ = false;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool done_ = false;
+    };
+
+    void run(const char* mode, const WriteAheadLog::Options* options, std::size_t clients, double seconds) {
+        UserStore store;
+        if (options) {
+            store.attach_log(std::make_shared<WriteAheadLog>(*options));
+        }
+
+        std::atomic<bool> running{true};
+        std::vector<bench::Latencies> latencies(clients);
+        std::vector<std::thread> threads;
+        for (std::size_t c = 0; c < clients; ++c) {
+            threads.emplace_back([&, c] {
+                Waiter waiter;
+                bench::Latencies& out = latencies[c];
+                for (std::size_t i = 0; running.load(std::memory_order_relaxed); ++i) {
+                    std::string email = "c" + std::to_string(c) + "-" + bench::user_email(i);
+                    auto start = bench::Clock::now();
+                    std::uint64_t lsn = 0;
+                    store.add_user(email, "password", &lsn);
+                    if (lsn != 0) {
+                        store.when_durable(lsn, [&waiter] { waiter.done(); });
+                        waiter.wait();
+                    }
+                    out.add(bench::Clock::now() - start);
+                }
+            });
+        }
+        auto start = bench::Clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        running.store(false);
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        double elapsed = bench::seconds_since(start);
+
+        bench::Latencies all;
+        for (const bench::Latencies& l : latencies) {
+            all.merge(l);
+        }
+        std::printf("%-8s %8zu %12.0f %9.1f %9.1f %9.1f\n", mode, clients,
+                    static_cast<double>(all.size()) / elapsed, all.percentile_us(50), all.percentile_us(99),
+                    all.percentile_us(100));
+    }
+}
+
+int main(int argc, char** argv) {
+    bench::Args args(argc, argv);
+    std::vector<std::uint64_t> clients = args.list("clients", {1, 16, 64});
+    double seconds = args.get("seconds", 2.0);
+    bench::TempDir dir(args.get("dir", std::string()));
+
+    std::printf("log in %s; latencies in microseconds\n", dir.path().c_str());
+    std::printf("%-8s %8s %12s %9s %9s %9s\n", "mode", "clients", "registers/s", "p50", "p99", "max");
+    const std::pair<const char*, WriteAheadLog::Durability> modes[] = {
+        {"sync", WriteAheadLog::Durability::Sync},
+        {"group", WriteAheadLog::Durability::Group},
+        {"async", WriteAheadLog::Durability::Async},
+    };
+    for (std::size_t n : clients) {
+        run("no log", nullptr, n, seconds);
+        for (const auto& [name, durability] : modes) {
+            WriteAheadLog::Options options;
+            options.path = dir.file(name);
+            options.durability = durability;
+            options.group_delay = std::chrono::microseconds(args.get("group-delay-us", std::uint64_t{500}));
+            run(name, &options, n, seconds);
+        }
+    }
+}
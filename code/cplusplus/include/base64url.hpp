@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// Unpadded base64url (RFC 4648 section 5), as used by JWTs.
+//
+// Both directions write into caller-provided buffers and pick an AVX2,
+// SSSE3 or portable kernel once, based on the CPU the process runs on.
+namespace base64url {
+    constexpr std::size_t encoded_size(std::size_t len) {
+        return (len * 4 + 2) / 3;
+    }
+
+    // Exact for valid input
+    constexpr std::size_t decoded_size(std::size_t len) {
+        return len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+    }
+
+    // Writes exactly encoded_size(len) characters to out
+    void encode(const void* data, std::size_t len, char* out);
+
+    // Returns the number of bytes written, or -1 if the input is not
+    // canonical base64url (unused trailing bits must be zero) or would
+    // need more than capacity bytes
+    std::ptrdiff_t decode(std::string_view in, void* out, std::size_t capacity);
+
+    // Name of the kernel in use, for logs
+    const char* implementation();
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for CPU-heavy request work, e.g. password KDFs, so
+// that it never runs on (and stalls) the io_context threads.
+//
+// The queue is bounded: submit() refuses work once max_queued jobs are
+// waiting, so an overload turns into fast rejections instead of unbounded
+// latency for everyone. Where the platform allows, the threads are
+// scheduled as batch work, so I/O threads win the CPU whenever they have
+// something to do. Queue depth, waits and rejections are exported as
+// auth_compute_* metrics.
+class ComputePool {
+public:
+    struct Options {
+        // 0 means one per hardware thread
+        unsigned threads = 0;
+        std::size_t max_queued = 1024;
+    };
+
+    explicit ComputePool(Options options);
+    ~ComputePool();
+
+    ComputePool(const ComputePool&) = delete;
+    ComputePool& operator=(const ComputePool&) = delete;
+
+    // Queues job; false (and job is dropped) if the queue is full. Jobs
+    // should not throw; anything they do throw is logged and dropped.
+    bool submit(std::function<void()> job);
+
+    std::size_t thread_count() const { return workers_.size(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::function<void()> run;
+        Clock::time_point queued;
+    };
+
+    void run();
+
+    Options options_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<Job> queue_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
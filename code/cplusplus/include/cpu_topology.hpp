@@ -0,0 +1,26 @@
+#pragma once
+#include <string_view>
+#include <vector>
+
+// Which CPUs the process may run on and which NUMA node each belongs to,
+// read from the affinity mask and /sys so there is no libnuma dependency.
+namespace cpu_topology {
+    struct Cpu {
+        unsigned id;
+        int node; // -1 when the kernel does not report NUMA nodes
+    };
+
+    // Parses a kernel-style list such as "0-3,8,10-11" into ascending ids;
+    // false if it is malformed
+    bool parse_cpu_list(std::string_view list, std::vector<unsigned>& cpus);
+
+    // CPUs in the process affinity mask, grouped by node
+    std::vector<Cpu> allowed();
+
+    // The given CPUs with their nodes, grouped by node; ids outside the
+    // affinity mask are dropped
+    std::vector<Cpu> resolve(const std::vector<unsigned>& ids);
+
+    // Pins the calling thread to one CPU
+    bool pin_current_thread(unsigned cpu);
+}
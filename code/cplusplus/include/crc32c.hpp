@@ -0,0 +1,10 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), as used by iSCSI, ext4 and most storage formats.
+// Uses the SSE4.2 or ARMv8 crc32c instructions when the CPU has them.
+std::uint32_t crc32c(const void* data, std::size_t len, std::uint32_t crc = 0);
+
+// Kernel crc32c uses, for logs and metrics
+const char* crc32c_implementation();
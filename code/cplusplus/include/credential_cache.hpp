@@ -0,0 +1,66 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "crypto.hpp"
+
+// Recent successful password checks, so that accounts which log in over
+// and over skip the KDF for a while.
+//
+// Entries are LoginFingerprints of verified logins. Since a fingerprint
+// covers the stored credential, a deleted, re-registered or re-keyed
+// account can never match an entry made for its old credential; delete
+// also calls invalidate() so such entries do not linger. Each entry
+// lives at most ttl.
+//
+// Bounded and sharded like TokenCache: the email picks a shard and a slot,
+// and a new entry overwrites the slot's previous one. Hits, misses,
+// evictions (expired or overwritten entries) and invalidations are
+// counted in the auth_credential_cache_* metrics.
+class CredentialCache {
+public:
+    struct Options {
+        // Rounded up to a power of two per shard
+        std::size_t capacity = 4096;
+        std::chrono::milliseconds ttl{60000};
+    };
+
+    explicit CredentialCache(Options options);
+
+    CredentialCache(const CredentialCache&) = delete;
+    CredentialCache& operator=(const CredentialCache&) = delete;
+
+    // Whether the login with this fingerprint was verified within the TTL
+    bool contains(std::string_view email, const crypto::Digest& fingerprint);
+
+    // Records a login that just passed verification
+    void insert(std::string_view email, const crypto::Digest& fingerprint);
+
+    // Drops any entry for email
+    void invalidate(std::string_view email);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        Clock::time_point expires;
+        std::string email; // empty when the slot is free
+        crypto::Digest fingerprint;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<Slot> slots;
+    };
+
+    // Locks the shard for email and returns it with the slot email maps to
+    Slot& slot_for(std::string_view email, std::unique_lock<std::mutex>& lock);
+
+    Options options_;
+    std::unique_ptr<Shard[]> shards_;
+    std::size_t slot_mask_;
+};
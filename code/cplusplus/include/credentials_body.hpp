@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// The {"email": ..., "password": ...} bodies of /register and /login,
+// read without building a JSON document.
+//
+// The whole body is validated as JSON exactly as nlohmann::json::parse
+// would (including UTF-8, escapes and number overflow), and the parse
+// fails unless it is an object whose "email" and "password" members are
+// strings; as with nlohmann, the last of repeated members wins. Strings
+// are scanned with SIMD kernels picked for the CPU at startup.
+namespace credentials_body {
+    struct Fields {
+        std::string_view email;
+        std::string_view password;
+    };
+
+    // Fields point into body, or into scratch for strings with escapes.
+    // scratch is cleared first, so one can be reused across calls and
+    // keeps its capacity.
+    bool parse(std::string_view body, Fields& fields, std::string& scratch);
+
+    // Kernel the string scan uses, for logs and metrics
+    const char* implementation();
+}
@@ -1,10 +1,67 @@
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace crypto {
-    // Hash a password using HMAC-SHA256 with a secret key
-    std::string hash_password(const std::string& password);
-    
-    // Verify a password against its hash
-    bool verify_password(const std::string& password, const std::string& hash);
+    constexpr std::size_t kDigestSize = 32;
+
+    // Raw HMAC-SHA256 output; hex only appears at export/debug boundaries
+    using Digest = std::array<unsigned char, kDigestSize>;
+
+    // Ways a stored credential can have been hashed. Values are persisted.
+    enum class Scheme : std::uint8_t {
+        // HMAC-SHA256 under the service secret, unsalted; every user hashed
+        // before credentials carried a scheme has one of these
+        HmacSha256 = 0,
+        Pbkdf2Sha256 = 1,
+        Scrypt = 2,
+    };
+
+    constexpr std::size_t kSaltSize = 16;
+
+    // A user's password hash plus the parameters that produced it, so users
+    // hashed under different schemes or costs coexist in one store
+    struct Credential {
+        Scheme scheme = Scheme::HmacSha256;
+        // Work factor: PBKDF2 iterations, log2(N) for scrypt, 0 otherwise
+        std::uint32_t cost = 0;
+        std::array<unsigned char, kSaltSize> salt{};
+        Digest hash{};
+
+        // Wraps a digest from before credentials had a scheme
+        static Credential legacy(const Digest& digest) {
+            Credential credential;
+            credential.hash = digest;
+            return credential;
+        }
+    };
+
+    // Fixed-size little-endian encoding used by the log and snapshots:
+    // [u8 scheme][3 zero bytes][u32 cost][16 salt][32 hash]
+    constexpr std::size_t kCredentialSize = 8 + kSaltSize + kDigestSize;
+    void encode_credential(const Credential& credential, unsigned char* out);
+    // False if the scheme is unknown
+    bool decode_credential(const unsigned char* in, Credential& credential);
+
+    // Hash a password using HMAC-SHA256 with a secret key (Scheme::HmacSha256)
+    Digest hash_password(std::string_view password);
+
+    // Verify a password against its hash in constant time
+    bool verify_password(std::string_view password, const Digest& hash);
+
+    // Constant-time digest comparison
+    bool digest_equal(const Digest& a, const Digest& b);
+
+    // Constant-time comparison of two secrets of any length, e.g. an
+    // admin token; neither the contents nor the length leak through timing
+    bool secret_equal(std::string_view a, std::string_view b);
+
+    // Lowercase hex encoding of a digest, for export and debugging
+    std::string to_hex(const Digest& digest);
+
+    // Parses 64 hex digits (either case); false on anything else
+    bool from_hex(std::string_view hex, Digest& digest);
 }
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// The longest email an account may have. Register and import turn longer
+// ones away, UserStore refuses to add them and the write-ahead log refuses
+// to record them. Log replay accepts far longer emails, so every user
+// that was accepted survives a restart.
+namespace email_limits {
+    // The longest address RFC 5321 lets fit in a path
+    constexpr std::size_t kMaxEmailSize = 254;
+
+    constexpr bool acceptable(std::string_view email) {
+        return !email.empty() && email.size() <= kMaxEmailSize;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+// Epoch-based reclamation for read-mostly structures.
+//
+// Readers wrap every access to shared nodes in an epoch::Guard. Entering a
+// guard only stores to the calling thread's own cache line, so concurrent
+// readers never contend. Writers unlink nodes first and then hand them to
+// retire(); a node is freed once every thread that could still see it has
+// left its guard.
+namespace epoch {
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    // Schedule ptr for deletion. Must be called after ptr is unreachable
+    // for new readers.
+    void retire(void* ptr, void (*deleter)(void*));
+
+    template <class T>
+    void retire(T* ptr) {
+        retire(static_cast<void*>(ptr), [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    // Try to advance the epoch and free everything that is safe to free.
+    // Called from retire(); exposed for shutdown and tests.
+    void collect();
+}
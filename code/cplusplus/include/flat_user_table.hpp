@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "crypto.hpp"
+
+// Open-addressing user table with Swiss-table style control bytes.
+//
+// Each slot keeps the password credential inline and points at an out-of-line
+// email key, so a lookup touches one control group, one slot and one key.
+// Probing is linear and scans 16 control bytes per step; erase shifts the
+// rest of the cluster back instead of leaving tombstones, so lookups do
+// not degrade after register/delete churn.
+//
+// The table has a single writer. find() may race with that writer: every
+// key pointer it reads is either null or a live (or epoch-retired) key,
+// and the caller is expected to discard results whose read overlapped a
+// write (UserStore uses a per-shard sequence counter for this).
+class FlatUserTable {
+public:
+    using Credential = crypto::Credential;
+
+    // Immutable email key; the characters follow the header in the same
+    // allocation. An erased key records that the user was deleted after
+    // being loaded from a snapshot; its slot's credential is meaningless.
+    struct EmailKey {
+        std::size_t hash;
+        std::uint32_t size;
+        bool erased;
+
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+        std::string_view view() const { return {data(), size}; }
+
+        static EmailKey* create(std::size_t hash, std::string_view email, bool erased = false);
+        static void destroy(void* key);
+    };
+
+    explicit FlatUserTable(std::size_t capacity);
+
+    FlatUserTable(const FlatUserTable&) = delete;
+    FlatUserTable& operator=(const FlatUserTable&) = delete;
+
+    // Smallest power-of-two capacity that holds n users under the maximum
+    // load factor
+    static std::size_t capacity_for(std::size_t n);
+
+    // Returns the key for email, or null, and copies its credential into
+    // *credential (if non-null)
+    const EmailKey* find(std::size_t hash, std::string_view email, Credential* credential) const;
+
+    // Writer side. insert() requires that the key is absent and that
+    // size() < max_size(); erase() returns the unlinked key, which the
+    // caller owns and must retire.
+    void insert(const EmailKey* key, const Credential& credential);
+    const EmailKey* erase(std::size_t hash, std::string_view email);
+
+    // Writer side. Moves entries starting at slot *cursor into `into`,
+    // examining at most `budget` slots, and advances *cursor. Every slot
+    // below the cursor is empty afterwards, so a cluster never wraps back
+    // into the drained region and entries cannot be skipped by later
+    // erases. Returns true once the whole table has been drained.
+    bool drain_into(FlatUserTable& into, std::size_t* cursor, std::size_t budget);
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return mask_ + 1; }
+    std::size_t max_size() const { return capacity() - capacity() / 8; }
+
+    // Writer side; visits every (key, credential) pair
+    template <class F>
+    void for_each(F&& f) const {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            if (ctrl_[i] != kEmpty) {
+                f(slots_[i].key.load(std::memory_order_relaxed), slots_[i].credential);
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint8_t kEmpty = 0x80;
+    static constexpr std::size_t kGroupWidth = 16;
+
+    struct Slot {
+        std::atomic<const EmailKey*> key{nullptr};
+        Credential credential;
+    };
+
+    static std::uint8_t h2(std::size_t hash) { return static_cast<std::uint8_t>(hash >> 57); }
+
+    void set_ctrl(std::size_t i, std::uint8_t value);
+    std::size_t find_index(std::size_t hash, std::string_view email) const;
+    void erase_at(std::size_t hole);
+
+    std::size_t mask_;
+    std::size_t size_ = 0;
+    // capacity + kGroupWidth - 1 bytes; the tail mirrors the first bytes so
+    // a group load starting near the end wraps without a branch
+    std::unique_ptr<std::uint8_t[]> ctrl_;
+    std::unique_ptr<Slot[]> slots_;
+};
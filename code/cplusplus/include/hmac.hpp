@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "crypto.hpp"
+#include "sha256.hpp"
+
+namespace crypto {
+    // HMAC-SHA256 under a fixed key.
+    //
+    // The key is padded and absorbed into the inner and outer SHA-256
+    // states once, at construction. Each mac() copies those midstates onto
+    // its own stack and only absorbs the message, so a single instance can
+    // be shared by any number of threads without locks or allocation.
+    class HmacSha256 {
+    public:
+        explicit HmacSha256(std::string_view key);
+
+        void mac(const void* data, std::size_t len, unsigned char* out) const;
+
+        Digest mac(std::string_view message) const {
+            Digest out;
+            mac(message.data(), message.size(), out.data());
+            return out;
+        }
+
+        // SHA-256 chaining values after the ipad / opad block, for engines
+        // that run the compression function themselves
+        const std::uint32_t* inner_midstate() const { return inner_; }
+        const std::uint32_t* outer_midstate() const { return outer_; }
+
+    private:
+        std::uint32_t inner_[8];
+        std::uint32_t outer_[8];
+    };
+
+    // The key hash_password uses, for callers that batch password checks
+    // through hmac_many
+    const HmacSha256& password_key();
+
+    struct MacJob {
+        const HmacSha256* key;
+        const void* data;
+        std::size_t len;
+        unsigned char* out; // 32 bytes
+    };
+
+    // Runs many independent MACs at once, 16 per pass with AVX-512 or 8
+    // with AVX2 (picked at startup), one at a time otherwise. AVX2 is
+    // skipped when SHA-256 has hardware support, which beats it. Pays off
+    // when messages are short and there are several of them; keys may
+    // differ between jobs.
+    void hmac_many(const MacJob* jobs, std::size_t count);
+
+    // Kernel hmac_many uses, for logs and metrics
+    const char* hmac_many_implementation();
+
+    struct MacKernel {
+        // Runs up to lanes jobs in one pass
+        void (*run)(const MacJob* jobs, std::size_t count);
+        std::size_t lanes;
+        const char* name;
+    };
+    // Every hmac_many kernel this CPU can run, the one in use first, so
+    // benchmarks can compare them
+    std::vector<MacKernel> supported_mac_kernels();
+}
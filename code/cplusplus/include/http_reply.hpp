@@ -0,0 +1,92 @@
+#pragma once
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http/status.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Responses written straight from pre-serialized pieces with one gathered
+// write, instead of being built as Beast messages and serialized per
+// request.
+//
+// Everything that is the same for every response with a given status and
+// content type (status line, Server, Content-Type, CORS headers) is a
+// ReplyHead; a CannedReply adds a fixed body and its Content-Length. Both
+// are built once at startup and shared by all connections. Per response
+// only a Date line (formatted once a second per thread), the Connection
+// header and, for variable bodies, Content-Length are written into the
+// reply's own buffer, so a canned response allocates nothing.
+class ReplyHead {
+public:
+    ReplyHead(boost::beast::http::status status, std::string_view content_type);
+
+private:
+    friend class HttpReply;
+    // Indexed by HTTP minor version
+    std::string lines_[2];
+};
+
+class CannedReply {
+public:
+    CannedReply(boost::beast::http::status status, std::string_view body,
+                std::string_view content_type = "application/json");
+
+private:
+    friend class HttpReply;
+    ReplyHead head_;
+    // Content-Length, the blank line and the body
+    std::string tail_;
+};
+
+class HttpReply {
+public:
+    using Buffers = std::array<boost::asio::const_buffer, 5>;
+
+    template<class Request>
+    void set(const CannedReply& canned, const Request& request) {
+        start(request.version(), request.keep_alive());
+        head_ = &canned.head_;
+        tail_ = canned.tail_;
+    }
+
+    // A response whose body is prefix + body + suffix; the reply keeps
+    // body until it has been written
+    template<class Request>
+    void set(const ReplyHead& head, const Request& request, std::string body,
+             std::string_view prefix = {}, std::string_view suffix = {}) {
+        start(request.version(), request.keep_alive());
+        head_ = &head;
+        prefix_ = prefix;
+        body_ = std::move(body);
+        suffix_ = suffix;
+        variable_ = true;
+    }
+
+    // Adds an Allow header listing methods, one bit per verb
+    void allow(std::uint64_t methods) { allow_ = methods; }
+
+    // Closes the connection after this response
+    void close() { keep_alive_ = false; }
+
+    bool keep_alive() const { return keep_alive_; }
+
+    // The response, valid until the reply is next set
+    Buffers serialize();
+
+private:
+    void start(unsigned version, bool keep_alive);
+
+    const ReplyHead* head_ = nullptr;
+    unsigned minor_ = 1;
+    bool keep_alive_ = true;
+    bool variable_ = false;
+    std::uint64_t allow_ = 0;
+    std::string_view tail_;
+    std::string_view prefix_;
+    std::string body_;
+    std::string_view suffix_;
+    // Date, Connection, Allow and Content-Length lines
+    char lines_[320];
+};
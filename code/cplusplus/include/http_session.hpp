@@ -0,0 +1,58 @@
+#pragma once
+#include <boost/asio/ip/tcp.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "compute_pool.hpp"
+#include "credential_cache.hpp"
+#include "import_runner.hpp"
+#include "login_coalescer.hpp"
+#include "login_fingerprint.hpp"
+#include "mac_batcher.hpp"
+#include "revocation_list.hpp"
+#include "snapshot_saver.hpp"
+#include "token_cache.hpp"
+#include "user_store.hpp"
+
+// The HTTP side of the service: one session per connection, reading
+// requests, routing them to the handlers and writing the replies.
+
+// Everything a session needs besides its socket
+struct Services {
+    std::shared_ptr<UserStore> user_store;
+    // Null unless AUTH_SNAPSHOT_PATH is set
+    std::shared_ptr<SnapshotSaver> snapshot_saver;
+    // Admin endpoints are disabled while this is empty
+    std::string admin_token;
+    // Body limit for POST /admin/import; other requests keep Beast's default
+    std::uint64_t import_max_bytes = 1ull << 30;
+    // Runs POST /admin/import; null while the admin endpoints are disabled
+    std::shared_ptr<ImportRunner> import_runner;
+    // Most responses a connection queues for pipelined requests before
+    // writing them out; 1 writes every response on its own
+    std::size_t pipeline_depth = 16;
+    // Null unless AUTH_MAC_BATCH_DELAY_US is set; /login then hashes
+    // through it instead of on the I/O thread
+    std::shared_ptr<MacBatcher> mac_batcher;
+    // Runs password KDFs (see crypto::is_expensive) off the I/O threads
+    std::shared_ptr<ComputePool> compute_pool;
+    // Keys the coalescer and the credential cache
+    std::shared_ptr<LoginFingerprint> login_fingerprint;
+    // Shares one check between identical concurrent logins on that pool
+    std::shared_ptr<LoginCoalescer> login_coalescer;
+    // Null unless AUTH_CREDENTIAL_CACHE_TTL_MS is set; lets KDF logins
+    // that passed recently skip the hash
+    std::shared_ptr<CredentialCache> credential_cache;
+    // Null if AUTH_TOKEN_CACHE_ENTRIES is 0
+    std::shared_ptr<TokenCache> token_cache;
+    // Tokens issued before their account was deleted
+    std::shared_ptr<RevocationList> revocations;
+};
+
+// Registers the session metrics, so they are exported before the first
+// connection
+void register_http_metrics();
+
+// Serves socket until the client closes it or a reply closes it
+void serve_http(boost::asio::ip::tcp::socket socket, std::shared_ptr<const Services> services);
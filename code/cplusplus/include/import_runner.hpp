@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "user_import.hpp"
+#include "user_store.hpp"
+
+// Runs bulk imports for the admin endpoint, one at a time, on a thread of
+// its own. An import can take minutes and fans out over every core, so
+// it stays off the I/O threads and the compute pool, and a second import
+// while one runs is refused rather than queued. Outcomes are counted in
+// auth_imports_total.
+class ImportRunner {
+public:
+    // Called on the import thread with the stats, or with null and what
+    // went wrong
+    using Done = std::function<void(const user_import::Stats* stats, const std::string& error)>;
+
+    explicit ImportRunner(std::shared_ptr<UserStore> store);
+    // Waits for a running import to finish
+    ~ImportRunner();
+
+    ImportRunner(const ImportRunner&) = delete;
+    ImportRunner& operator=(const ImportRunner&) = delete;
+
+    // Returns false if an import is already running. Otherwise imports
+    // data, which must stay valid until done has been called.
+    bool start(std::string_view data, Done done);
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+
+private:
+    std::shared_ptr<UserStore> store_;
+    std::atomic<bool> running_{false};
+    std::mutex thread_mutex_;
+    std::thread thread_;
+};
@@ -1,14 +1,59 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <string_view>
 
+namespace crypto {
+    class HmacSha256;
+}
+
 class JWT {
 public:
-    static std::string create(const std::string& email);
-    static bool verify(const std::string& token, std::string& email);
+    // Seconds from iat to exp in every token we issue
+    static constexpr std::int64_t kTokenLifetime = 24 * 60 * 60;
+
+    // Longest decoded payload verify accepts; it is decoded on the stack
+    static constexpr std::size_t kMaxPayloadSize = 4096;
+
+    // Claims of a verified token. email points into buffer, so the object
+    // must outlive any use of it.
+    struct Claims {
+        std::string_view email;
+        std::int64_t exp = 0;
+        std::int64_t iat = 0;
+        char buffer[kMaxPayloadSize];
+    };
+
+    // One allocation, for the returned string
+    static std::string create(std::string_view email);
+    // Same, with iat (and so exp) fixed instead of taken from the clock
+    static std::string create_at(std::string_view email, std::int64_t iat);
+
+    // The second create() stamps as iat right now. A token depends on
+    // nothing else but the email, so this is also what a token cache is
+    // keyed by.
+    static std::int64_t current_second();
+
+    // Allocation-free variant: out must hold max_token_size(email) bytes.
+    // Returns the token's length.
+    static std::size_t create(std::string_view email, char* out);
+    static std::size_t max_token_size(std::string_view email);
+
+    // create_at() in two halves, for callers that batch the signature:
+    // MAC the unsigned header.payload with signing_key(), then append it
+    static std::string create_unsigned(std::string_view email, std::int64_t iat);
+    static void append_signature(std::string& header_payload, const unsigned char* signature);
+    static const crypto::HmacSha256& signing_key();
+
+    // Checks the signature and expiry without touching the heap
+    static bool verify(std::string_view token, Claims& claims);
+    static bool verify(std::string_view token, std::string& email);
 private:
     static constexpr const char* SECRET_KEY = "your-256-bit-secret"; // In production, load from env
-    static std::string base64_encode(const std::string& input);
-    static std::string base64_decode(const std::string& input);
-    static std::string create_signature(const std::string& header_payload);
+    // HMAC-SHA256 of header.payload into 32 bytes at out
+    static void sign(std::string_view header_payload, unsigned char* out);
+    static std::size_t write_token(std::string_view email, std::string_view time_claims, char* out);
+    // Writes header.payload at out and returns its length
+    static std::size_t write_unsigned(std::string_view email, std::string_view time_claims, char* out);
 };
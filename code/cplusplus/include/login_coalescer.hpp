@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "crypto.hpp"
+
+// Singleflight for password checks: concurrent logins that present the
+// same password for the same stored credential share one verification.
+//
+// Flights are keyed by LoginFingerprint, so the table never holds a
+// password, and a login that raced with a re-registration never joins a
+// check of the old credential. Flights run and logins that joined one are
+// counted in the auth_login_* metrics.
+class LoginCoalescer {
+public:
+    enum class Outcome { Valid, Invalid, Busy, Failed };
+
+    // A LoginFingerprint
+    using Key = crypto::Digest;
+    using Callback = std::function<void(Outcome)>;
+
+    LoginCoalescer();
+
+    LoginCoalescer(const LoginCoalescer&) = delete;
+    LoginCoalescer& operator=(const LoginCoalescer&) = delete;
+
+    // Adds done to the flight for key. Returns true if that opened a new
+    // flight; the caller then has to run the check and call complete().
+    bool join(const Key& key, Callback done);
+
+    // Ends the flight for key and runs every callback that joined it,
+    // on the calling thread
+    void complete(const Key& key, Outcome outcome);
+
+private:
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const;
+    };
+
+    // Flights last a full KDF run, so one lock is nowhere near contended
+    std::mutex mutex_;
+    std::unordered_map<Key, std::vector<Callback>, KeyHash> flights_;
+};
@@ -0,0 +1,27 @@
+#pragma once
+#include <string_view>
+#include "crypto.hpp"
+#include "hmac.hpp"
+
+// Identifies a login attempt without holding on to its password: an HMAC,
+// under a key drawn at startup, of the email, the stored credential and
+// the submitted password. Nothing derived from it can be checked against
+// a password outside this process, and since the stored credential is
+// part of it, a fingerprint stops matching as soon as the account is
+// deleted, re-registered or given a new password.
+//
+// Computing one costs an HMAC, as much as checking a legacy credential,
+// so it only pays for KDF credentials.
+class LoginFingerprint {
+public:
+    LoginFingerprint();
+
+    LoginFingerprint(const LoginFingerprint&) = delete;
+    LoginFingerprint& operator=(const LoginFingerprint&) = delete;
+
+    crypto::Digest operator()(std::string_view email, const crypto::Credential& stored,
+                              std::string_view password) const;
+
+private:
+    crypto::HmacSha256 mac_;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Process-wide metrics rendered in the Prometheus text format.
+//
+// Metrics are registered once (usually into a function-local static) and
+// live for the rest of the process, so hot paths keep a plain reference.
+// Names may carry a label set, e.g. auth_snapshots_total{result="ok"};
+// metrics sharing a base name share one HELP/TYPE header.
+namespace metrics {
+    // Monotonic counter. Increments land on one of several cache lines
+    // picked per thread, so busy threads do not contend on one atomic.
+    class Counter {
+    public:
+        void add(std::uint64_t n = 1);
+        std::uint64_t value() const;
+
+    private:
+        static constexpr std::size_t kStripes = 16;
+        struct alignas(64) Stripe {
+            std::atomic<std::uint64_t> value{0};
+        };
+        Stripe stripes_[kStripes];
+    };
+
+    class Gauge {
+    public:
+        void set(double v) { value_.store(v, std::memory_order_relaxed); }
+        double value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value_{0};
+    };
+
+    Counter& counter(const std::string& name, const std::string& help);
+    Gauge& gauge(const std::string& name, const std::string& help);
+
+    std::string render();
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include "crypto.hpp"
+
+// Pluggable password hashing.
+//
+// Every stored Credential names the scheme and cost it was made with, so
+// the policy for new credentials can change (say, from the legacy HMAC to
+// PBKDF2, or to a higher cost) without invalidating existing users; each
+// is verified under its own parameters.
+//
+// The KDF schemes are deliberately slow. Callers on I/O threads check
+// is_expensive() and hand those credentials to a ComputePool.
+namespace crypto {
+    class PasswordScheme {
+    public:
+        virtual ~PasswordScheme() = default;
+
+        virtual Scheme id() const = 0;
+        virtual const char* name() const = 0;
+
+        // Whether hashing is slow enough to keep off the I/O threads
+        virtual bool expensive() const = 0;
+
+        // Hash of password under the salt and cost in params
+        virtual Digest derive(std::string_view password, const Credential& params) const = 0;
+
+        // Cost at which derive() takes about `target` on this machine
+        virtual std::uint32_t calibrate(std::chrono::milliseconds target) const = 0;
+    };
+
+    // Null if there is no such scheme. Names: hmac-sha256, pbkdf2-sha256,
+    // scrypt.
+    const PasswordScheme* find_scheme(Scheme id);
+    const PasswordScheme* find_scheme(std::string_view name);
+
+    // Scheme and cost for new credentials; hmac-sha256 until set. Call
+    // before serving, it is not synchronized.
+    void set_password_policy(const PasswordScheme& scheme, std::uint32_t cost);
+    const PasswordScheme& password_scheme();
+    std::uint32_t password_cost();
+
+    // New credential for password under the current policy, with a fresh
+    // random salt
+    Credential make_credential(std::string_view password);
+
+    // Constant-time check of password against credential; false for an
+    // unknown scheme
+    bool verify_credential(std::string_view password, const Credential& credential);
+
+    // Whether verifying credential (or, without one, making a new
+    // credential) belongs on a compute pool
+    bool is_expensive(const Credential& credential);
+    bool is_expensive();
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for memory that lives exactly as long as one request,
+// such as Beast's header fields and target. A session keeps one arena and
+// rewinds it before parsing each request; blocks are kept across resets,
+// so once the arena has grown to the largest header the connection
+// sends, parsing allocates nothing. deallocate() is a no-op and memory
+// only comes back at reset().
+class RequestArena {
+public:
+    explicit RequestArena(std::size_t block_size = 4096) : next_block_size_(block_size) {}
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t align) {
+        for (;;) {
+            if (current_ < blocks_.size()) {
+                Block& block = blocks_[current_];
+                std::size_t at = (used_ + align - 1) & ~(align - 1);
+                if (at + size <= block.size) {
+                    used_ = at + size;
+                    return block.data.get() + at;
+                }
+                ++current_;
+                used_ = 0;
+                continue;
+            }
+            // operator new[] aligns for any fundamental type, which is
+            // all a header needs
+            std::size_t block_size = std::max(next_block_size_, size + align);
+            blocks_.push_back({std::make_unique<unsigned char[]>(block_size), block_size});
+            next_block_size_ = block_size * 2;
+        }
+    }
+
+    // Everything allocated since the last reset must be dead by now
+    void reset() {
+        current_ = 0;
+        used_ = 0;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t current_ = 0;
+    std::size_t used_ = 0;
+    std::size_t next_block_size_;
+};
+
+template<class T>
+class RequestArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit RequestArenaAllocator(RequestArena& arena) noexcept : arena_(&arena) {}
+
+    template<class U>
+    RequestArenaAllocator(const RequestArenaAllocator<U>& other) noexcept : arena_(other.arena_) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept {}
+
+    template<class U>
+    bool operator==(const RequestArenaAllocator<U>& other) const noexcept { return arena_ == other.arena_; }
+
+    template<class U>
+    bool operator!=(const RequestArenaAllocator<U>& other) const noexcept { return arena_ != other.arena_; }
+
+private:
+    template<class> friend class RequestArenaAllocator;
+    RequestArena* arena_;
+};
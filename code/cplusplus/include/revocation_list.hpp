@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+// Denylist of tokens issued before an account was deleted.
+//
+// Revoking an email at second T revokes every token for it with iat <= T.
+// Reads take no locks: one open-addressing table maps each revoked email
+// to its latest revocation time, so a check is a hash, an epoch guard and
+// a short probe whatever the token's age. Tokens issued after the most
+// recent revocation, and every token while the list is empty, skip even
+// that.
+//
+// Tokens revoked at T all expire by T + JWT::kTokenLifetime, so entries
+// are accounted in buckets by that expiry hour. Once a bucket's hour has
+// passed, sweep() drops it whole by publishing a rebuilt table without
+// its entries (the old one is retired through epoch); memory is bounded
+// by the deletions of the last day.
+//
+// Emails are keyed by SipHash under a per-process random key, so nobody
+// can pick an email that collides with someone else's to revoke their
+// tokens. Entry and bucket counts are exported as auth_revocation_*.
+//
+// The list itself is not persisted: handle_delete logs each revocation to
+// the write-ahead log and startup replays them into a fresh list. Where
+// that history is incomplete, revoked_through refuses every token up to
+// the point it can vouch for.
+class RevocationList {
+public:
+    // Revokes every token issued at or before second revoked_through;
+    // -1 revokes none
+    explicit RevocationList(std::int64_t revoked_through);
+    ~RevocationList();
+
+    RevocationList(const RevocationList&) = delete;
+    RevocationList& operator=(const RevocationList&) = delete;
+
+    // Records that a token dated iat is being issued. Call it before
+    // handing the token out.
+    void note_issued(std::int64_t iat);
+
+    // Revokes every token for email issued at or before second at, or
+    // at the latest iat noted for any email if that is later (the clock
+    // may have stepped back since), and returns the second it used
+    std::int64_t revoke(std::string_view email, std::int64_t at);
+
+    // Whether a token for email issued at iat has been revoked
+    bool is_revoked(std::string_view email, std::int64_t iat) const;
+
+    // Drops the buckets whose tokens have all expired by second now
+    void sweep(std::int64_t now);
+
+    std::size_t size() const { return entries_.load(std::memory_order_relaxed); }
+
+private:
+    struct Table;
+
+    struct Bucket {
+        std::int64_t hour = -1;
+        std::size_t size = 0;
+    };
+
+    // One per hour, with room for a whole token lifetime and the hour in
+    // progress
+    static constexpr std::size_t kBuckets = 26;
+
+    std::uint64_t key_for(std::string_view email) const;
+    Bucket& bucket_locked(std::int64_t hour);
+    // Publishes a copy of the table with room for `entries`, keeping only
+    // entries whose bucket is still live
+    void rebuild_locked(std::size_t entries);
+    void update_metrics_locked();
+
+    std::uint64_t hash_key_[2];
+    const std::int64_t revoked_through_;
+    std::atomic<std::int64_t> latest_issued_{-1};
+    std::atomic<Table*> table_{nullptr};
+    std::atomic<std::size_t> entries_{0};
+    // Latest revocation time ever seen
+    std::atomic<std::int64_t> latest_{-1};
+
+    std::mutex write_mutex_;
+    Bucket buckets_[kBuckets]; // guarded by write_mutex_
+};
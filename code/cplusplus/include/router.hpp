@@ -0,0 +1,238 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream> // verb.hpp streams verbs without including it
+#include <stdexcept>
+#include <string_view>
+#include <boost/beast/http/verb.hpp>
+
+// Dispatch by method and path through a table built at compile time.
+//
+// Paths are placed by a perfect hash (hash and displace): a path's hash
+// picks a bucket, and every bucket has a seed, found while the table is
+// built, that sends its paths to slots no other path uses. A lookup is
+// then one hash, one slot and one string compare however many routes
+// there are. A path that is routed, but not for the request's method,
+// reports the methods it does take so the caller can answer 405 instead
+// of 404. Building a table with a repeated route fails to compile.
+namespace router {
+    using verb = boost::beast::http::verb;
+
+    template<typename Handler>
+    struct Route {
+        std::string_view path;
+        verb method = verb::unknown;
+        Handler handler{};
+    };
+
+    template<typename Handler>
+    struct Match {
+        // Null unless both the path and the method are routed
+        Handler handler{};
+        // Methods the path takes, one bit per verb; 0 for unknown paths
+        std::uint64_t allowed = 0;
+    };
+
+    constexpr std::uint64_t method_bit(verb method) {
+        return std::uint64_t{1} << static_cast<unsigned>(method);
+    }
+
+    namespace detail {
+        constexpr std::uint64_t kMul = 0xff51afd7ed558ccdULL;
+
+        constexpr std::uint64_t finish(std::uint64_t h) {
+            return h ^ (h >> 32);
+        }
+
+        // Little-endian word of n bytes of s from pos
+        constexpr std::uint64_t bytes(std::string_view s, std::size_t pos, std::size_t n) {
+            std::uint64_t w = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                w |= std::uint64_t{static_cast<unsigned char>(s[pos + i])} << (8 * i);
+            }
+            return w;
+        }
+
+        inline std::uint64_t load64(const char* p) {
+            std::uint64_t w;
+            std::memcpy(&w, p, sizeof(w)); // little-endian hosts only
+            return w;
+        }
+
+        inline std::uint64_t load32(const char* p) {
+            std::uint32_t w;
+            std::memcpy(&w, p, sizeof(w));
+            return w;
+        }
+    }
+
+    // Eight bytes per multiply, with the last word overlapping the one
+    // before it; the per-bucket seeds do the spreading. Used to build
+    // tables at compile time, so written without memcpy.
+    constexpr std::uint64_t hash(std::string_view s) {
+        using namespace detail;
+        std::size_t n = s.size();
+        std::uint64_t h = n * 0x9e3779b97f4a7c15ULL;
+        if (n < 4) {
+            return finish((h ^ bytes(s, 0, n)) * kMul);
+        }
+        if (n < 8) {
+            return finish((h ^ (bytes(s, 0, 4) | bytes(s, n - 4, 4) << 32)) * kMul);
+        }
+        for (std::size_t pos = 0; pos + 8 < n; pos += 8) {
+            h = (h ^ bytes(s, pos, 8)) * kMul;
+        }
+        return finish((h ^ bytes(s, n - 8, 8)) * kMul);
+    }
+
+    // hash(), with word loads for requests
+    inline std::uint64_t hash_request(std::string_view s) {
+        using namespace detail;
+        std::size_t n = s.size();
+        const char* p = s.data();
+        std::uint64_t h = n * 0x9e3779b97f4a7c15ULL;
+        if (n < 4) {
+            return finish((h ^ bytes(s, 0, n)) * kMul);
+        }
+        if (n < 8) {
+            return finish((h ^ (load32(p) | load32(p + n - 4) << 32)) * kMul);
+        }
+        for (std::size_t pos = 0; pos + 8 < n; pos += 8) {
+            h = (h ^ load64(p + pos)) * kMul;
+        }
+        return finish((h ^ load64(p + n - 8)) * kMul);
+    }
+
+    template<typename Handler, std::size_t N>
+    class Table {
+        static_assert(N > 0 && N < 0x8000, "a route table needs between 1 and 32767 routes");
+
+        static constexpr std::size_t slot_bits() {
+            std::size_t bits = 1;
+            while ((std::size_t{1} << bits) < 2 * N) {
+                ++bits;
+            }
+            return bits;
+        }
+
+    public:
+        // At most half the slots hold a path, which keeps the seed search
+        // short. There are as many buckets as slots.
+        static constexpr std::size_t kSlotBits = slot_bits();
+        static constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+
+        constexpr explicit Table(const Route<Handler> (&routes)[N]) {
+            // Group routes by path so a slot can name a contiguous run
+            std::array<std::uint64_t, N> hashes{};
+            std::array<Slot, N> paths{};
+            std::size_t path_count = 0;
+            std::size_t placed = 0;
+            for (std::size_t i = 0; i < N; ++i) {
+                bool seen = false;
+                for (std::size_t p = 0; p < path_count; ++p) {
+                    seen = seen || paths[p].path == routes[i].path;
+                }
+                if (seen) {
+                    continue;
+                }
+                Slot& group = paths[path_count];
+                hashes[path_count++] = hash(routes[i].path);
+                group.path = routes[i].path;
+                group.first = static_cast<std::uint16_t>(placed);
+                for (std::size_t j = i; j < N; ++j) {
+                    if (routes[j].path != routes[i].path) {
+                        continue;
+                    }
+                    if (group.allowed & method_bit(routes[j].method)) {
+                        throw std::logic_error("route listed twice");
+                    }
+                    group.allowed |= method_bit(routes[j].method);
+                    routes_[placed++] = routes[j];
+                    ++group.count;
+                }
+            }
+
+            // Seed the fullest buckets first, while most slots are free
+            std::array<std::size_t, kSlots> bucket_sizes{};
+            std::size_t largest = 0;
+            for (std::size_t p = 0; p < path_count; ++p) {
+                std::size_t size = ++bucket_sizes[hashes[p] & (kSlots - 1)];
+                largest = size > largest ? size : largest;
+            }
+            std::array<bool, kSlots> taken{};
+            for (std::size_t size = largest; size > 0; --size) {
+                for (std::size_t bucket = 0; bucket < kSlots; ++bucket) {
+                    if (bucket_sizes[bucket] != size) {
+                        continue;
+                    }
+                    std::array<std::size_t, N> members{};
+                    std::size_t count = 0;
+                    for (std::size_t p = 0; p < path_count; ++p) {
+                        if ((hashes[p] & (kSlots - 1)) == bucket) {
+                            members[count++] = p;
+                        }
+                    }
+                    seeds_[bucket] = find_seed(hashes, members, count, taken);
+                    for (std::size_t m = 0; m < count; ++m) {
+                        std::size_t s = slot(hashes[members[m]], seeds_[bucket]);
+                        taken[s] = true;
+                        slots_[s] = paths[members[m]];
+                    }
+                }
+            }
+        }
+
+        Match<Handler> find(std::string_view path, verb method) const {
+            std::uint64_t h = hash_request(path);
+            const Slot& s = slots_[slot(h, seeds_[h & (kSlots - 1)])];
+            if (s.count == 0 || s.path != path) {
+                return {};
+            }
+            Match<Handler> match;
+            match.allowed = s.allowed;
+            for (std::size_t i = s.first; i < s.first + s.count; ++i) {
+                if (routes_[i].method == method) {
+                    match.handler = routes_[i].handler;
+                }
+            }
+            return match;
+        }
+
+    private:
+        struct Slot {
+            std::string_view path;
+            std::uint64_t allowed = 0;
+            std::uint16_t first = 0;
+            std::uint16_t count = 0; // 0 when no path hashes here
+        };
+
+        static constexpr std::size_t slot(std::uint64_t h, std::uint64_t seed) {
+            return static_cast<std::size_t>(((h ^ seed * detail::kMul) * 0x9e3779b97f4a7c15ULL) >> (64 - kSlotBits));
+        }
+
+        static constexpr std::uint64_t find_seed(const std::array<std::uint64_t, N>& hashes,
+                                                 const std::array<std::size_t, N>& members, std::size_t count,
+                                                 const std::array<bool, kSlots>& taken) {
+            for (std::uint64_t seed = 0; seed < (1u << 16); ++seed) {
+                bool fits = true;
+                for (std::size_t m = 0; m < count && fits; ++m) {
+                    std::size_t s = slot(hashes[members[m]], seed);
+                    fits = !taken[s];
+                    for (std::size_t k = 0; k < m && fits; ++k) {
+                        fits = slot(hashes[members[k]], seed) != s;
+                    }
+                }
+                if (fits) {
+                    return seed;
+                }
+            }
+            throw std::logic_error("no perfect hash for these routes");
+        }
+
+        std::array<Route<Handler>, N> routes_{};
+        std::array<std::uint64_t, kSlots> seeds_{};
+        std::array<Slot, kSlots> slots_{};
+    };
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// SHA-256 with the compression function picked at startup: the SHA
+// extensions on x86 (SHA-NI), the ARMv8 crypto extensions, or portable
+// code. The choice depends on the CPU the process runs on rather than the
+// one it was built on, so one binary is both portable and fast.
+namespace sha256 {
+    constexpr std::size_t kBlockSize = 64;
+    constexpr std::size_t kDigestSize = 32;
+
+    // FIPS 180-4 initial hash value and round constants
+    extern const std::uint32_t kInitialState[8];
+    extern const std::uint32_t kRoundConstants[64];
+
+    // Absorbs blocks (nblocks * 64 bytes, no padding) into state
+    void compress(std::uint32_t state[8], const unsigned char* blocks, std::size_t nblocks);
+
+    // Digest of data into 32 bytes at out
+    void hash(const void* data, std::size_t len, unsigned char* out);
+
+    // True when compress runs on dedicated SHA instructions
+    bool hardware_accelerated();
+
+    // Kernel compress uses, for logs and metrics
+    const char* implementation();
+
+    struct Kernel {
+        void (*compress)(std::uint32_t state[8], const unsigned char* blocks, std::size_t nblocks);
+        bool hardware;
+        const char* name;
+    };
+    // Every kernel this CPU can run, the one in use first, so benchmarks
+    // can compare them
+    std::vector<Kernel> supported_kernels();
+}
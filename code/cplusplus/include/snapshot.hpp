@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "crypto.hpp"
+
+// Versioned, memory-mappable snapshot of the user table.
+//
+// Layout (little endian):
+//   header      magic, version, counts, section offsets, WAL position,
+//               header checksum
+//   heap        records of [credential][u32 email length][email], back to
+//               back; version 1 files hold a 32-byte HMAC digest instead
+//               of the credential and are still readable
+//   index       open-addressing table of u64 entries, each holding a 16-bit
+//               hash tag and the record's heap offset (0 = empty)
+//   checksums   one crc32c per 4 MiB chunk of heap + index
+//
+// Lookups probe the mapped index and compare against the mapped heap
+// directly, so opening a snapshot costs one checksum pass (spread across
+// threads) and no per-record parsing; pages fault in as they are used.
+class Snapshot {
+public:
+    // Maps and validates the snapshot; throws std::runtime_error or
+    // std::system_error if it is missing, truncated or corrupt
+    static std::shared_ptr<const Snapshot> open(const std::string& path, unsigned verify_threads);
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    bool find(std::string_view email, crypto::Credential* credential) const;
+
+    // Visits every record in heap order
+    template <class F>
+    void for_each(F&& f) const {
+        const unsigned char* p = heap_;
+        for (std::uint64_t i = 0; i < user_count_; ++i) {
+            crypto::Credential credential;
+            std::uint32_t size;
+            p = read_record(p, &credential, &size);
+            f(std::string_view(reinterpret_cast<const char*>(p), size), credential);
+            p += size;
+        }
+    }
+
+    std::uint64_t user_count() const { return user_count_; }
+
+    // Every log record up to this position is reflected in the snapshot
+    std::uint64_t wal_lsn() const { return wal_lsn_; }
+
+private:
+    Snapshot() = default;
+
+    const unsigned char* read_record(const unsigned char* p, crypto::Credential* credential,
+                                     std::uint32_t* size) const;
+
+    void* map_ = nullptr;
+    std::size_t map_size_ = 0;
+    const unsigned char* heap_ = nullptr;
+    std::uint64_t heap_size_ = 0;
+    const unsigned char* index_ = nullptr;
+    std::uint64_t index_mask_ = 0;
+    std::uint64_t user_count_ = 0;
+    std::uint64_t wal_lsn_ = 0;
+    std::uint32_t version_ = 0;
+    std::size_t credential_size_ = 0;
+};
+
+// Streams records into a new snapshot file. Nothing is visible at `path`
+// until commit() renames the finished file into place, so readers of the
+// previous snapshot are never disturbed.
+class SnapshotWriter {
+public:
+    // Throws std::system_error if the temporary file cannot be created
+    explicit SnapshotWriter(std::string path);
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    void add(std::string_view email, const crypto::Credential& credential);
+
+    // Writes the index and checksums, syncs and renames into place
+    void commit(std::uint64_t wal_lsn);
+
+    std::uint64_t user_count() const { return entries_.size(); }
+
+private:
+    void write(const void* data, std::size_t len);
+    void flush_buffer();
+
+    std::string path_;
+    std::string tmp_path_;
+    int fd_ = -1;
+    bool committed_ = false;
+
+    std::vector<unsigned char> buffer_;
+    std::uint64_t offset_ = 0;
+    std::uint32_t chunk_crc_ = 0;
+    std::vector<std::uint32_t> chunk_crcs_;
+
+    // (hash, heap offset) of every record, for building the index
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> entries_;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/types.h>
+#include "user_store.hpp"
+
+// Redis-style background save of the user table.
+//
+// start() briefly pauses writers, forks, and lets them go again. The child
+// owns a frozen copy-on-write image of the table and writes the snapshot
+// from it without any locking; the parent keeps serving and only pays for
+// the pages it dirties meanwhile. A reaper thread tracks the child and
+// publishes progress and timings as auth_snapshot_* metrics.
+class SnapshotSaver {
+public:
+    SnapshotSaver(std::shared_ptr<UserStore> store, std::string path);
+    ~SnapshotSaver();
+
+    SnapshotSaver(const SnapshotSaver&) = delete;
+    SnapshotSaver& operator=(const SnapshotSaver&) = delete;
+
+    // Returns false if a save is already running
+    bool start();
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+
+private:
+    // Lives in a shared anonymous mapping so the child can report to us
+    struct Progress {
+        std::atomic<std::uint64_t> written{0};
+    };
+
+    void reap(pid_t pid, std::size_t expected_users, std::chrono::steady_clock::time_point started);
+    void save_in_process(std::chrono::steady_clock::time_point started);
+
+    std::shared_ptr<UserStore> store_;
+    std::string path_;
+    Progress* progress_ = nullptr;
+
+    std::atomic<bool> running_{false};
+    std::mutex reaper_mutex_;
+    std::thread reaper_;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Recently minted tokens, keyed by (email, iat second).
+//
+// A token depends only on the email and the second it was minted in, so
+// every login of a user within one second gets the same bytes; the cache
+// hands those out instead of building, encoding and signing them again.
+// Entries from an earlier second simply stop matching, so nothing has to
+// expire them.
+//
+// It is bounded and sharded: the email's hash picks a shard (one mutex
+// each) and a slot within it, and a new token overwrites whatever held
+// that slot. invalidate() must be called when an account is deleted so no
+// token minted for the old account is handed out again. Hits, misses and
+// invalidations are counted in the auth_token_cache_* metrics.
+class TokenCache {
+public:
+    // Rounded up to a power of two per shard
+    explicit TokenCache(std::size_t capacity);
+
+    TokenCache(const TokenCache&) = delete;
+    TokenCache& operator=(const TokenCache&) = delete;
+
+    // The cached token for email issued at iat, or a newly minted (and
+    // cached) one
+    std::string mint(std::string_view email, std::int64_t iat);
+
+    // Copies the token for email minted in second iat into token; false
+    // on a miss
+    bool find(std::string_view email, std::int64_t iat, std::string& token);
+    void put(std::string_view email, std::int64_t iat, const std::string& token);
+
+    // Drops any token cached for email
+    void invalidate(std::string_view email);
+
+private:
+    struct Slot {
+        std::int64_t iat = -1;
+        std::string email;
+        std::string token;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<Slot> slots;
+    };
+
+    // Locks the shard for email and returns it with the slot email maps to
+    Slot& slot_for(std::string_view email, std::unique_lock<std::mutex>& lock);
+
+    std::unique_ptr<Shard[]> shards_;
+    std::size_t slot_mask_;
+};
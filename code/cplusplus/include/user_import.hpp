@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "user_store.hpp"
+
+// Bulk user import for migrations.
+//
+// Two input formats are accepted:
+//
+//   NDJSON, one object per line, with either a password (hashed here with
+//   the configured password scheme) or an existing HMAC-SHA256 digest as
+//   64 hex digits:
+//     {"email":"a@example.com","password":"secret"}
+//     {"email":"b@example.com","digest":"9f86d0..."}
+//
+//   Records whose email is empty or longer than email_limits allows are
+//   counted as invalid and skipped.
+//
+//   Binary, for large exports: the magic "AUTHIMP\x01" followed by records
+//     [u8 kind][u32 email_len][email] then either
+//     kind 1: [32-byte digest]  or  kind 2: [u32 password_len][password]
+//   with little-endian lengths.
+//
+// The input is cut into chunks at record boundaries. Worker threads parse
+// and hash their chunks and hand the results to UserStore::add_users in
+// shard-grouped batches, so no per-user JSON DOM, token or lock round trip
+// is paid. Progress is logged every second and counted in the
+// auth_import_users_total metrics.
+namespace user_import {
+    enum class Format { Ndjson, Binary };
+
+    // Binary if the input starts with the magic, NDJSON otherwise
+    Format detect_format(std::string_view data);
+
+    struct Stats {
+        std::size_t imported = 0;
+        // Emails that already existed, including repeats within the input
+        std::size_t duplicates = 0;
+        // Malformed records; they are skipped, not fatal
+        std::size_t invalid = 0;
+        double seconds = 0;
+        // Log position of the last imported user, for UserStore::when_durable
+        std::uint64_t lsn = 0;
+
+        double users_per_second() const { return seconds > 0 ? imported / seconds : 0; }
+    };
+
+    // Imports every record in data. workers == 0 uses one per hardware
+    // thread. Throws std::runtime_error if a binary input is truncated,
+    // and rethrows the first error a worker hits (e.g. hashing failed)
+    // once every worker has stopped; users added before it stay.
+    Stats run(UserStore& store, std::string_view data, unsigned workers = 0);
+
+    // Maps the file at path and imports it with run()
+    Stats run_file(UserStore& store, const std::string& path, unsigned workers = 0);
+}
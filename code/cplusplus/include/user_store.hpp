@@ -1,15 +1,150 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <mutex>
+#include <vector>
+#include "flat_user_table.hpp"
+#include "snapshot.hpp"
+#include "wal.hpp"
 
+// Sharded user table with a lock-free read path.
+//
+// Each shard is a FlatUserTable guarded by a writer mutex and a sequence
+// counter. authenticate_user never takes a lock: it reads under an
+// epoch::Guard and retries if the shard's sequence changed meanwhile.
+// add_user and delete_user serialize on the shard mutex and never block
+// readers. Erased email keys and tables replaced during growth are
+// reclaimed through epoch::retire.
+//
+// Growth is incremental: a full shard allocates a table twice the size
+// and every subsequent write moves a bounded number of slots out of the
+// old generation. Until it is drained, lookups consult both tables.
+//
+// With a WriteAheadLog attached, every successful add and delete is
+// appended to it under the shard lock, so the log order matches the order
+// in which changes became visible.
+//
+// A Snapshot can be attached as a read-only base layer. Lookups that miss
+// the shards fall through to it, and deleting a base user leaves an erased
+// key in the shard to hide it.
 class UserStore {
 public:
-    bool add_user(const std::string& email, const std::string& password);
+    // shard_count is rounded up to a power of two; 0 picks a default
+    // based on the number of hardware threads
+    explicit UserStore(std::size_t shard_count = 0);
+    ~UserStore();
+
+    UserStore(const UserStore&) = delete;
+    UserStore& operator=(const UserStore&) = delete;
+
+    // When a log is attached and the call succeeds, *lsn receives the
+    // position of the logged change; pass it to when_durable before
+    // acknowledging. Throws std::length_error for an email that
+    // email_limits does not accept.
+    bool add_user(const std::string& email, const std::string& password,
+                  std::uint64_t* lsn = nullptr);
     bool authenticate_user(const std::string& email, const std::string& password);
-    bool delete_user(const std::string& email);
+    // Copies out the stored credential, for callers that check the
+    // password themselves (e.g. in a batch or on another thread); false if
+    // the user does not exist
+    bool lookup_credential(const std::string& email, crypto::Credential& credential);
+    bool delete_user(const std::string& email, std::uint64_t* lsn = nullptr);
+    // Logs that email's tokens are revoked through second revoked_through,
+    // so a restart can rebuild the revocation list; *lsn as above
+    void log_revocation(std::string_view email, std::int64_t revoked_through, std::uint64_t* lsn);
+
+    struct NewUser {
+        std::string email;
+        crypto::Credential credential;
+    };
+
+    // Bulk add of already hashed users, e.g. for imports. Existing emails
+    // are left alone and counted in *duplicates. The batch is grouped by
+    // shard so each shard lock is taken once; *lsn receives the position
+    // of the last logged change (0 if none). Throws std::length_error,
+    // adding nobody, if any email is not acceptable.
+    std::size_t add_users(const std::vector<NewUser>& users, std::size_t* duplicates = nullptr,
+                          std::uint64_t* lsn = nullptr);
+
+    // Inserts or replaces an already hashed user without logging it, e.g.
+    // while replaying the log on top of a snapshot
+    void restore_user(const std::string& email, const crypto::Credential& credential);
+
+    // Attach after replay so replayed records are not logged twice
+    void attach_log(std::shared_ptr<WriteAheadLog> log) { log_ = std::move(log); }
+
+    // Attach before serving and before replaying the log
+    void attach_snapshot(std::shared_ptr<const Snapshot> base) { base_ = std::move(base); }
+
+    // Writes every current user to a new snapshot at path while traffic
+    // continues and returns the number of users written. Each shard is
+    // copied under its write lock, and the snapshot records the log
+    // position from before the copy started. Replaying the log from there
+    // is idempotent, so changes that race with the copy are never lost.
+    std::size_t save_snapshot(const std::string& path);
+
+    // Runs f with every shard's write lock held, so no change is half
+    // applied for as long as f runs. Readers are not affected.
+    void pause_writers(const std::function<void()>& f);
+
+    // Writes every current user without taking any lock. Only safe while
+    // nothing can modify the store, e.g. in a process forked from inside
+    // pause_writers. *progress (if given) tracks the users written so far.
+    std::size_t write_frozen_snapshot(SnapshotWriter& writer, std::atomic<std::uint64_t>* progress);
+
+    // Log position that a snapshot taken now would cover; 0 without a log
+    std::uint64_t log_position() const;
+
+    // Shard entries plus base users; erased keys make it an overestimate
+    std::size_t approximate_size() const;
+
+    // Runs done once the change at lsn is durable; immediately without a log
+    void when_durable(std::uint64_t lsn, std::function<void()> done);
+
+    // Pre-sizes every shard so that about `users` accounts fit without
+    // further growth
+    void reserve(std::size_t users);
+
+    std::size_t shard_count() const { return shard_mask_ + 1; }
 
 private:
-    std::unordered_map<std::string, std::string> users_; // email -> hashed_password
-    std::mutex mutex_; // Simple mutex for thread safety
+    // Each shard sits on its own cache line(s) so that threads working on
+    // different shards never bounce the same mutex between cores
+    struct alignas(64) Shard {
+        std::mutex write_mutex;
+        // Odd while a writer is modifying the table
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<FlatUserTable*> table{nullptr};
+        // Previous generation, non-null while a resize is in progress
+        std::atomic<FlatUserTable*> previous{nullptr};
+        std::size_t migrate_cursor = 0; // guarded by write_mutex
+    };
+
+    std::size_t shard_index(std::size_t hash) const;
+    Shard& shard_for(std::size_t hash);
+    static const FlatUserTable::EmailKey* find(Shard& shard, std::size_t hash, const std::string& email,
+                                               crypto::Credential* credential);
+    static const FlatUserTable::EmailKey* find_locked(Shard& shard, std::size_t hash,
+                                                      const std::string& email);
+    static const FlatUserTable::EmailKey* erase_locked(Shard& shard, std::size_t hash,
+                                                       const std::string& email);
+    static void make_room(Shard& shard);
+    static void grow(Shard& shard, std::size_t capacity);
+    static void migrate(Shard& shard, std::size_t budget);
+    static void finish_migration(Shard& shard);
+    bool insert(const std::string& email, const crypto::Credential& credential, bool replace,
+                std::uint64_t* lsn);
+    bool insert_locked(Shard& shard, std::size_t hash, const std::string& email,
+                       const crypto::Credential& credential, bool replace, std::uint64_t* lsn);
+    void write_users(SnapshotWriter& writer, bool lock_shards, std::atomic<std::uint64_t>* progress);
+
+    std::unique_ptr<Shard[]> shards_;
+    std::size_t shard_mask_;
+    std::shared_ptr<WriteAheadLog> log_;
+    std::shared_ptr<const Snapshot> base_;
 };
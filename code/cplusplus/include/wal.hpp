@@ -0,0 +1,103 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "crypto.hpp"
+
+// Append-only write-ahead log of user changes.
+//
+// Each record is [crc32c][type][email length][email][payload] in little
+// endian, with the checksum covering everything after it. Adds carry the
+// credential (or, if written before credentials existed, a bare HMAC
+// digest that replays as a legacy credential), deletes nothing, and
+// revocations the second through which the email's tokens are revoked.
+// Positions in
+// the log (LSNs) are byte offsets of a record's end, so "durable up to
+// LSN n" means every byte before n has been fdatasync'ed.
+//
+// Appends only copy the record into a pending buffer; when it reaches
+// disk depends on the durability mode:
+//   Sync  - the thread waiting for the record writes and syncs it itself
+//   Group - a flusher thread batches every record that arrived within
+//           group_delay (or during the previous sync) into one fdatasync
+//           and acknowledges them together
+//   Async - the flusher syncs every group_delay and callers are
+//           acknowledged immediately, trading a bounded loss window for
+//           latency
+class WriteAheadLog {
+public:
+    enum class Durability { Sync, Group, Async };
+
+    enum class RecordType : std::uint8_t { AddUser = 1, DeleteUser = 2, RevokeTokens = 3 };
+
+    struct Record {
+        RecordType type;
+        std::string_view email;
+        crypto::Credential credential;    // AddUser only
+        std::int64_t revoked_through = 0; // RevokeTokens only
+    };
+
+    struct Options {
+        std::string path;
+        Durability durability = Durability::Group;
+        std::chrono::microseconds group_delay{500};
+    };
+
+    // Opens (or creates) the log for appending; throws std::system_error
+    explicit WriteAheadLog(Options options);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Calls apply for every intact record after from_lsn, in order, and
+    // returns how many there were. from_lsn must be a record boundary,
+    // e.g. Snapshot::wal_lsn(). A torn or corrupt tail (from a crash
+    // mid-write) is cut off so new appends start at a record boundary.
+    // Must run before the log is opened for appending.
+    static std::size_t replay(const std::string& path, const std::function<void(const Record&)>& apply,
+                              std::uint64_t from_lsn = 0);
+
+    static bool parse_durability(std::string_view name, Durability& out);
+
+    // All return the record's LSN
+    std::uint64_t log_add(std::string_view email, const crypto::Credential& credential);
+    std::uint64_t log_delete(std::string_view email);
+    std::uint64_t log_revoke(std::string_view email, std::int64_t revoked_through);
+
+    // Runs done once the record at lsn is as durable as the configured
+    // mode promises. done may run inline or on the flusher thread.
+    void when_durable(std::uint64_t lsn, std::function<void()> done);
+
+    // Position just past the last appended record
+    std::uint64_t appended_lsn();
+
+private:
+    std::uint64_t append(RecordType type, std::string_view email, const crypto::Credential* credential,
+                         std::int64_t revoked_through = 0);
+    void flush();
+    void run_flusher();
+
+    Options options_;
+    int fd_ = -1;
+
+    // Serializes write()+fdatasync() so batches reach the file in order
+    std::mutex io_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable pending_cv_;
+    std::vector<char> pending_;
+    std::uint64_t appended_lsn_ = 0;
+    std::uint64_t durable_lsn_ = 0;
+    std::vector<std::pair<std::uint64_t, std::function<void()>>> waiters_;
+    bool stopping_ = false;
+
+    std::thread flusher_;
+};
@@ -0,0 +1,296 @@
+#include "base64url.hpp"
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    constexpr char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    constexpr std::array<signed char, 256> make_decode_table() {
+        std::array<signed char, 256> table{};
+        for (auto& v : table) {
+            v = -1;
+        }
+        for (int i = 0; i < 64; ++i) {
+            table[static_cast<unsigned char>(kAlphabet[i])] = static_cast<signed char>(i);
+        }
+        return table;
+    }
+
+    constexpr auto kDecodeTable = make_decode_table();
+
+    // Portable kernels; the vector ones finish their tails with these
+
+    void encode_scalar(const unsigned char* in, std::size_t len, char* out) {
+        std::size_t i = 0;
+        for (; i + 3 <= len; i += 3) {
+            std::uint32_t v = std::uint32_t{in[i]} << 16 | std::uint32_t{in[i + 1]} << 8 | in[i + 2];
+            *out++ = kAlphabet[v >> 18];
+            *out++ = kAlphabet[v >> 12 & 0x3f];
+            *out++ = kAlphabet[v >> 6 & 0x3f];
+            *out++ = kAlphabet[v & 0x3f];
+        }
+        if (len - i == 1) {
+            std::uint32_t v = std::uint32_t{in[i]} << 16;
+            *out++ = kAlphabet[v >> 18];
+            *out++ = kAlphabet[v >> 12 & 0x3f];
+        } else if (len - i == 2) {
+            std::uint32_t v = std::uint32_t{in[i]} << 16 | std::uint32_t{in[i + 1]} << 8;
+            *out++ = kAlphabet[v >> 18];
+            *out++ = kAlphabet[v >> 12 & 0x3f];
+            *out++ = kAlphabet[v >> 6 & 0x3f];
+        }
+    }
+
+    // The caller has checked the length and the output space
+    bool decode_scalar(const char* in, std::size_t len, unsigned char* out) {
+        std::size_t i = 0;
+        for (; i + 4 <= len; i += 4) {
+            int a = kDecodeTable[static_cast<unsigned char>(in[i])];
+            int b = kDecodeTable[static_cast<unsigned char>(in[i + 1])];
+            int c = kDecodeTable[static_cast<unsigned char>(in[i + 2])];
+            int d = kDecodeTable[static_cast<unsigned char>(in[i + 3])];
+            if ((a | b | c | d) < 0) {
+                return false;
+            }
+            std::uint32_t v = static_cast<std::uint32_t>(a << 18 | b << 12 | c << 6 | d);
+            *out++ = static_cast<unsigned char>(v >> 16);
+            *out++ = static_cast<unsigned char>(v >> 8);
+            *out++ = static_cast<unsigned char>(v);
+        }
+        std::size_t rest = len - i;
+        if (rest == 0) {
+            return true;
+        }
+        int a = kDecodeTable[static_cast<unsigned char>(in[i])];
+        int b = kDecodeTable[static_cast<unsigned char>(in[i + 1])];
+        int c = rest == 3 ? kDecodeTable[static_cast<unsigned char>(in[i + 2])] : 0;
+        if ((a | b | c) < 0) {
+            return false;
+        }
+        std::uint32_t v = static_cast<std::uint32_t>(a << 18 | b << 12 | c << 6);
+        // Bits past the last byte must be zero, or every token would have
+        // a few other spellings that decode the same
+        if ((v & (rest == 3 ? 0xffu : 0xffffu)) != 0) {
+            return false;
+        }
+        *out++ = static_cast<unsigned char>(v >> 16);
+        if (rest == 3) {
+            *out++ = static_cast<unsigned char>(v >> 8);
+        }
+        return true;
+    }
+
+#if defined(__x86_64__)
+    // Vector kernels after Wojciech Muła and Daniel Lemire, "Faster Base64
+    // Encoding and Decoding Using AVX2 Instructions" (2018), adapted to the
+    // URL-safe alphabet. The AVX2 versions run the same steps on two
+    // 128-bit lanes.
+
+    // Bytes 0-11 of v, already spread as [b1 b0 b2 b1 ...] -> 16 sextets
+    __attribute__((target("ssse3")))
+    __m128i split_ssse3(__m128i v) {
+        __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(hi, lo);
+    }
+
+    // Sextets to ASCII: pick one of 14 offsets, 0 for a-z, 1-10 for
+    // digits, 11 for '-', 12 for '_' and 13 for A-Z
+    __attribute__((target("ssse3")))
+    __m128i to_ascii_ssse3(__m128i v) {
+        const __m128i shift = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0);
+        __m128i index = _mm_subs_epu8(v, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), v);
+        index = _mm_or_si128(index, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        return _mm_add_epi8(v, _mm_shuffle_epi8(shift, index));
+    }
+
+    __attribute__((target("ssse3")))
+    void encode_ssse3(const unsigned char* in, std::size_t len, char* out) {
+        const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+        // Each step reads 16 bytes and consumes 12
+        while (len >= 16) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), spread);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), to_ascii_ssse3(split_ssse3(v)));
+            in += 12;
+            len -= 12;
+            out += 16;
+        }
+        encode_scalar(in, len, out);
+    }
+
+    __attribute__((target("avx2")))
+    void encode_avx2(const unsigned char* in, std::size_t len, char* out) {
+        const __m256i spread = _mm256_setr_epi8(
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+        const __m256i shift = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0);
+        // Each step reads 28 bytes (two overlapping lanes) and consumes 24
+        while (len >= 28) {
+            __m256i v = _mm256_set_m128i(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+            v = _mm256_shuffle_epi8(v, spread);
+            __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)),
+                                            _mm256_set1_epi32(0x04000040));
+            __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)),
+                                            _mm256_set1_epi32(0x01000010));
+            v = _mm256_or_si256(hi, lo);
+            __m256i index = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+            __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+            index = _mm256_or_si256(index, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+            v = _mm256_add_epi8(v, _mm256_shuffle_epi8(shift, index));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+            in += 24;
+            len -= 24;
+            out += 32;
+        }
+        // GCC does not always emit this before tail-calling the SSE
+        // kernel, and the transition penalty costs more than the rest
+        _mm256_zeroupper();
+        encode_ssse3(in, len, out);
+    }
+
+    // ASCII to sextets by character class; *ok is cleared if any byte is
+    // outside the alphabet
+    __attribute__((target("ssse3")))
+    __m128i from_ascii_ssse3(__m128i c, bool* ok) {
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), c));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), c));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+        __m128i dash = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+        __m128i under = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(dash, under)));
+        *ok = _mm_movemask_epi8(valid) == 0xffff;
+        __m128i offset = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                         _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+            _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                         _mm_or_si128(_mm_and_si128(dash, _mm_set1_epi8(62 - '-')),
+                                      _mm_and_si128(under, _mm_set1_epi8(63 - '_')))));
+        return _mm_add_epi8(c, offset);
+    }
+
+    __attribute__((target("ssse3")))
+    bool decode_ssse3(const char* in, std::size_t len, unsigned char* out, std::size_t capacity) {
+        const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        // Each step consumes 16 characters and stores 16 bytes, 12 of them
+        // meaningful
+        while (len >= 16 && capacity >= 16) {
+            bool ok;
+            __m128i v = from_ascii_ssse3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), &ok);
+            if (!ok) {
+                return false;
+            }
+            v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+            v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(v, pack));
+            in += 16;
+            len -= 16;
+            out += 12;
+            capacity -= 12;
+        }
+        return decode_scalar(in, len, out);
+    }
+
+    __attribute__((target("avx2")))
+    bool decode_avx2(const char* in, std::size_t len, unsigned char* out, std::size_t capacity) {
+        const __m256i pack = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+        // Each step consumes 32 characters and stores 32 bytes, 24 of them
+        // meaningful
+        while (len >= 32 && capacity >= 32) {
+            // Same classification as from_ascii_ssse3
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+            __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+            __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+            __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                             _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+            __m256i dash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'));
+            __m256i under = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'));
+            __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                                            _mm256_or_si256(digit, _mm256_or_si256(dash, under)));
+            if (_mm256_movemask_epi8(valid) != -1) {
+                return false;
+            }
+            __m256i offset = _mm256_or_si256(
+                _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                                _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+                _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                                _mm256_or_si256(_mm256_and_si256(dash, _mm256_set1_epi8(62 - '-')),
+                                                _mm256_and_si256(under, _mm256_set1_epi8(63 - '_')))));
+            __m256i v = _mm256_add_epi8(c, offset);
+            v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+            v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+            v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), compact);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+            in += 32;
+            len -= 32;
+            out += 24;
+            capacity -= 24;
+        }
+        _mm256_zeroupper();
+        return decode_ssse3(in, len, out, capacity);
+    }
+#endif
+
+    struct Kernels {
+        void (*encode)(const unsigned char*, std::size_t, char*);
+        bool (*decode)(const char*, std::size_t, unsigned char*, std::size_t);
+        const char* name;
+    };
+
+    bool decode_portable(const char* in, std::size_t len, unsigned char* out, std::size_t) {
+        return decode_scalar(in, len, out);
+    }
+
+    Kernels pick_kernels() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return {encode_avx2, decode_avx2, "avx2"};
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return {encode_ssse3, decode_ssse3, "ssse3"};
+        }
+#endif
+        return {encode_scalar, decode_portable, "scalar"};
+    }
+
+    const Kernels kKernels = pick_kernels();
+}
+
+namespace base64url {
+    void encode(const void* data, std::size_t len, char* out) {
+        kKernels.encode(static_cast<const unsigned char*>(data), len, out);
+    }
+
+    std::ptrdiff_t decode(std::string_view in, void* out, std::size_t capacity) {
+        if (in.size() % 4 == 1 || decoded_size(in.size()) > capacity) {
+            return -1;
+        }
+        if (!kKernels.decode(in.data(), in.size(), static_cast<unsigned char*>(out), capacity)) {
+            return -1;
+        }
+        return static_cast<std::ptrdiff_t>(decoded_size(in.size()));
+    }
+
+    const char* implementation() {
+        return kKernels.name;
+    }
+}
@@ -0,0 +1,108 @@
+#include "compute_pool.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+    struct PoolMetrics {
+        metrics::Gauge& queued = metrics::gauge(
+            "auth_compute_queue_depth", "Jobs waiting for a compute thread");
+        metrics::Gauge& busy = metrics::gauge(
+            "auth_compute_busy_threads", "Compute threads running a job");
+        metrics::Counter& completed = metrics::counter(
+            "auth_compute_jobs_total{result=\"ok\"}", "Compute jobs, by outcome");
+        metrics::Counter& rejected = metrics::counter(
+            "auth_compute_jobs_total{result=\"rejected\"}", "Compute jobs, by outcome");
+        metrics::Counter& wait_us = metrics::counter(
+            "auth_compute_queue_wait_microseconds_total", "Time jobs spent queued before a thread took them");
+        metrics::Counter& run_us = metrics::counter(
+            "auth_compute_run_microseconds_total", "Time compute threads spent running jobs");
+    };
+
+    PoolMetrics& pool_metrics() {
+        static PoolMetrics m;
+        return m;
+    }
+
+    std::uint64_t microseconds(std::chrono::steady_clock::duration d) {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+    }
+}
+
+ComputePool::ComputePool(Options options)
+    : options_(options)
+{
+    unsigned threads = options_.threads ? options_.threads : std::thread::hardware_concurrency();
+    pool_metrics();
+    for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+        workers_.emplace_back([this] {
+#if defined(SCHED_BATCH)
+            // Tells the scheduler these threads are throughput work, so a
+            // waking I/O thread preempts them instead of queueing behind
+            sched_param param{};
+            if (pthread_setschedparam(pthread_self(), SCHED_BATCH, &param) != 0) {
+                std::cerr << "Compute pool: could not switch to SCHED_BATCH" << std::endl;
+            }
+#endif
+            run();
+        });
+    }
+}
+
+ComputePool::~ComputePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+bool ComputePool::submit(std::function<void()> job) {
+    PoolMetrics& m = pool_metrics();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= options_.max_queued) {
+            m.rejected.add();
+            return false;
+        }
+        queue_.push_back(Job{std::move(job), Clock::now()});
+        m.queued.set(static_cast<double>(queue_.size()));
+    }
+    ready_.notify_one();
+    return true;
+}
+
+void ComputePool::run() {
+    PoolMetrics& m = pool_metrics();
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        m.queued.set(static_cast<double>(queue_.size()));
+        m.busy.set(m.busy.value() + 1);
+        lock.unlock();
+
+        auto started = Clock::now();
+        m.wait_us.add(microseconds(started - job.queued));
+        try {
+            job.run();
+        } catch (const std::exception& e) {
+            std::cerr << "Compute job failed: " << e.what() << std::endl;
+        }
+        m.run_us.add(microseconds(Clock::now() - started));
+        m.completed.add();
+
+        lock.lock();
+        m.busy.set(m.busy.value() - 1);
+    }
+}
@@ -0,0 +1,113 @@
+#include "cpu_topology.hpp"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+    bool parse_number(std::string_view& s, unsigned& value) {
+        std::size_t i = 0;
+        value = 0;
+        while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) {
+            if (value > 1u << 20) {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(s[i] - '0');
+            ++i;
+        }
+        s.remove_prefix(i);
+        return i > 0;
+    }
+
+    // Node of every CPU the kernel lists under /sys/devices/system/node;
+    // empty on kernels built without NUMA
+    std::map<unsigned, int> read_nodes() {
+        std::map<unsigned, int> nodes;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string list;
+        std::vector<unsigned> ids;
+        if (!std::getline(online, list) || !cpu_topology::parse_cpu_list(list, ids)) {
+            return nodes;
+        }
+        for (unsigned node : ids) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::vector<unsigned> cpus;
+            if (std::getline(in, list) && cpu_topology::parse_cpu_list(list, cpus)) {
+                for (unsigned cpu : cpus) {
+                    nodes[cpu] = static_cast<int>(node);
+                }
+            }
+        }
+        return nodes;
+    }
+}
+
+namespace cpu_topology {
+    bool parse_cpu_list(std::string_view list, std::vector<unsigned>& cpus) {
+        cpus.clear();
+        while (!list.empty() && std::isspace(static_cast<unsigned char>(list.back()))) {
+            list.remove_suffix(1);
+        }
+        while (!list.empty()) {
+            unsigned first, last;
+            if (!parse_number(list, first)) {
+                return false;
+            }
+            last = first;
+            if (!list.empty() && list.front() == '-') {
+                list.remove_prefix(1);
+                if (!parse_number(list, last) || last < first) {
+                    return false;
+                }
+            }
+            for (unsigned cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+            if (!list.empty()) {
+                if (list.front() != ',') {
+                    return false;
+                }
+                list.remove_prefix(1);
+            }
+        }
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+        return !cpus.empty();
+    }
+
+    std::vector<Cpu> resolve(const std::vector<unsigned>& ids) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+            return {};
+        }
+        std::map<unsigned, int> nodes = read_nodes();
+        std::vector<Cpu> cpus;
+        for (unsigned id : ids) {
+            if (id < CPU_SETSIZE && CPU_ISSET(id, &mask)) {
+                auto it = nodes.find(id);
+                cpus.push_back(Cpu{id, it == nodes.end() ? -1 : it->second});
+            }
+        }
+        std::stable_sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) { return a.node < b.node; });
+        return cpus;
+    }
+
+    std::vector<Cpu> allowed() {
+        std::vector<unsigned> ids;
+        for (unsigned id = 0; id < CPU_SETSIZE; ++id) {
+            ids.push_back(id);
+        }
+        return resolve(ids);
+    }
+
+    bool pin_current_thread(unsigned cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+}
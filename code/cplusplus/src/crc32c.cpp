@@ -0,0 +1,114 @@
+#include "crc32c.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+namespace {
+    constexpr std::uint32_t kPolynomial = 0x82F63B78; // reflected 0x1EDC6F41
+
+    constexpr std::array<std::uint32_t, 256> make_table() {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (c >> 1) ^ kPolynomial : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }
+
+    constexpr auto kTable = make_table();
+
+    std::uint32_t crc32c_portable(const unsigned char* p, std::size_t len, std::uint32_t crc) {
+        while (len--) {
+            crc = kTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    std::uint32_t crc32c_sse42(const unsigned char* p, std::size_t len, std::uint32_t crc) {
+        std::uint64_t c = crc;
+        for (; len >= 8; p += 8, len -= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            c = _mm_crc32_u64(c, word);
+        }
+        crc = static_cast<std::uint32_t>(c);
+        for (; len > 0; ++p, --len) {
+            crc = _mm_crc32_u8(crc, *p);
+        }
+        return crc;
+    }
+
+    const bool kHasSse42 = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__)
+#if defined(__clang__)
+    __attribute__((target("crc")))
+#else
+    __attribute__((target("+crc")))
+#endif
+    std::uint32_t crc32c_armv8(const unsigned char* p, std::size_t len, std::uint32_t crc) {
+        for (; len >= 8; p += 8, len -= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            crc = __crc32cd(crc, word);
+        }
+        for (; len > 0; ++p, --len) {
+            crc = __crc32cb(crc, *p);
+        }
+        return crc;
+    }
+
+    bool has_armv8_crc() {
+#if defined(__APPLE__)
+        return true;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+        return false;
+#endif
+    }
+
+    const bool kHasCrc = has_armv8_crc();
+#endif
+}
+
+std::uint32_t crc32c(const void* data, std::size_t len, std::uint32_t crc) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (kHasSse42) {
+        return ~crc32c_sse42(p, len, crc);
+    }
+#elif defined(__aarch64__)
+    if (kHasCrc) {
+        return ~crc32c_armv8(p, len, crc);
+    }
+#endif
+    return ~crc32c_portable(p, len, crc);
+}
+
+const char* crc32c_implementation() {
+#if defined(__x86_64__)
+    if (kHasSse42) {
+        return "sse4.2";
+    }
+#elif defined(__aarch64__)
+    if (kHasCrc) {
+        return "armv8-crc";
+    }
+#endif
+    return "portable";
+}
@@ -0,0 +1,94 @@
+#include "credential_cache.hpp"
+#include "metrics.hpp"
+#include <openssl/crypto.h>
+#include <functional>
+
+namespace {
+    constexpr std::size_t kShardBits = 6;
+    constexpr std::size_t kShardCount = std::size_t{1} << kShardBits;
+
+    struct CacheMetrics {
+        metrics::Counter& hits = metrics::counter(
+            "auth_credential_cache_hits_total", "Logins accepted from the verified-credential cache without hashing");
+        metrics::Counter& misses = metrics::counter(
+            "auth_credential_cache_misses_total", "Logins the verified-credential cache could not vouch for");
+        metrics::Counter& evictions = metrics::counter(
+            "auth_credential_cache_evictions_total", "Verified-credential entries dropped on expiry or overwritten");
+        metrics::Counter& invalidations = metrics::counter(
+            "auth_credential_cache_invalidations_total", "Verified-credential entries dropped because the account was deleted");
+    };
+
+    CacheMetrics& cache_metrics() {
+        static CacheMetrics m;
+        return m;
+    }
+}
+
+CredentialCache::CredentialCache(Options options)
+    : options_(options)
+    , shards_(new Shard[kShardCount])
+{
+    std::size_t per_shard = 1;
+    while (per_shard * kShardCount < options_.capacity) {
+        per_shard <<= 1;
+    }
+    slot_mask_ = per_shard - 1;
+    for (std::size_t i = 0; i < kShardCount; ++i) {
+        shards_[i].slots.resize(per_shard);
+    }
+    cache_metrics();
+}
+
+CredentialCache::Slot& CredentialCache::slot_for(std::string_view email, std::unique_lock<std::mutex>& lock) {
+    std::size_t hash = std::hash<std::string_view>{}(email);
+    Shard& shard = shards_[hash & (kShardCount - 1)];
+    lock = std::unique_lock<std::mutex>(shard.mutex);
+    return shard.slots[(hash >> kShardBits) & slot_mask_];
+}
+
+bool CredentialCache::contains(std::string_view email, const crypto::Digest& fingerprint) {
+    CacheMetrics& m = cache_metrics();
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    if (slot.email.empty() || slot.email != email) {
+        lock.unlock();
+        m.misses.add();
+        return false;
+    }
+    if (Clock::now() >= slot.expires) {
+        slot.email.clear();
+        lock.unlock();
+        m.evictions.add();
+        m.misses.add();
+        return false;
+    }
+    bool hit = CRYPTO_memcmp(slot.fingerprint.data(), fingerprint.data(), fingerprint.size()) == 0;
+    lock.unlock();
+    (hit ? m.hits : m.misses).add();
+    return hit;
+}
+
+void CredentialCache::insert(std::string_view email, const crypto::Digest& fingerprint) {
+    Clock::time_point now = Clock::now();
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    bool evicted = !slot.email.empty() && slot.email != email;
+    slot.expires = now + options_.ttl;
+    slot.email.assign(email);
+    slot.fingerprint = fingerprint;
+    lock.unlock();
+    if (evicted) {
+        cache_metrics().evictions.add();
+    }
+}
+
+void CredentialCache::invalidate(std::string_view email) {
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    if (slot.email.empty() || slot.email != email) {
+        return;
+    }
+    slot.email.clear();
+    lock.unlock();
+    cache_metrics().invalidations.add();
+}
@@ -0,0 +1,491 @@
+#include "credentials_body.hpp"
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    // A string's bytes need a closer look at a quote, a backslash, a
+    // control character or the start of a multi-byte UTF-8 sequence
+    bool is_special(unsigned char c) {
+        return c == '"' || c == '\\' || c < 0x20 || c >= 0x80;
+    }
+
+    const char* find_special_scalar(const char* p, const char* end) {
+        while (p < end && !is_special(static_cast<unsigned char>(*p))) {
+            ++p;
+        }
+        return p;
+    }
+
+#if defined(__x86_64__)
+    // A signed compare against 0x20 catches both control characters and
+    // bytes from 0x80 up
+    const char* find_special_sse2(const char* p, const char* end) {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(0x20);
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                _mm_cmplt_epi8(v, space));
+            if (int mask = _mm_movemask_epi8(special)) {
+                return p + __builtin_ctz(static_cast<unsigned>(mask));
+            }
+            p += 16;
+        }
+        return find_special_scalar(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    const char* find_special_avx2(const char* p, const char* end) {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i space = _mm256_set1_epi8(0x20);
+        while (end - p >= 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                _mm256_cmpgt_epi8(space, v));
+            if (unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special))) {
+                return p + __builtin_ctz(mask);
+            }
+            p += 32;
+        }
+        return find_special_sse2(p, end);
+    }
+#endif
+
+    struct Kernel {
+        const char* (*find_special)(const char*, const char*);
+        const char* name;
+    };
+
+    Kernel pick_kernel() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return {find_special_avx2, "avx2"};
+        }
+        return {find_special_sse2, "sse2"};
+#else
+        return {find_special_scalar, "scalar"};
+#endif
+    }
+
+    const Kernel kKernel = pick_kernel();
+
+    int hex_digit(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    void append_utf8(std::string& out, std::uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xc0 | cp >> 6);
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xe0 | cp >> 12);
+            out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | cp >> 18);
+            out += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+            out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    class Scanner {
+    public:
+        explicit Scanner(std::string_view body)
+            : p_(body.data())
+            , end_(body.data() + body.size())
+        {
+            // nlohmann skips a UTF-8 byte order mark
+            if (body.substr(0, 3) == "\xEF\xBB\xBF") {
+                p_ += 3;
+            }
+        }
+
+        // nlohmann's lexer also takes a NUL byte for the end of the input,
+        // so nothing after one that follows the value is ever read
+        bool at_end() const { return p_ == end_ || *p_ == '\0'; }
+
+        void skip_whitespace() {
+            while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+                ++p_;
+            }
+        }
+
+        bool consume(char c) {
+            if (p_ < end_ && *p_ == c) {
+                ++p_;
+                return true;
+            }
+            return false;
+        }
+
+        bool peek(char c) const {
+            return p_ < end_ && *p_ == c;
+        }
+
+        // A string at the cursor. Without escapes value points into the
+        // body; otherwise it is decoded into scratch (or, with no scratch,
+        // only checked).
+        bool string(std::string_view& value, std::string* scratch) {
+            if (!consume('"')) {
+                return false;
+            }
+            const char* start = p_;
+            std::size_t decoded = std::string::npos;
+            for (;;) {
+                const char* run = p_;
+                p_ = kKernel.find_special(p_, end_);
+                if (decoded != std::string::npos && scratch) {
+                    scratch->append(run, p_);
+                }
+                if (p_ == end_) {
+                    return false;
+                }
+                unsigned char c = static_cast<unsigned char>(*p_);
+                if (c == '"') {
+                    if (decoded == std::string::npos) {
+                        value = std::string_view(start, static_cast<std::size_t>(p_ - start));
+                    } else if (scratch) {
+                        value = std::string_view(scratch->data() + decoded, scratch->size() - decoded);
+                    }
+                    ++p_;
+                    return true;
+                }
+                if (c < 0x20) {
+                    return false;
+                }
+                if (c >= 0x80) {
+                    const char* sequence = p_;
+                    if (!utf8_sequence()) {
+                        return false;
+                    }
+                    if (decoded != std::string::npos && scratch) {
+                        scratch->append(sequence, p_);
+                    }
+                    continue;
+                }
+                if (decoded == std::string::npos) {
+                    decoded = scratch ? begin_decoding(*scratch, start) : 0;
+                }
+                if (!escape(scratch)) {
+                    return false;
+                }
+            }
+        }
+
+        // Any JSON value at the cursor, checked and skipped. Nesting is
+        // tracked in a string used as a stack, so depth costs no recursion.
+        bool skip_value() {
+            std::string open;
+            for (;;) {
+                skip_whitespace();
+                if (p_ == end_) {
+                    return false;
+                }
+                char c = *p_;
+                if (c == '{' || c == '[') {
+                    ++p_;
+                    skip_whitespace();
+                    if (!consume(c == '{' ? '}' : ']')) {
+                        open += c;
+                        if (c == '{' && !member_name()) {
+                            return false;
+                        }
+                        continue;
+                    }
+                } else if (c == '"') {
+                    std::string_view ignored;
+                    if (!string(ignored, nullptr)) {
+                        return false;
+                    }
+                } else if (c == 't' || c == 'f' || c == 'n') {
+                    if (!literal()) {
+                        return false;
+                    }
+                } else if (!number()) {
+                    return false;
+                }
+
+                // A value just ended; close whatever it completes
+                for (;;) {
+                    if (open.empty()) {
+                        return true;
+                    }
+                    skip_whitespace();
+                    if (consume(',')) {
+                        if (open.back() == '{' && !member_name()) {
+                            return false;
+                        }
+                        break;
+                    }
+                    if (!consume(open.back() == '{' ? '}' : ']')) {
+                        return false;
+                    }
+                    open.pop_back();
+                }
+            }
+        }
+
+    private:
+        // Decoded strings are never longer than their source, so reserving
+        // the rest of the body up front keeps earlier views valid
+        std::size_t begin_decoding(std::string& scratch, const char* start) {
+            std::size_t needed = scratch.size() + static_cast<std::size_t>(end_ - start);
+            if (scratch.capacity() < needed) {
+                scratch.reserve(needed);
+            }
+            std::size_t offset = scratch.size();
+            scratch.append(start, p_);
+            return offset;
+        }
+
+        // A member name and its colon, leaving the cursor at the value
+        bool member_name() {
+            std::string_view ignored;
+            skip_whitespace();
+            if (!string(ignored, nullptr)) {
+                return false;
+            }
+            skip_whitespace();
+            return consume(':');
+        }
+
+        bool escape(std::string* out) {
+            if (end_ - p_ < 2) {
+                return false;
+            }
+            char c = p_[1];
+            p_ += 2;
+            char plain;
+            switch (c) {
+                case '"': plain = '"'; break;
+                case '\\': plain = '\\'; break;
+                case '/': plain = '/'; break;
+                case 'b': plain = '\b'; break;
+                case 'f': plain = '\f'; break;
+                case 'n': plain = '\n'; break;
+                case 'r': plain = '\r'; break;
+                case 't': plain = '\t'; break;
+                case 'u': {
+                    std::uint32_t cp;
+                    if (!hex4(cp) || (cp >= 0xdc00 && cp <= 0xdfff)) {
+                        return false;
+                    }
+                    if (cp >= 0xd800 && cp <= 0xdbff) {
+                        // Only valid as the first half of a surrogate pair
+                        std::uint32_t low;
+                        if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+                            return false;
+                        }
+                        p_ += 2;
+                        if (!hex4(low) || low < 0xdc00 || low > 0xdfff) {
+                            return false;
+                        }
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    if (out) {
+                        append_utf8(*out, cp);
+                    }
+                    return true;
+                }
+                default:
+                    return false;
+            }
+            if (out) {
+                *out += plain;
+            }
+            return true;
+        }
+
+        bool hex4(std::uint32_t& value) {
+            if (end_ - p_ < 4) {
+                return false;
+            }
+            value = 0;
+            for (int i = 0; i < 4; ++i) {
+                int digit = hex_digit(p_[i]);
+                if (digit < 0) {
+                    return false;
+                }
+                value = value << 4 | static_cast<std::uint32_t>(digit);
+            }
+            p_ += 4;
+            return true;
+        }
+
+        // One well-formed UTF-8 sequence of two to four bytes: no overlong
+        // forms, no surrogates, nothing past U+10FFFF
+        bool utf8_sequence() {
+            unsigned char lead = static_cast<unsigned char>(*p_);
+            unsigned char low = 0x80, high = 0xbf;
+            int continuation;
+            if (lead >= 0xc2 && lead <= 0xdf) {
+                continuation = 1;
+            } else if (lead >= 0xe0 && lead <= 0xef) {
+                continuation = 2;
+                low = lead == 0xe0 ? 0xa0 : 0x80;
+                high = lead == 0xed ? 0x9f : 0xbf;
+            } else if (lead >= 0xf0 && lead <= 0xf4) {
+                continuation = 3;
+                low = lead == 0xf0 ? 0x90 : 0x80;
+                high = lead == 0xf4 ? 0x8f : 0xbf;
+            } else {
+                return false;
+            }
+            if (end_ - p_ <= continuation) {
+                return false;
+            }
+            for (int i = 1; i <= continuation; ++i) {
+                unsigned char c = static_cast<unsigned char>(p_[i]);
+                if (c < low || c > high) {
+                    return false;
+                }
+                low = 0x80;
+                high = 0xbf;
+            }
+            p_ += continuation + 1;
+            return true;
+        }
+
+        bool literal() {
+            for (std::string_view word : {"true", "false", "null"}) {
+                if (static_cast<std::size_t>(end_ - p_) >= word.size() &&
+                    std::string_view(p_, word.size()) == word) {
+                    p_ += word.size();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool digits() {
+            const char* start = p_;
+            while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+                ++p_;
+            }
+            return p_ > start;
+        }
+
+        // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? that, like in
+        // nlohmann, does not overflow a double
+        bool number() {
+            const char* start = p_;
+            consume('-');
+            const char* integer = p_;
+            if (consume('0')) {
+                // no leading zeros; a digit after this fails as a stray token
+            } else if (p_ == end_ || *p_ < '1' || *p_ > '9' || !digits()) {
+                return false;
+            }
+            std::size_t integer_digits = static_cast<std::size_t>(p_ - integer);
+            if (consume('.') && !digits()) {
+                return false;
+            }
+            bool exponent = false;
+            if (consume('e') || consume('E')) {
+                exponent = true;
+                if (!consume('+')) {
+                    consume('-');
+                }
+                if (!digits()) {
+                    return false;
+                }
+            }
+            // Without an exponent only an absurdly long integer part can
+            // overflow
+            if (exponent || integer_digits > 300) {
+                std::string text(start, p_);
+                return std::isfinite(std::strtod(text.c_str(), nullptr));
+            }
+            return true;
+        }
+
+        const char* p_;
+        const char* end_;
+    };
+}
+
+namespace credentials_body {
+    bool parse(std::string_view body, Fields& fields, std::string& scratch) {
+        scratch.clear();
+        Scanner scanner(body);
+        scanner.skip_whitespace();
+        if (!scanner.consume('{')) {
+            return false;
+        }
+        bool have_email = false;
+        bool have_password = false;
+        scanner.skip_whitespace();
+        if (!scanner.consume('}')) {
+            for (;;) {
+                std::string_view name;
+                scanner.skip_whitespace();
+                if (!scanner.string(name, &scratch)) {
+                    return false;
+                }
+                scanner.skip_whitespace();
+                if (!scanner.consume(':')) {
+                    return false;
+                }
+                scanner.skip_whitespace();
+
+                std::string_view* field = nullptr;
+                bool* have = nullptr;
+                if (name == "email") {
+                    field = &fields.email;
+                    have = &have_email;
+                } else if (name == "password") {
+                    field = &fields.password;
+                    have = &have_password;
+                }
+                if (field && scanner.peek('"')) {
+                    if (!scanner.string(*field, &scratch)) {
+                        return false;
+                    }
+                    *have = true;
+                } else {
+                    if (!scanner.skip_value()) {
+                        return false;
+                    }
+                    if (have) {
+                        // A later non-string replaces an earlier string
+                        *have = false;
+                    }
+                }
+
+                scanner.skip_whitespace();
+                if (scanner.consume('}')) {
+                    break;
+                }
+                if (!scanner.consume(',')) {
+                    return false;
+                }
+            }
+        }
+        scanner.skip_whitespace();
+        return scanner.at_end() && have_email && have_password;
+    }
+
+    const char* implementation() {
+        return kKernel.name;
+    }
+}
@@ -1,36 +1,86 @@
 #include "crypto.hpp"
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
-#include <sstream>
-#include <iomanip>
+#include "hmac.hpp"
+#include <openssl/crypto.h>
+#include <cstring>
 
 namespace {
-    const char* SECRET_KEY = "YOUR_SUPER_SECRET";
-    
-    std::string bytes_to_hex(const unsigned char* data, size_t len) {
-        std::stringstream ss;
-        ss << std::hex << std::setfill('0');
-        for (size_t i = 0; i < len; ++i) {
-            ss << std::setw(2) << static_cast<int>(data[i]);
-        }
-        return ss.str();
-    }
+    constexpr std::string_view SECRET_KEY = "YOUR_SUPER_SECRET";
 }
 
 namespace crypto {
-    std::string hash_password(const std::string& password) {
-        unsigned char hash[EVP_MAX_MD_SIZE];
-        unsigned int hash_len;
-        
-        HMAC(EVP_sha256(), SECRET_KEY, strlen(SECRET_KEY),
-             reinterpret_cast<const unsigned char*>(password.c_str()),
-             password.length(), hash, &hash_len);
-        
-        return bytes_to_hex(hash, hash_len);
-    }
-    
-    bool verify_password(const std::string& password, const std::string& stored_hash) {
-        std::string computed_hash = hash_password(password);
-        return computed_hash == stored_hash;
+    const HmacSha256& password_key() {
+        static const HmacSha256 password_mac(SECRET_KEY);
+        return password_mac;
+    }
+
+    Digest hash_password(std::string_view password) {
+        return password_key().mac(password);
+    }
+
+    bool verify_password(std::string_view password, const Digest& stored_hash) {
+        return digest_equal(hash_password(password), stored_hash);
+    }
+
+    bool digest_equal(const Digest& a, const Digest& b) {
+        return CRYPTO_memcmp(a.data(), b.data(), kDigestSize) == 0;
+    }
+
+    bool secret_equal(std::string_view a, std::string_view b) {
+        return digest_equal(hash_password(a), hash_password(b));
+    }
+
+    void encode_credential(const Credential& credential, unsigned char* out) {
+        out[0] = static_cast<unsigned char>(credential.scheme);
+        out[1] = out[2] = out[3] = 0;
+        for (int i = 0; i < 4; ++i) {
+            out[4 + i] = static_cast<unsigned char>(credential.cost >> (8 * i));
+        }
+        std::memcpy(out + 8, credential.salt.data(), kSaltSize);
+        std::memcpy(out + 8 + kSaltSize, credential.hash.data(), kDigestSize);
+    }
+
+    bool decode_credential(const unsigned char* in, Credential& credential) {
+        if (in[0] > static_cast<unsigned char>(Scheme::Scrypt)) {
+            return false;
+        }
+        credential.scheme = static_cast<Scheme>(in[0]);
+        credential.cost = 0;
+        for (int i = 0; i < 4; ++i) {
+            credential.cost |= static_cast<std::uint32_t>(in[4 + i]) << (8 * i);
+        }
+        std::memcpy(credential.salt.data(), in + 8, kSaltSize);
+        std::memcpy(credential.hash.data(), in + 8 + kSaltSize, kDigestSize);
+        return true;
+    }
+
+    std::string to_hex(const Digest& digest) {
+        static constexpr char kHex[] = "0123456789abcdef";
+        std::string out(kDigestSize * 2, '\0');
+        for (std::size_t i = 0; i < kDigestSize; ++i) {
+            out[2 * i] = kHex[digest[i] >> 4];
+            out[2 * i + 1] = kHex[digest[i] & 0x0f];
+        }
+        return out;
+    }
+
+    bool from_hex(std::string_view hex, Digest& digest) {
+        if (hex.size() != kDigestSize * 2) {
+            return false;
+        }
+        auto nibble = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+        for (std::size_t i = 0; i < kDigestSize; ++i) {
+            int hi = nibble(hex[2 * i]);
+            int lo = nibble(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            digest[i] = static_cast<unsigned char>(hi << 4 | lo);
+        }
+        return true;
     }
 }
@@ -0,0 +1,143 @@
+#include "epoch.hpp"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+    // Epoch value announced by a thread that is not inside a guard
+    constexpr std::uint64_t kQuiescent = 0;
+
+    // Retired nodes are only collected in batches of this size so the
+    // participant scan is amortized over many deletes
+    constexpr std::size_t kCollectThreshold = 64;
+
+    struct alignas(64) Participant {
+        std::atomic<std::uint64_t> epoch{kQuiescent};
+        std::atomic<bool> in_use{false};
+        Participant* next = nullptr;
+    };
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        std::uint64_t epoch;
+    };
+
+    alignas(64) std::atomic<std::uint64_t> global_epoch{1};
+    std::atomic<Participant*> participants{nullptr};
+
+    std::mutex limbo_mutex;
+    std::vector<Retired> limbo;
+    std::size_t retired_since_collect = 0;
+
+    Participant* acquire_participant() {
+        for (Participant* p = participants.load(std::memory_order_acquire); p; p = p->next) {
+            bool expected = false;
+            if (!p->in_use.load(std::memory_order_relaxed) &&
+                p->in_use.compare_exchange_strong(expected, true)) {
+                return p;
+            }
+        }
+
+        auto* p = new Participant;
+        p->in_use.store(true, std::memory_order_relaxed);
+        Participant* head = participants.load(std::memory_order_relaxed);
+        do {
+            p->next = head;
+        } while (!participants.compare_exchange_weak(head, p, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        return p;
+    }
+
+    // Registers the thread on first use and releases its slot on exit.
+    // Participants are never freed, only reused by later threads.
+    struct ThreadState {
+        Participant* participant = acquire_participant();
+        unsigned depth = 0;
+
+        ~ThreadState() {
+            participant->epoch.store(kQuiescent, std::memory_order_release);
+            participant->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    ThreadState& thread_state() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    // The epoch may move from e to e + 1 only once every thread inside a
+    // guard has observed e.
+    void try_advance() {
+        std::uint64_t current = global_epoch.load(std::memory_order_acquire);
+        for (Participant* p = participants.load(std::memory_order_acquire); p; p = p->next) {
+            std::uint64_t e = p->epoch.load(std::memory_order_acquire);
+            if (e != kQuiescent && e != current) {
+                return;
+            }
+        }
+        global_epoch.compare_exchange_strong(current, current + 1);
+    }
+
+    // Frees everything retired at least two epochs ago; caller holds limbo_mutex
+    void free_expired(std::vector<Retired>& ready) {
+        std::uint64_t now = global_epoch.load(std::memory_order_acquire);
+        auto it = limbo.begin();
+        for (auto& r : limbo) {
+            if (r.epoch + 2 <= now) {
+                ready.push_back(r);
+            } else {
+                *it++ = r;
+            }
+        }
+        limbo.erase(it, limbo.end());
+    }
+}
+
+namespace epoch {
+    Guard::Guard() {
+        ThreadState& state = thread_state();
+        if (state.depth++ == 0) {
+            state.participant->epoch.store(global_epoch.load(std::memory_order_relaxed),
+                                           std::memory_order_relaxed);
+            // Order the announcement before any load of shared nodes
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    Guard::~Guard() {
+        ThreadState& state = thread_state();
+        if (--state.depth == 0) {
+            state.participant->epoch.store(kQuiescent, std::memory_order_release);
+        }
+    }
+
+    void retire(void* ptr, void (*deleter)(void*)) {
+        // The unlink must be visible before we read the epoch it is tagged with
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t e = global_epoch.load(std::memory_order_relaxed);
+
+        bool should_collect;
+        {
+            std::lock_guard<std::mutex> lock(limbo_mutex);
+            limbo.push_back({ptr, deleter, e});
+            should_collect = ++retired_since_collect >= kCollectThreshold;
+        }
+        if (should_collect) {
+            collect();
+        }
+    }
+
+    void collect() {
+        std::vector<Retired> ready;
+        {
+            std::lock_guard<std::mutex> lock(limbo_mutex);
+            retired_since_collect = 0;
+            try_advance();
+            free_expired(ready);
+        }
+        for (auto& r : ready) {
+            r.deleter(r.ptr);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#include "flat_user_table.hpp"
+#include <cstring>
+#include <new>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr std::size_t kNotFound = ~std::size_t{0};
+
+    // Bitmasks over one group of 16 control bytes
+    struct Group {
+#if defined(__SSE2__)
+        __m128i ctrl;
+
+        explicit Group(const std::uint8_t* p)
+            : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+
+        std::uint32_t match(std::uint8_t h2) const {
+            return static_cast<std::uint32_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(h2)))));
+        }
+
+        // Empty is the only control value with the high bit set
+        std::uint32_t match_empty() const {
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(ctrl));
+        }
+#else
+        std::uint8_t ctrl[16];
+
+        explicit Group(const std::uint8_t* p) { std::memcpy(ctrl, p, sizeof(ctrl)); }
+
+        std::uint32_t match(std::uint8_t h2) const {
+            std::uint32_t mask = 0;
+            for (unsigned i = 0; i < 16; ++i) {
+                mask |= static_cast<std::uint32_t>(ctrl[i] == h2) << i;
+            }
+            return mask;
+        }
+
+        std::uint32_t match_empty() const {
+            std::uint32_t mask = 0;
+            for (unsigned i = 0; i < 16; ++i) {
+                mask |= static_cast<std::uint32_t>(ctrl[i] >> 7) << i;
+            }
+            return mask;
+        }
+#endif
+    };
+}
+
+FlatUserTable::EmailKey* FlatUserTable::EmailKey::create(std::size_t hash, std::string_view email,
+                                                         bool erased) {
+    void* mem = ::operator new(sizeof(EmailKey) + email.size());
+    auto* key = new (mem) EmailKey{hash, static_cast<std::uint32_t>(email.size()), erased};
+    std::memcpy(key + 1, email.data(), email.size());
+    return key;
+}
+
+void FlatUserTable::EmailKey::destroy(void* key) {
+    ::operator delete(key);
+}
+
+FlatUserTable::FlatUserTable(std::size_t capacity)
+    : mask_(capacity - 1)
+    , ctrl_(new std::uint8_t[capacity + kGroupWidth - 1])
+    , slots_(new Slot[capacity])
+{
+    std::memset(ctrl_.get(), kEmpty, capacity + kGroupWidth - 1);
+}
+
+std::size_t FlatUserTable::capacity_for(std::size_t n) {
+    std::size_t capacity = kGroupWidth;
+    while (capacity - capacity / 8 < n + 1) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+void FlatUserTable::set_ctrl(std::size_t i, std::uint8_t value) {
+    ctrl_[i] = value;
+    if (i < kGroupWidth - 1) {
+        ctrl_[mask_ + 1 + i] = value;
+    }
+}
+
+std::size_t FlatUserTable::find_index(std::size_t hash, std::string_view email) const {
+    const std::uint8_t tag = h2(hash);
+    std::size_t pos = hash & mask_;
+
+    // A racing writer can make a reader see an inconsistent picture, so
+    // never probe more than one full lap
+    for (std::size_t probed = 0; probed <= mask_; probed += kGroupWidth) {
+        Group group(ctrl_.get() + pos);
+        std::uint32_t empties = group.match_empty();
+        std::uint32_t matches = group.match(tag);
+        if (empties) {
+            // Linear probing: nothing past the first empty slot belongs to us
+            matches &= (empties & (0u - empties)) - 1;
+        }
+
+        while (matches) {
+            std::size_t i = (pos + static_cast<std::size_t>(__builtin_ctz(matches))) & mask_;
+            matches &= matches - 1;
+            const EmailKey* key = slots_[i].key.load(std::memory_order_relaxed);
+            if (key && key->hash == hash && key->view() == email) {
+                return i;
+            }
+        }
+
+        if (empties) {
+            return kNotFound;
+        }
+        pos = (pos + kGroupWidth) & mask_;
+    }
+    return kNotFound;
+}
+
+const FlatUserTable::EmailKey* FlatUserTable::find(std::size_t hash, std::string_view email,
+                                                   Credential* credential) const {
+    std::size_t i = find_index(hash, email);
+    if (i == kNotFound) {
+        return nullptr;
+    }
+    if (credential) {
+        std::memcpy(credential, &slots_[i].credential, sizeof(*credential));
+    }
+    return slots_[i].key.load(std::memory_order_relaxed);
+}
+
+void FlatUserTable::insert(const EmailKey* key, const Credential& credential) {
+    std::size_t pos = key->hash & mask_;
+    for (;;) {
+        std::uint32_t empties = Group(ctrl_.get() + pos).match_empty();
+        if (empties) {
+            std::size_t i = (pos + static_cast<std::size_t>(__builtin_ctz(empties))) & mask_;
+            slots_[i].credential = credential;
+            slots_[i].key.store(key, std::memory_order_relaxed);
+            set_ctrl(i, h2(key->hash));
+            ++size_;
+            return;
+        }
+        pos = (pos + kGroupWidth) & mask_;
+    }
+}
+
+const FlatUserTable::EmailKey* FlatUserTable::erase(std::size_t hash, std::string_view email) {
+    std::size_t i = find_index(hash, email);
+    if (i == kNotFound) {
+        return nullptr;
+    }
+    const EmailKey* removed = slots_[i].key.load(std::memory_order_relaxed);
+    erase_at(i);
+    return removed;
+}
+
+// Backward-shift deletion: walk the rest of the cluster and pull back
+// every entry whose home slot is not between the hole and itself
+void FlatUserTable::erase_at(std::size_t hole) {
+    for (std::size_t j = (hole + 1) & mask_; ctrl_[j] != kEmpty; j = (j + 1) & mask_) {
+        const EmailKey* key = slots_[j].key.load(std::memory_order_relaxed);
+        std::size_t home = key->hash & mask_;
+        if (((j - home) & mask_) >= ((j - hole) & mask_)) {
+            slots_[hole].credential = slots_[j].credential;
+            slots_[hole].key.store(key, std::memory_order_relaxed);
+            set_ctrl(hole, ctrl_[j]);
+            hole = j;
+        }
+    }
+
+    set_ctrl(hole, kEmpty);
+    slots_[hole].key.store(nullptr, std::memory_order_relaxed);
+    --size_;
+}
+
+bool FlatUserTable::drain_into(FlatUserTable& into, std::size_t* cursor, std::size_t budget) {
+    std::size_t i = *cursor;
+    for (; budget > 0 && i <= mask_; --budget) {
+        if (ctrl_[i] == kEmpty) {
+            ++i;
+            continue;
+        }
+        // erase_at may shift another entry into slot i, so stay put
+        into.insert(slots_[i].key.load(std::memory_order_relaxed), slots_[i].credential);
+        erase_at(i);
+    }
+    *cursor = i;
+    return size_ == 0;
+}
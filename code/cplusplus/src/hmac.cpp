@@ -0,0 +1,78 @@
+#include "hmac.hpp"
+#include <openssl/crypto.h>
+#include <cstring>
+
+namespace {
+    // Padding blocks are written a word at a time: byte stores followed
+    // by the kernels' 16-byte loads would defeat store forwarding
+    void store_be32(unsigned char* p, std::uint32_t v) {
+        v = __builtin_bswap32(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    // Length field of the final block; the key block already absorbed
+    // into the midstate counts too
+    void put_bit_length(unsigned char* block_end, std::uint64_t message_len) {
+        std::uint64_t bits = __builtin_bswap64((sha256::kBlockSize + message_len) * 8);
+        std::memcpy(block_end - sizeof(bits), &bits, sizeof(bits));
+    }
+}
+
+namespace crypto {
+    HmacSha256::HmacSha256(std::string_view key) {
+        unsigned char block[sha256::kBlockSize] = {};
+        if (key.size() > sha256::kBlockSize) {
+            sha256::hash(key.data(), key.size(), block);
+        } else {
+            std::memcpy(block, key.data(), key.size());
+        }
+
+        unsigned char pad[sha256::kBlockSize];
+        for (std::size_t i = 0; i < sha256::kBlockSize; ++i) {
+            pad[i] = block[i] ^ 0x36;
+        }
+        std::memcpy(inner_, sha256::kInitialState, sizeof(inner_));
+        sha256::compress(inner_, pad, 1);
+
+        for (std::size_t i = 0; i < sha256::kBlockSize; ++i) {
+            pad[i] = block[i] ^ 0x5c;
+        }
+        std::memcpy(outer_, sha256::kInitialState, sizeof(outer_));
+        sha256::compress(outer_, pad, 1);
+
+        OPENSSL_cleanse(block, sizeof(block));
+        OPENSSL_cleanse(pad, sizeof(pad));
+    }
+
+    void HmacSha256::mac(const void* data, std::size_t len, unsigned char* out) const {
+        const auto* p = static_cast<const unsigned char*>(data);
+
+        std::uint32_t state[8];
+        std::memcpy(state, inner_, sizeof(state));
+        std::size_t full = len / sha256::kBlockSize;
+        sha256::compress(state, p, full);
+
+        unsigned char block[2 * sha256::kBlockSize] = {};
+        std::size_t rest = len % sha256::kBlockSize;
+        std::memcpy(block, p + full * sha256::kBlockSize, rest);
+        block[rest] = 0x80;
+        std::size_t tail = rest + 9 <= sha256::kBlockSize ? 1 : 2;
+        put_bit_length(block + tail * sha256::kBlockSize, len);
+        sha256::compress(state, block, tail);
+
+        // The outer hash always fits one block: the inner digest, then
+        // padding
+        std::memset(block, 0, sha256::kBlockSize);
+        for (int i = 0; i < 8; ++i) {
+            store_be32(block + 4 * i, state[i]);
+        }
+        block[sha256::kDigestSize] = 0x80;
+        put_bit_length(block + sha256::kBlockSize, sha256::kDigestSize);
+        std::memcpy(state, outer_, sizeof(state));
+        sha256::compress(state, block, 1);
+
+        for (int i = 0; i < 8; ++i) {
+            store_be32(out + 4 * i, state[i]);
+        }
+    }
+}
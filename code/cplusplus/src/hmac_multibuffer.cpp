@@ -0,0 +1,398 @@
+#include "hmac.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Multi-buffer HMAC-SHA256: lane i of every vector register belongs to an
+// independent message, so one pass of the compression function advances
+// 8 (AVX2) or 16 (AVX-512) MACs. Messages may have different lengths;
+// lanes that have run out of blocks are masked and keep their state.
+namespace {
+    using crypto::MacJob;
+    using Kernel = crypto::MacKernel;
+
+#if defined(__x86_64__)
+    const std::uint32_t* const K = sha256::kRoundConstants;
+
+    // The inner hash of one job: whole blocks straight from the message,
+    // then one or two blocks holding the remainder and the padding
+    struct Lane {
+        const unsigned char* data;
+        std::size_t full_blocks;
+        std::size_t blocks;
+        unsigned char tail[128];
+
+        void prepare(const MacJob& job) {
+            data = static_cast<const unsigned char*>(job.data);
+            full_blocks = job.len / 64;
+            std::size_t rest = job.len % 64;
+            std::size_t tail_blocks = rest + 9 <= 64 ? 1 : 2;
+            blocks = full_blocks + tail_blocks;
+
+            std::memset(tail, 0, sizeof(tail));
+            if (rest) {
+                std::memcpy(tail, data + full_blocks * 64, rest);
+            }
+            tail[rest] = 0x80;
+            // The key block in the midstate counts towards the length
+            std::uint64_t bits = (64 + static_cast<std::uint64_t>(job.len)) * 8;
+            unsigned char* end = tail + tail_blocks * 64;
+            for (int i = 1; i <= 8; ++i) {
+                end[-i] = static_cast<unsigned char>(bits >> (8 * (i - 1)));
+            }
+        }
+
+        const unsigned char* block(std::size_t b) const {
+            return b < full_blocks ? data + b * 64 : tail + (b - full_blocks) * 64;
+        }
+    };
+
+    std::uint32_t load_be32(const unsigned char* p) {
+        return std::uint32_t{p[0]} << 24 | std::uint32_t{p[1]} << 16 | std::uint32_t{p[2]} << 8 | p[3];
+    }
+
+    void store_be32(unsigned char* p, std::uint32_t v) {
+        p[0] = static_cast<unsigned char>(v >> 24);
+        p[1] = static_cast<unsigned char>(v >> 16);
+        p[2] = static_cast<unsigned char>(v >> 8);
+        p[3] = static_cast<unsigned char>(v);
+    }
+
+    // Message words of block b for every lane, transposed so that w[t]
+    // holds word t of each lane. Lanes without a block b get zeros; their
+    // result is discarded anyway.
+    template<std::size_t Lanes>
+    void gather_words(const Lane* lanes, std::size_t n, std::size_t b, std::uint32_t (&w)[16][Lanes]) {
+        for (std::size_t l = 0; l < Lanes; ++l) {
+            if (l < n && b < lanes[l].blocks) {
+                const unsigned char* p = lanes[l].block(b);
+                for (int t = 0; t < 16; ++t) {
+                    w[t][l] = load_be32(p + 4 * t);
+                }
+            } else {
+                for (int t = 0; t < 16; ++t) {
+                    w[t][l] = 0;
+                }
+            }
+        }
+    }
+
+    // -------- AVX2, 8 lanes --------
+
+    __attribute__((target("avx2")))
+    inline __m256i rotr8(__m256i x, int n) {
+        return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+    }
+
+    __attribute__((target("avx2")))
+    void compress8(__m256i (&s)[8], __m256i (&w)[16]) {
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; ++i) {
+            __m256i wi;
+            if (i < 16) {
+                wi = w[i];
+            } else {
+                __m256i w15 = w[(i - 15) & 15];
+                __m256i w2 = w[(i - 2) & 15];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w15, 7), rotr8(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w2, 17), rotr8(w2, 19)), _mm256_srli_epi32(w2, 10));
+                wi = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+                w[i & 15] = wi;
+            }
+            __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(e, 6), rotr8(e, 11)), rotr8(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1),
+                                          _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32(static_cast<int>(K[i]))), wi));
+            __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(a, 2), rotr8(a, 13)), rotr8(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i t2 = _mm256_add_epi32(S0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    __attribute__((target("avx2")))
+    void hmac8_avx2(const MacJob* jobs, std::size_t n) {
+        Lane lanes[8];
+        std::size_t max_blocks = 0;
+        for (std::size_t l = 0; l < n; ++l) {
+            lanes[l].prepare(jobs[l]);
+            max_blocks = std::max(max_blocks, lanes[l].blocks);
+        }
+
+        // Unused lanes borrow the first job's key and are never stored
+        alignas(32) std::uint32_t init[8][8];
+        for (std::size_t l = 0; l < 8; ++l) {
+            const std::uint32_t* h = jobs[l < n ? l : 0].key->inner_midstate();
+            for (int i = 0; i < 8; ++i) {
+                init[i][l] = h[i];
+            }
+        }
+        __m256i s[8];
+        for (int i = 0; i < 8; ++i) {
+            s[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(init[i]));
+        }
+
+        alignas(32) std::uint32_t words[16][8];
+        for (std::size_t b = 0; b < max_blocks; ++b) {
+            gather_words<8>(lanes, n, b, words);
+            __m256i w[16];
+            for (int t = 0; t < 16; ++t) {
+                w[t] = _mm256_load_si256(reinterpret_cast<const __m256i*>(words[t]));
+            }
+            alignas(32) std::int32_t active[8];
+            for (std::size_t l = 0; l < 8; ++l) {
+                active[l] = l < n && b < lanes[l].blocks ? -1 : 0;
+            }
+            __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(active));
+            __m256i before[8];
+            std::copy(s, s + 8, before);
+            compress8(s, w);
+            for (int i = 0; i < 8; ++i) {
+                s[i] = _mm256_blendv_epi8(before[i], s[i], mask);
+            }
+        }
+
+        // Outer hash: the inner digest is exactly one padded block
+        __m256i w[16];
+        for (int i = 0; i < 8; ++i) {
+            w[i] = s[i];
+        }
+        w[8] = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+        for (int i = 9; i < 15; ++i) {
+            w[i] = _mm256_setzero_si256();
+        }
+        w[15] = _mm256_set1_epi32((64 + 32) * 8);
+        for (std::size_t l = 0; l < 8; ++l) {
+            const std::uint32_t* h = jobs[l < n ? l : 0].key->outer_midstate();
+            for (int i = 0; i < 8; ++i) {
+                init[i][l] = h[i];
+            }
+        }
+        for (int i = 0; i < 8; ++i) {
+            s[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(init[i]));
+        }
+        compress8(s, w);
+
+        alignas(32) std::uint32_t result[8][8];
+        for (int i = 0; i < 8; ++i) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(result[i]), s[i]);
+        }
+        for (std::size_t l = 0; l < n; ++l) {
+            for (int i = 0; i < 8; ++i) {
+                store_be32(jobs[l].out + 4 * i, result[i][l]);
+            }
+        }
+        _mm256_zeroupper();
+    }
+
+    // -------- AVX-512, 16 lanes --------
+
+    // The unmasked rotate and shift intrinsics merge into an undefined
+    // register, which GCC 12 reports as an uninitialized read. Passing
+    // the input as the merge source with every lane selected gives the
+    // same instruction with all lanes defined.
+    template<int N>
+    __attribute__((target("avx512f"), always_inline))
+    inline __m512i ror16(__m512i x) {
+        return _mm512_mask_ror_epi32(x, 0xffff, x, N);
+    }
+
+    template<unsigned N>
+    __attribute__((target("avx512f"), always_inline))
+    inline __m512i shr16(__m512i x) {
+        return _mm512_mask_srli_epi32(x, 0xffff, x, N);
+    }
+
+    __attribute__((target("avx512f")))
+    void compress16(__m512i (&s)[8], __m512i (&w)[16]) {
+        __m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; ++i) {
+            __m512i wi;
+            if (i < 16) {
+                wi = w[i];
+            } else {
+                __m512i w15 = w[(i - 15) & 15];
+                __m512i w2 = w[(i - 2) & 15];
+                __m512i s0 = _mm512_ternarylogic_epi32(ror16<7>(w15), ror16<18>(w15), shr16<3>(w15), 0x96);
+                __m512i s1 = _mm512_ternarylogic_epi32(ror16<17>(w2), ror16<19>(w2), shr16<10>(w2), 0x96);
+                wi = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], s0), _mm512_add_epi32(w[(i - 7) & 15], s1));
+                w[i & 15] = wi;
+            }
+            // 0x96 is a ^ b ^ c, 0xca is a ? b : c, 0xe8 is majority
+            __m512i S1 = _mm512_ternarylogic_epi32(ror16<6>(e), ror16<11>(e), ror16<25>(e), 0x96);
+            __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xca);
+            __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, S1),
+                                          _mm512_add_epi32(_mm512_add_epi32(ch, _mm512_set1_epi32(static_cast<int>(K[i]))), wi));
+            __m512i S0 = _mm512_ternarylogic_epi32(ror16<2>(a), ror16<13>(a), ror16<22>(a), 0x96);
+            __m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xe8);
+            __m512i t2 = _mm512_add_epi32(S0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm512_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm512_add_epi32(t1, t2);
+        }
+        s[0] = _mm512_add_epi32(s[0], a);
+        s[1] = _mm512_add_epi32(s[1], b);
+        s[2] = _mm512_add_epi32(s[2], c);
+        s[3] = _mm512_add_epi32(s[3], d);
+        s[4] = _mm512_add_epi32(s[4], e);
+        s[5] = _mm512_add_epi32(s[5], f);
+        s[6] = _mm512_add_epi32(s[6], g);
+        s[7] = _mm512_add_epi32(s[7], h);
+    }
+
+    __attribute__((target("avx512f")))
+    void hmac16_avx512(const MacJob* jobs, std::size_t n) {
+        Lane lanes[16];
+        std::size_t max_blocks = 0;
+        for (std::size_t l = 0; l < n; ++l) {
+            lanes[l].prepare(jobs[l]);
+            max_blocks = std::max(max_blocks, lanes[l].blocks);
+        }
+
+        alignas(64) std::uint32_t init[8][16];
+        for (std::size_t l = 0; l < 16; ++l) {
+            const std::uint32_t* h = jobs[l < n ? l : 0].key->inner_midstate();
+            for (int i = 0; i < 8; ++i) {
+                init[i][l] = h[i];
+            }
+        }
+        __m512i s[8];
+        for (int i = 0; i < 8; ++i) {
+            s[i] = _mm512_load_si512(init[i]);
+        }
+
+        alignas(64) std::uint32_t words[16][16];
+        for (std::size_t b = 0; b < max_blocks; ++b) {
+            gather_words<16>(lanes, n, b, words);
+            __m512i w[16];
+            for (int t = 0; t < 16; ++t) {
+                w[t] = _mm512_load_si512(words[t]);
+            }
+            __mmask16 active = 0;
+            for (std::size_t l = 0; l < n; ++l) {
+                if (b < lanes[l].blocks) {
+                    active = static_cast<__mmask16>(active | 1u << l);
+                }
+            }
+            __m512i before[8];
+            std::copy(s, s + 8, before);
+            compress16(s, w);
+            for (int i = 0; i < 8; ++i) {
+                s[i] = _mm512_mask_blend_epi32(active, before[i], s[i]);
+            }
+        }
+
+        __m512i w[16];
+        for (int i = 0; i < 8; ++i) {
+            w[i] = s[i];
+        }
+        w[8] = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+        for (int i = 9; i < 15; ++i) {
+            w[i] = _mm512_setzero_si512();
+        }
+        w[15] = _mm512_set1_epi32((64 + 32) * 8);
+        for (std::size_t l = 0; l < 16; ++l) {
+            const std::uint32_t* h = jobs[l < n ? l : 0].key->outer_midstate();
+            for (int i = 0; i < 8; ++i) {
+                init[i][l] = h[i];
+            }
+        }
+        for (int i = 0; i < 8; ++i) {
+            s[i] = _mm512_load_si512(init[i]);
+        }
+        compress16(s, w);
+
+        alignas(64) std::uint32_t result[8][16];
+        for (int i = 0; i < 8; ++i) {
+            _mm512_store_si512(result[i], s[i]);
+        }
+        for (std::size_t l = 0; l < n; ++l) {
+            for (int i = 0; i < 8; ++i) {
+                store_be32(jobs[l].out + 4 * i, result[i][l]);
+            }
+        }
+        _mm256_zeroupper();
+    }
+#endif
+
+    void hmac_one_by_one(const MacJob* jobs, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            jobs[i].key->mac(jobs[i].data, jobs[i].len, jobs[i].out);
+        }
+    }
+
+    Kernel pick_kernel() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx512f")) {
+            return {hmac16_avx512, 16, "avx512-16x"};
+        }
+        // Eight lanes of plain AVX2 lose to one message at a time on the
+        // SHA extensions
+        if (__builtin_cpu_supports("avx2") && !sha256::hardware_accelerated()) {
+            return {hmac8_avx2, 8, "avx2-8x"};
+        }
+#endif
+        return {hmac_one_by_one, 1, sha256::hardware_accelerated() ? "sha-1x" : "scalar"};
+    }
+
+    const Kernel kKernel = pick_kernel();
+}
+
+namespace crypto {
+    void hmac_many(const MacJob* jobs, std::size_t count) {
+        // A lone job gains nothing from the vector unit
+        if (count == 1 || kKernel.lanes == 1) {
+            hmac_one_by_one(jobs, count);
+            return;
+        }
+        for (std::size_t i = 0; i < count; i += kKernel.lanes) {
+            std::size_t n = std::min(kKernel.lanes, count - i);
+            if (n == 1) {
+                hmac_one_by_one(jobs + i, 1);
+            } else {
+                kKernel.run(jobs + i, n);
+            }
+        }
+    }
+
+    const char* hmac_many_implementation() {
+        return kKernel.name;
+    }
+
+    std::vector<MacKernel> supported_mac_kernels() {
+        std::vector<MacKernel> kernels{kKernel};
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2") && kKernel.run != hmac8_avx2) {
+            kernels.push_back({hmac8_avx2, 8, "avx2-8x"});
+        }
+#endif
+        if (kKernel.run != hmac_one_by_one) {
+            kernels.push_back({hmac_one_by_one, 1, sha256::hardware_accelerated() ? "sha-1x" : "scalar"});
+        }
+        return kernels;
+    }
+}
@@ -0,0 +1,118 @@
+#include "http_reply.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <ostream> // verb.hpp streams verbs without including it
+#include <boost/beast/http/verb.hpp>
+#include <boost/beast/version.hpp>
+
+namespace {
+    namespace http = boost::beast::http;
+
+    std::string status_line(unsigned minor, http::status status) {
+        std::string line = minor ? "HTTP/1.1 " : "HTTP/1.0 ";
+        line += std::to_string(static_cast<unsigned>(status));
+        line += ' ';
+        auto reason = http::obsolete_reason(status);
+        line.append(reason.data(), reason.size());
+        line += "\r\n";
+        return line;
+    }
+
+    // The Date line for the current second, formatted once a second per
+    // thread
+    std::string_view date_line() {
+        thread_local std::time_t formatted = -1;
+        thread_local char line[64];
+        thread_local std::size_t size = 0;
+        std::time_t now = std::time(nullptr);
+        if (now != formatted) {
+            std::tm tm;
+            gmtime_r(&now, &tm);
+            size = std::strftime(line, sizeof(line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+            formatted = now;
+        }
+        return {line, size};
+    }
+
+    // Appends to a fixed buffer, dropping what does not fit
+    struct LineWriter {
+        char* p;
+        char* end;
+
+        void put(std::string_view s) {
+            std::size_t n = std::min(s.size(), static_cast<std::size_t>(end - p));
+            std::memcpy(p, s.data(), n);
+            p += n;
+        }
+    };
+}
+
+ReplyHead::ReplyHead(http::status status, std::string_view content_type) {
+    for (unsigned minor = 0; minor < 2; ++minor) {
+        std::string& lines = lines_[minor];
+        lines = status_line(minor, status);
+        lines += "Server: " BOOST_BEAST_VERSION_STRING "\r\nContent-Type: ";
+        lines.append(content_type.data(), content_type.size());
+        lines += "\r\nAccess-Control-Allow-Origin: *\r\n";
+    }
+}
+
+CannedReply::CannedReply(http::status status, std::string_view body, std::string_view content_type)
+    : head_(status, content_type)
+    , tail_("Content-Length: " + std::to_string(body.size()) + "\r\n\r\n")
+{
+    tail_.append(body.data(), body.size());
+}
+
+void HttpReply::start(unsigned version, bool keep_alive) {
+    minor_ = version == 10 ? 0 : 1;
+    keep_alive_ = keep_alive;
+    variable_ = false;
+    allow_ = 0;
+    tail_ = {};
+    prefix_ = {};
+    body_.clear();
+    suffix_ = {};
+}
+
+HttpReply::Buffers HttpReply::serialize() {
+    LineWriter out{lines_, lines_ + sizeof(lines_)};
+    out.put(date_line());
+    // What Beast's keep_alive() would have set
+    if (minor_ == 1 && !keep_alive_) {
+        out.put("Connection: close\r\n");
+    } else if (minor_ == 0 && keep_alive_) {
+        out.put("Connection: keep-alive\r\n");
+    }
+    if (allow_) {
+        out.put("Allow: ");
+        const char* separator = "";
+        for (unsigned i = 0; i < 64; ++i) {
+            if (allow_ & (std::uint64_t{1} << i)) {
+                auto name = http::to_string(static_cast<http::verb>(i));
+                out.put(separator);
+                out.put(std::string_view(name.data(), name.size()));
+                separator = ", ";
+            }
+        }
+        out.put("\r\n");
+    }
+    if (variable_) {
+        char digits[24];
+        auto length = std::to_chars(digits, digits + sizeof(digits), prefix_.size() + body_.size() + suffix_.size());
+        out.put("Content-Length: ");
+        out.put(std::string_view(digits, static_cast<std::size_t>(length.ptr - digits)));
+        out.put("\r\n\r\n");
+    }
+    const std::string& head = head_->lines_[minor_];
+    return {
+        boost::asio::const_buffer(head.data(), head.size()),
+        boost::asio::const_buffer(lines_, static_cast<std::size_t>(out.p - lines_)),
+        variable_ ? boost::asio::const_buffer(prefix_.data(), prefix_.size())
+                  : boost::asio::const_buffer(tail_.data(), tail_.size()),
+        boost::asio::const_buffer(body_.data(), body_.size()),
+        boost::asio::const_buffer(suffix_.data(), suffix_.size()),
+    };
+}
@@ -0,0 +1,716 @@
+#include "http_session.hpp"
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "credentials_body.hpp"
+#include "crypto.hpp"
+#include "email_limits.hpp"
+#include "http_reply.hpp"
+#include "jwt.hpp"
+#include "metrics.hpp"
+#include "password_hash.hpp"
+#include "request_arena.hpp"
+#include "router.hpp"
+#include "user_import.hpp"
+#include <nlohmann/json.hpp>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using json = nlohmann::json;
+
+namespace {
+
+// Every fixed response, serialized once and shared by all connections
+namespace replies {
+    const ReplyHead json_ok(http::status::ok, "application/json");
+    const ReplyHead json_bad_request(http::status::bad_request, "application/json");
+    const ReplyHead metrics_ok(http::status::ok, "text/plain; version=0.0.4");
+
+    const CannedReply not_found(http::status::not_found, "{\"error\": \"Not Found\"}");
+    const CannedReply method_not_allowed(http::status::method_not_allowed, "{\"error\": \"Method Not Allowed\"}");
+    const CannedReply body_too_large(http::status::payload_too_large, "{\"error\": \"Request body too large\"}");
+    const CannedReply invalid_body(http::status::bad_request, "{\"error\": \"Invalid JSON or missing fields\"}");
+    const CannedReply user_exists(http::status::bad_request, "{\"error\": \"User already exists\"}");
+    const CannedReply invalid_email(http::status::bad_request, "{\"error\": \"Email must be 1 to 254 bytes\"}");
+    const CannedReply invalid_credentials(http::status::unauthorized, "{\"error\": \"Invalid credentials\"}");
+    const CannedReply missing_authorization(http::status::unauthorized, "{\"error\": \"Missing Authorization header\"}");
+    const CannedReply malformed_authorization(http::status::unauthorized, "{\"error\": \"Malformed Authorization header\"}");
+    const CannedReply invalid_token(http::status::unauthorized, "{\"error\": \"Invalid or expired token\"}");
+    const CannedReply deleted(http::status::ok, "{\"success\": true}");
+    const CannedReply user_not_found(http::status::bad_request, "{\"success\": false, \"error\": \"User not found\"}");
+    const CannedReply unauthorized(http::status::unauthorized, "{\"error\": \"Unauthorized\"}");
+    const CannedReply snapshot_started(http::status::accepted, "{\"started\": true}");
+    const CannedReply snapshot_running(http::status::conflict, "{\"started\": false, \"error\": \"Snapshot already in progress\"}");
+    const CannedReply import_running(http::status::conflict, "{\"error\": \"Import already in progress\"}");
+    const CannedReply busy(http::status::service_unavailable, "{\"error\": \"Server busy\"}");
+    const CannedReply internal_error(http::status::internal_server_error, "{\"error\": \"Internal error\"}");
+}
+
+struct PipelineMetrics {
+    metrics::Counter& writes = metrics::counter(
+        "auth_http_pipelined_writes_total", "Writes carrying the replies to several pipelined requests");
+    metrics::Counter& replies = metrics::counter(
+        "auth_http_pipelined_replies_total", "Replies sent in writes with others to pipelined requests");
+};
+
+PipelineMetrics& pipeline_metrics() {
+    static PipelineMetrics m;
+    return m;
+}
+
+class HttpSession : public std::enable_shared_from_this<HttpSession> {
+    // Beast's default request body limit, kept for everything but imports
+    static constexpr std::uint64_t kBodyLimit = 1024 * 1024;
+
+    using Request = http::request<http::string_body, http::basic_fields<RequestArenaAllocator<char>>>;
+
+    tcp::socket socket_;
+    beast::flat_buffer buffer_;
+    std::shared_ptr<const Services> services_;
+    UserStore* user_store_;
+    // Fields and targets of the request being handled, rewound before
+    // the next is parsed
+    RequestArena arena_;
+    std::optional<http::request_parser<http::string_body, RequestArenaAllocator<char>>> parser_;
+    Request request_;
+    // /register and /login bodies are read into these, which keep their
+    // capacity from one request to the next
+    std::string email_;
+    std::string password_;
+    std::string scratch_;
+    HttpReply reply_;
+    // Replies to pipelined requests, waiting to be written with reply_
+    std::vector<HttpReply> queued_;
+    std::vector<net::const_buffer> write_buffers_;
+
+public:
+    HttpSession(tcp::socket socket, std::shared_ptr<const Services> services)
+        : socket_(std::move(socket))
+        , services_(std::move(services))
+        , user_store_(services_->user_store.get())
+        , request_(std::piecewise_construct, std::make_tuple(), std::make_tuple(RequestArenaAllocator<char>(arena_)))
+    {
+    }
+
+    void run() {
+        // Replies are coalesced here already; Nagle would only hold back
+        // the last write of a pipelined batch behind the client's ACK
+        beast::error_code ec;
+        socket_.set_option(tcp::no_delay(true), ec);
+        do_read();
+    }
+
+private:
+    // Bytes past the last request stay in buffer_: they are the start of
+    // the next, pipelined one
+    void do_read() {
+        // The last request is done with. Drop its fields before rewinding
+        // the arena they live in, and parse the next body into its
+        // buffer (unless that is an import's)
+        parser_.reset();
+        std::string body = std::move(request_.body());
+        body.clear();
+        if (body.capacity() > kBodyLimit) {
+            body.shrink_to_fit();
+        }
+        request_ = Request(std::piecewise_construct, std::make_tuple(),
+                           std::make_tuple(RequestArenaAllocator<char>(arena_)));
+        arena_.reset();
+        parser_.emplace(std::piecewise_construct, std::make_tuple(std::move(body)),
+                        std::make_tuple(RequestArenaAllocator<char>(arena_)));
+
+        // Beast checks Content-Length against the limit while parsing the
+        // header, so admit import-sized bodies here and narrow the limit
+        // again in read_body for everything but an authorized import
+        if (!services_->admin_token.empty()) {
+            parser_->body_limit(std::max(services_->import_max_bytes, kBodyLimit));
+        }
+
+        auto self = shared_from_this();
+        http::async_read_header(
+            socket_,
+            buffer_,
+            *parser_,
+            [self](beast::error_code ec, std::size_t) {
+                if (ec) {
+                    return self->read_failed(ec);
+                }
+                self->read_body();
+            });
+    }
+
+    void read_body() {
+        const auto& header = parser_->get();
+        if (!services_->admin_token.empty() &&
+            !(header.target() == "/admin/import" && header.method() == http::verb::post && is_admin(header))) {
+            auto length = parser_->content_length();
+            if (length && *length > kBodyLimit) {
+                // The body stays unread, so the connection cannot be reused
+                reply_.set(replies::body_too_large, header);
+                reply_.close();
+                return do_write();
+            }
+            parser_->body_limit(kBodyLimit);
+        }
+
+        auto self = shared_from_this();
+        http::async_read(
+            socket_,
+            buffer_,
+            *parser_,
+            [self](beast::error_code ec, std::size_t) {
+                if (ec) {
+                    return self->read_failed(ec);
+                }
+                self->request_ = self->parser_->release();
+                self->handle_request();
+            });
+    }
+
+    using Handler = void (HttpSession::*)();
+
+    void handle_request() {
+        static constexpr router::Route<Handler> kRoutes[] = {
+            {"/register", http::verb::post, &HttpSession::handle_register},
+            {"/login", http::verb::post, &HttpSession::handle_login},
+            {"/delete", http::verb::delete_, &HttpSession::handle_delete},
+            {"/metrics", http::verb::get, &HttpSession::handle_metrics},
+            {"/admin/snapshot", http::verb::post, &HttpSession::handle_snapshot},
+            {"/admin/import", http::verb::post, &HttpSession::handle_import},
+        };
+        static constexpr router::Table<Handler, std::size(kRoutes)> kTable(kRoutes);
+
+        std::string_view target(request_.target().data(), request_.target().size());
+        router::Match<Handler> match = kTable.find(target, request_.method());
+        if (services_->admin_token.empty() && target.substr(0, 7) == "/admin/") {
+            // The admin endpoints do not exist unless a token is configured
+            match = {};
+        }
+        if (match.handler) {
+            return (this->*match.handler)();
+        }
+        if (match.allowed) {
+            reply_.set(replies::method_not_allowed, request_);
+            reply_.allow(match.allowed);
+        } else {
+            reply_.set(replies::not_found, request_);
+        }
+        do_write();
+    }
+
+    // Writes the reply, once durable_lsn (if not 0) is durable
+    void respond(std::uint64_t durable_lsn) {
+        if (durable_lsn != 0) {
+            return write_when_durable(durable_lsn);
+        }
+        do_write();
+    }
+
+    // Reads the email and password of a /register or /login body into
+    // email_ and password_; if they are missing or the body is not JSON,
+    // answers 400 and returns false
+    bool read_credentials() {
+        credentials_body::Fields fields;
+        if (!credentials_body::parse(request_.body(), fields, scratch_)) {
+            reply_.set(replies::invalid_body, request_);
+            do_write();
+            return false;
+        }
+        email_.assign(fields.email);
+        password_.assign(fields.password);
+        return true;
+    }
+
+    void handle_register() {
+        // Set by writes that must be durable before we acknowledge them
+        std::uint64_t durable_lsn = 0;
+        if (!read_credentials()) {
+            return;
+        }
+        std::string& email = email_;
+        std::string& password = password_;
+        if (minting_would_be_revoked(email)) {
+            return retry_next_second(&HttpSession::handle_register);
+        }
+        try {
+            crypto::Credential existing;
+            if (!email_limits::acceptable(email)) {
+                reply_.set(replies::invalid_email, request_);
+            }
+            else if (user_store_->lookup_credential(email, existing)) {
+                // Taken emails are turned away before any hashing; a racing
+                // registration is still caught by add_user
+                reply_.set(replies::user_exists, request_);
+            }
+            else if (crypto::is_expensive()) {
+                return run_on_compute_pool([this, email = std::move(email), password = std::move(password)] {
+                    std::uint64_t lsn = 0;
+                    if (user_store_->add_user(email, password, &lsn)) {
+                        reply_new_token(email, nullptr);
+                    } else {
+                        reply_.set(replies::user_exists, request_);
+                    }
+                    return lsn;
+                });
+            }
+            else if (user_store_->add_user(email, password, &durable_lsn)) {
+                reply_new_token(email, nullptr);
+            } else {
+                reply_.set(replies::user_exists, request_);
+            }
+        } catch (...) {
+            reply_.set(replies::invalid_body, request_);
+        }
+        respond(durable_lsn);
+    }
+
+    void handle_login() {
+        if (!read_credentials()) {
+            return;
+        }
+        std::string& email = email_;
+        std::string& password = password_;
+        if (minting_would_be_revoked(email)) {
+            return retry_next_second(&HttpSession::handle_login);
+        }
+        try {
+            crypto::Credential stored;
+            if (!user_store_->lookup_credential(email, stored)) {
+                reply_.set(replies::invalid_credentials, request_);
+            }
+            else if (crypto::is_expensive(stored)) {
+                return login_coalesced(std::move(email), std::move(password), stored);
+            }
+            else if (services_->mac_batcher && stored.scheme == crypto::Scheme::HmacSha256) {
+                return login_batched(std::move(email), std::move(password), stored.hash);
+            }
+            else if (crypto::verify_credential(password, stored)) {
+                reply_new_token(email, &stored.hash);
+            } else {
+                reply_.set(replies::invalid_credentials, request_);
+            }
+        } catch (...) {
+            reply_.set(replies::invalid_body, request_);
+        }
+        do_write();
+    }
+
+    void handle_delete() {
+        std::uint64_t durable_lsn = 0;
+        auto auth_it = request_.find("Authorization");
+        if (auth_it == request_.end()) {
+            reply_.set(replies::missing_authorization, request_);
+        }
+        else {
+            std::string_view auth_header(auth_it->value().data(), auth_it->value().size());
+            if (auth_header.substr(0, 7) != "Bearer ") {
+                reply_.set(replies::malformed_authorization, request_);
+            }
+            else {
+                JWT::Claims claims;
+
+                if (!JWT::verify(auth_header.substr(7), claims) ||
+                    services_->revocations->is_revoked(claims.email, claims.iat)) {
+                    reply_.set(replies::invalid_token, request_);
+                }
+                else if (user_store_->delete_user(std::string(claims.email), &durable_lsn)) {
+                    // Logged after the delete, by when every token minted
+                    // for the user has been noted, so replay revokes
+                    // through the same second
+                    std::int64_t through = services_->revocations->revoke(claims.email, JWT::current_second());
+                    user_store_->log_revocation(claims.email, through, &durable_lsn);
+                    if (services_->token_cache) {
+                        services_->token_cache->invalidate(claims.email);
+                    }
+                    if (services_->credential_cache) {
+                        services_->credential_cache->invalidate(claims.email);
+                    }
+                    reply_.set(replies::deleted, request_);
+                }
+                else {
+                    reply_.set(replies::user_not_found, request_);
+                }
+            }
+        }
+        respond(durable_lsn);
+    }
+
+    void handle_metrics() {
+        reply_.set(replies::metrics_ok, request_, metrics::render());
+        do_write();
+    }
+
+    void handle_snapshot() {
+        if (!services_->snapshot_saver) {
+            reply_.set(replies::not_found, request_);
+        }
+        else if (!is_admin(request_)) {
+            reply_.set(replies::unauthorized, request_);
+        }
+        else if (services_->snapshot_saver->start()) {
+            reply_.set(replies::snapshot_started, request_);
+        }
+        else {
+            reply_.set(replies::snapshot_running, request_);
+        }
+        do_write();
+    }
+
+    void handle_import() {
+        if (!is_admin(request_)) {
+            reply_.set(replies::unauthorized, request_);
+        }
+        else {
+            return run_import();
+        }
+        do_write();
+    }
+
+    // An import can take seconds to minutes, so it runs on the import
+    // runner's thread and the response is written once the imported users
+    // are durable. Only one runs at a time; others get 409.
+    void run_import() {
+        auto self = shared_from_this();
+        bool started = services_->import_runner->start(
+            request_.body(), [self](const user_import::Stats* stats, const std::string& error) {
+                self->request_.body().clear();
+                if (!stats) {
+                    json body = {{"error", error}};
+                    self->reply_.set(replies::json_bad_request, self->request_, body.dump());
+                    net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+                    return;
+                }
+                json result = {
+                    {"imported", stats->imported},
+                    {"duplicates", stats->duplicates},
+                    {"invalid", stats->invalid},
+                    {"seconds", stats->seconds},
+                    {"users_per_second", stats->users_per_second()},
+                };
+                self->reply_.set(replies::json_ok, self->request_, result.dump());
+                self->write_when_durable(stats->lsn);
+            });
+        if (!started) {
+            reply_.set(replies::import_running, request_);
+            do_write();
+        }
+    }
+
+    // Tokens are dated the current second, never later, and the date is
+    // noted before the token goes out so a delete revokes at or past it
+    std::int64_t token_iat() const {
+        std::int64_t iat = JWT::current_second();
+        services_->revocations->note_issued(iat);
+        return iat;
+    }
+
+    // A token minted now would be revoked already if its email was
+    // revoked this second (deleted, then registered again)
+    bool minting_would_be_revoked(const std::string& email) const {
+        return services_->revocations->is_revoked(email, JWT::current_second());
+    }
+
+    // Runs handler again once JWT::current_second has moved on. That
+    // clock is coarse and may trail the system clock by a few ticks.
+    void retry_next_second(Handler handler) {
+        auto next = std::chrono::seconds(JWT::current_second() + 1) + std::chrono::milliseconds(10);
+        auto wait = next - std::chrono::system_clock::now().time_since_epoch();
+        auto timer = std::make_shared<net::steady_timer>(socket_.get_executor());
+        timer->expires_after(std::max<std::chrono::nanoseconds>(wait, std::chrono::milliseconds(1)));
+        auto self = shared_from_this();
+        timer->async_wait([self, timer, handler](beast::error_code) {
+            (self.get()->*handler)();
+        });
+    }
+
+    // Checked once a token is minted: whether the account whose password
+    // hash is verified (any account for email if null) is still there. A
+    // delete that comes after this revokes the token instead.
+    bool still_registered(const std::string& email, const crypto::Digest* verified) const {
+        crypto::Credential current;
+        return user_store_->lookup_credential(email, current) &&
+               (!verified || crypto::digest_equal(current.hash, *verified));
+    }
+
+    // Replies with a new token for email, or 401 if its account was
+    // deleted while the password was being checked
+    void reply_new_token(const std::string& email, const crypto::Digest* verified) {
+        std::int64_t iat = token_iat();
+        std::string token = services_->token_cache ? services_->token_cache->mint(email, iat)
+                                                   : JWT::create_at(email, iat);
+        if (still_registered(email, verified)) {
+            reply_token(std::move(token));
+        } else {
+            reply_.set(replies::invalid_credentials, request_);
+        }
+    }
+
+    void reply_token(std::string token) {
+        reply_.set(replies::json_ok, request_, std::move(token), "{\"token\": \"", "\"}");
+    }
+
+    // Runs job (which fills in reply_ and returns the LSN to wait for,
+    // or 0) on the compute pool and writes the response from there. A full
+    // queue is answered with 503 right away rather than queued behind.
+    void run_on_compute_pool(std::function<std::uint64_t()> job) {
+        auto self = shared_from_this();
+        bool queued = services_->compute_pool->submit([self, job = std::move(job)] {
+            std::uint64_t lsn = 0;
+            try {
+                lsn = job();
+            } catch (const std::exception& e) {
+                std::cerr << "Password hashing failed: " << e.what() << std::endl;
+                self->reply_.set(replies::internal_error, self->request_);
+            }
+            if (lsn != 0) {
+                return self->write_when_durable(lsn);
+            }
+            net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+        });
+        if (!queued) {
+            reply_.set(replies::busy, request_);
+            do_write();
+        }
+    }
+
+    // /login for a KDF credential: a login verified within the credential
+    // cache's TTL is accepted as is; otherwise identical logins in flight
+    // share one check on the compute pool, and each then answers its own
+    // request
+    void login_coalesced(std::string email, std::string password, const crypto::Credential& stored) {
+        using Outcome = LoginCoalescer::Outcome;
+        LoginCoalescer::Key key = (*services_->login_fingerprint)(email, stored, password);
+        if (services_->credential_cache && services_->credential_cache->contains(email, key)) {
+            reply_new_token(email, &stored.hash);
+            return do_write();
+        }
+
+        LoginCoalescer& coalescer = *services_->login_coalescer;
+        auto self = shared_from_this();
+        bool leader = coalescer.join(key, [self, email, verified = stored.hash](Outcome outcome) {
+            if (outcome == Outcome::Valid) {
+                self->reply_new_token(email, &verified);
+            } else if (outcome == Outcome::Invalid) {
+                self->reply_.set(replies::invalid_credentials, self->request_);
+            } else if (outcome == Outcome::Busy) {
+                self->reply_.set(replies::busy, self->request_);
+            } else {
+                self->reply_.set(replies::internal_error, self->request_);
+            }
+            net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+        });
+        if (!leader) {
+            return;
+        }
+
+        auto services = services_;
+        bool queued = services_->compute_pool->submit([services, key, stored, email = std::move(email),
+                                                       password = std::move(password)] {
+            Outcome outcome = Outcome::Failed;
+            try {
+                outcome = crypto::verify_credential(password, stored) ? Outcome::Valid : Outcome::Invalid;
+            } catch (const std::exception& e) {
+                std::cerr << "Password hashing failed: " << e.what() << std::endl;
+            }
+            if (outcome == Outcome::Valid && services->credential_cache) {
+                services->credential_cache->insert(email, key);
+            }
+            services->login_coalescer->complete(key, outcome);
+        });
+        if (!queued) {
+            coalescer.complete(key, Outcome::Busy);
+        }
+    }
+
+    // /login with both MACs (password check, then token signature) run by
+    // the batcher; its thread fills in the response and posts the write
+    void login_batched(std::string email, std::string password, const crypto::Digest& stored) {
+        auto self = shared_from_this();
+        services_->mac_batcher->submit(
+            crypto::password_key(), std::move(password),
+            [self, stored, email = std::move(email)](std::string&, const crypto::Digest& computed) {
+                if (!crypto::digest_equal(computed, stored)) {
+                    self->reply_.set(replies::invalid_credentials, self->request_);
+                    net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+                    return;
+                }
+                std::int64_t iat = self->token_iat();
+                std::string token;
+                TokenCache* cache = self->services_->token_cache.get();
+                if (cache && cache->find(email, iat, token)) {
+                    if (self->still_registered(email, &stored)) {
+                        self->reply_token(std::move(token));
+                    } else {
+                        self->reply_.set(replies::invalid_credentials, self->request_);
+                    }
+                    net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+                    return;
+                }
+                self->services_->mac_batcher->submit(
+                    JWT::signing_key(), JWT::create_unsigned(email, iat),
+                    [self, cache, iat, email, stored](std::string& token, const crypto::Digest& signature) {
+                        JWT::append_signature(token, signature.data());
+                        if (cache) {
+                            cache->put(email, iat, token);
+                        }
+                        if (self->still_registered(email, &stored)) {
+                            self->reply_token(std::move(token));
+                        } else {
+                            self->reply_.set(replies::invalid_credentials, self->request_);
+                        }
+                        net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+                    });
+            });
+    }
+
+    template<class Fields>
+    bool is_admin(const http::request_header<Fields>& header) const {
+        auto auth_it = header.find(http::field::authorization);
+        if (auth_it == header.end()) {
+            return false;
+        }
+        std::string_view auth_header(auth_it->value().data(), auth_it->value().size());
+        if (auth_header.substr(0, 7) != "Bearer ") {
+            return false;
+        }
+        return crypto::secret_equal(auth_header.substr(7), services_->admin_token);
+    }
+
+    // The log may complete on its flusher thread, so hop back onto the
+    // socket's executor before writing
+    void write_when_durable(std::uint64_t lsn) {
+        auto self = shared_from_this();
+        user_store_->when_durable(lsn, [self] {
+            net::post(self->socket_.get_executor(), [self] { self->do_write(); });
+        });
+    }
+
+    // Called once reply_ is filled in. While the client has pipelined
+    // another whole request, the reply is queued and that request handled
+    // first; then everything queued goes out in one gathered write.
+    // Requests are still handled one at a time, so replies stay in order.
+    void do_write() {
+        if (reply_.keep_alive() && queued_.size() + 1 < services_->pipeline_depth && request_ready()) {
+            queued_.push_back(std::move(reply_));
+            return do_read();
+        }
+        auto self = shared_from_this();
+        auto written = [self](beast::error_code ec, std::size_t) {
+            if (ec) {
+                return;
+            }
+            self->queued_.clear();
+            if (!self->reply_.keep_alive()) {
+                return self->do_close();
+            }
+            self->do_read();
+        };
+        if (queued_.empty()) {
+            return net::async_write(socket_, reply_.serialize(), std::move(written));
+        }
+        write_buffers_.clear();
+        for (HttpReply& reply : queued_) {
+            HttpReply::Buffers pieces = reply.serialize();
+            write_buffers_.insert(write_buffers_.end(), pieces.begin(), pieces.end());
+        }
+        HttpReply::Buffers pieces = reply_.serialize();
+        write_buffers_.insert(write_buffers_.end(), pieces.begin(), pieces.end());
+        PipelineMetrics& m = pipeline_metrics();
+        m.writes.add();
+        m.replies.add(queued_.size() + 1);
+        net::async_write(socket_, write_buffers_, std::move(written));
+    }
+
+    // Whether a whole request has arrived. Once part of one is buffered,
+    // what the socket has received since is taken in too; a client that
+    // is not pipelining leaves buffer_ empty and costs no system call.
+    bool request_ready() {
+        if (buffer_.size() == 0) {
+            return false;
+        }
+        if (request_buffered()) {
+            return true;
+        }
+        beast::error_code ec;
+        std::size_t available = socket_.available(ec);
+        if (ec || available == 0) {
+            return false;
+        }
+        std::size_t n = socket_.read_some(buffer_.prepare(available), ec);
+        buffer_.commit(ec ? 0 : n);
+        return request_buffered();
+    }
+
+    // Whether buffer_ holds all of a request: its header and as much body
+    // as Content-Length gives. A chunked body counts as incomplete, so the
+    // replies queued so far are written rather than held for it.
+    bool request_buffered() const {
+        std::string_view data(static_cast<const char*>(buffer_.data().data()), buffer_.size());
+        std::size_t header_end = data.find("\r\n\r\n");
+        if (header_end == std::string_view::npos) {
+            return false;
+        }
+        std::uint64_t length = 0;
+        std::size_t line = data.find("\r\n") + 2;
+        while (line < header_end + 2) {
+            std::size_t next = data.find("\r\n", line);
+            std::string_view field = data.substr(line, next - line);
+            line = next + 2;
+            if (beast::iequals(beast::string_view(field.data(), std::min<std::size_t>(field.size(), 18)),
+                               "transfer-encoding:")) {
+                return false;
+            }
+            if (!beast::iequals(beast::string_view(field.data(), std::min<std::size_t>(field.size(), 15)),
+                                "content-length:")) {
+                continue;
+            }
+            std::size_t digits = field.find_first_not_of(" \t", 15);
+            if (digits == std::string_view::npos ||
+                std::from_chars(field.data() + digits, field.data() + field.size(), length).ec != std::errc()) {
+                return false;
+            }
+        }
+        return data.size() - (header_end + 4) >= length;
+    }
+
+    // Reading stopped: answer the requests already handled, then close
+    void read_failed(beast::error_code ec) {
+        if (!queued_.empty()) {
+            reply_ = std::move(queued_.back());
+            queued_.pop_back();
+            reply_.close();
+            return do_write();
+        }
+        if (ec == http::error::end_of_stream) {
+            do_close();
+        }
+    }
+
+    void do_close() {
+        beast::error_code ec;
+        socket_.shutdown(tcp::socket::shutdown_send, ec);
+    }
+};
+
+
+}
+
+void register_http_metrics() {
+    pipeline_metrics();
+}
+
+void serve_http(tcp::socket socket, std::shared_ptr<const Services> services) {
+    std::make_shared<HttpSession>(std::move(socket), std::move(services))->run();
+}
@@ -0,0 +1,76 @@
+#include "import_runner.hpp"
+#include "metrics.hpp"
+#include <exception>
+#include <iostream>
+
+namespace {
+    struct RunnerMetrics {
+        metrics::Gauge& in_progress = metrics::gauge(
+            "auth_import_in_progress", "1 while an import started through the admin endpoint runs");
+        metrics::Counter& succeeded = metrics::counter(
+            "auth_imports_total{result=\"ok\"}", "Imports requested through the admin endpoint, by outcome");
+        metrics::Counter& failed = metrics::counter(
+            "auth_imports_total{result=\"error\"}", "Imports requested through the admin endpoint, by outcome");
+        metrics::Counter& rejected = metrics::counter(
+            "auth_imports_total{result=\"busy\"}", "Imports requested through the admin endpoint, by outcome");
+    };
+
+    RunnerMetrics& runner_metrics() {
+        static RunnerMetrics m;
+        return m;
+    }
+}
+
+ImportRunner::ImportRunner(std::shared_ptr<UserStore> store)
+    : store_(std::move(store))
+{
+    runner_metrics();
+}
+
+ImportRunner::~ImportRunner() {
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool ImportRunner::start(std::string_view data, Done done) {
+    RunnerMetrics& m = runner_metrics();
+    bool expected = false;
+    if (!running_.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+        m.rejected.add();
+        return false;
+    }
+    m.in_progress.set(1);
+
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    // The previous import has cleared running_, so its thread is at most
+    // finishing its callback
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    thread_ = std::thread([this, data, done = std::move(done)] {
+        user_import::Stats stats;
+        std::string error;
+        try {
+            stats = user_import::run(*store_, data);
+        } catch (const std::exception& e) {
+            error = e.what();
+        } catch (...) {
+            error = "import failed";
+        }
+        RunnerMetrics& m = runner_metrics();
+        if (error.empty()) {
+            m.succeeded.add();
+        } else {
+            std::cerr << "Import failed: " << error << std::endl;
+            m.failed.add();
+        }
+        m.in_progress.set(0);
+        // Free for the next import before answering this one, so a client
+        // that starts another on seeing the response is not refused
+        running_.store(false, std::memory_order_release);
+        done(error.empty() ? &stats : nullptr, error);
+    });
+    return true;
+}
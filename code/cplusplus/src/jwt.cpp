@@ -1,161 +1,481 @@
 #include "jwt.hpp"
-#include <openssl/hmac.h>
-#include <openssl/evp.h>
-#include <nlohmann/json.hpp>
+#include "base64url.hpp"
+#include "hmac.hpp"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
-#include <vector>
+#include <cstring>
+#include <ctime>
+#include <limits>
 
-using json = nlohmann::json;
+namespace {
+    constexpr std::size_t kSignatureSize = 32;
 
-std::string JWT::base64_encode(const std::string& input) {
-    static const std::string base64_chars = 
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
-    
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-    size_t in_len = input.length();
-    const unsigned char* bytes_to_encode = reinterpret_cast<const unsigned char*>(input.c_str());
-    
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-            
-            for(i = 0; i < 4; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
+    // base64url of {"alg":"HS256","typ":"JWT"}, the only header we issue
+    constexpr std::string_view kHeaderSegment = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9";
+
+    // Claims are written in the order nlohmann::json used to emit them:
+    // {"email":"...","exp":N,"iat":N}
+    constexpr std::string_view kEmailClaimPrefix = "{\"email\":\"";
+    constexpr std::size_t kMaxTimeClaimsSize = 64;
+
+    char* append(char* out, std::string_view s) {
+        std::memcpy(out, s.data(), s.size());
+        return out + s.size();
+    }
+
+    // Whole seconds are all a token carries, so the coarse clock (a few
+    // ms resolution, no syscall) is precise enough
+    std::int64_t now_seconds() {
+#ifdef CLOCK_REALTIME_COARSE
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return ts.tv_sec;
+#else
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // `","exp":N,"iat":N}` for the given second. Every token minted within
+    // the same second shares it, so each thread formats it once.
+    std::string_view time_claims(std::int64_t now) {
+        struct Cache {
+            std::int64_t second = -1;
+            char text[kMaxTimeClaimsSize];
+            std::size_t size = 0;
+        };
+        thread_local Cache cache;
+        if (cache.second != now) {
+            char* end = cache.text + sizeof(cache.text);
+            char* p = append(cache.text, "\",\"exp\":");
+            p = std::to_chars(p, end, now + JWT::kTokenLifetime).ptr;
+            p = append(p, ",\"iat\":");
+            p = std::to_chars(p, end, now).ptr;
+            *p++ = '}';
+            cache.size = static_cast<std::size_t>(p - cache.text);
+            cache.second = now;
         }
+        return std::string_view(cache.text, cache.size);
     }
-    
-    if (i) {
-        for(j = i; j < 3; j++)
-            char_array_3[j] = '\0';
-        
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        
-        for (j = 0; j < i + 1; j++)
-            ret += base64_chars[char_array_4[j]];
+
+    // JSON string escaping as nlohmann::json::dump does it
+    std::size_t escaped_size(std::string_view s) {
+        std::size_t size = s.size();
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t') {
+                size += 1;
+            } else if (c < 0x20) {
+                size += 5;
+            }
+        }
+        return size;
     }
-    
-    return ret;
-}
 
-std::string JWT::base64_decode(const std::string& encoded_string) {
-    static const std::string base64_chars = 
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
-    
-    std::string ret;
-    std::vector<int> char_map(256, -1);
-    for (size_t i = 0; i < base64_chars.length(); i++)
-        char_map[base64_chars[i]] = i;
-    
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    
-    for (char c : encoded_string) {
-        if (char_map[c] == -1) break;
-        char_array_4[i++] = c;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = char_map[char_array_4[i]];
-            
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-            
-            for (i = 0; i < 3; i++)
-                ret += char_array_3[i];
-            i = 0;
+    char* write_escaped(char* out, std::string_view s) {
+        static constexpr char kHex[] = "0123456789abcdef";
+        for (unsigned char c : s) {
+            switch (c) {
+                case '"': *out++ = '\\'; *out++ = '"'; break;
+                case '\\': *out++ = '\\'; *out++ = '\\'; break;
+                case '\b': *out++ = '\\'; *out++ = 'b'; break;
+                case '\f': *out++ = '\\'; *out++ = 'f'; break;
+                case '\n': *out++ = '\\'; *out++ = 'n'; break;
+                case '\r': *out++ = '\\'; *out++ = 'r'; break;
+                case '\t': *out++ = '\\'; *out++ = 't'; break;
+                default:
+                    if (c < 0x20) {
+                        out = append(out, "\\u00");
+                        *out++ = kHex[c >> 4];
+                        *out++ = kHex[c & 0x0f];
+                    } else {
+                        *out++ = static_cast<char>(c);
+                    }
+            }
         }
+        return out;
     }
-    
-    if (i) {
-        for (j = 0; j < i; j++)
-            char_array_4[j] = char_map[char_array_4[j]];
-        
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        
-        for (j = 0; j < i - 1; j++)
-            ret += char_array_3[j];
+
+    // base64url-encodes a payload handed over in pieces. Whole 3-byte
+    // groups are encoded whenever the stack buffer fills, so a payload of
+    // any length goes straight to out without a contiguous copy.
+    class PayloadEncoder {
+    public:
+        explicit PayloadEncoder(char* out) : out_(out) {}
+
+        void put(std::string_view s) {
+            while (!s.empty()) {
+                std::size_t n = std::min(s.size(), sizeof(buffer_) - size_);
+                std::memcpy(buffer_ + size_, s.data(), n);
+                size_ += n;
+                s.remove_prefix(n);
+                if (size_ == sizeof(buffer_)) {
+                    flush();
+                }
+            }
+        }
+
+        // JSON-escaped, at most 6 bytes per character
+        void put_escaped(std::string_view s) {
+            while (!s.empty()) {
+                std::size_t n = std::min(s.size(), (sizeof(buffer_) - size_) / 6);
+                if (n == 0) {
+                    flush();
+                    continue;
+                }
+                size_ = static_cast<std::size_t>(write_escaped(buffer_ + size_, s.substr(0, n)) - buffer_);
+                s.remove_prefix(n);
+            }
+        }
+
+        // Encodes the rest and returns the end of the output
+        char* finish() {
+            base64url::encode(buffer_, size_, out_);
+            return out_ + base64url::encoded_size(size_);
+        }
+
+    private:
+        void flush() {
+            std::size_t whole = size_ - size_ % 3;
+            base64url::encode(buffer_, whole, out_);
+            out_ += whole / 3 * 4;
+            std::memmove(buffer_, buffer_ + whole, size_ - whole);
+            size_ -= whole;
+        }
+
+        char buffer_[768];
+        std::size_t size_ = 0;
+        char* out_;
+    };
+
+    // Appends code point cp as UTF-8 at out; never longer than the \u
+    // escape it replaces
+    std::size_t put_utf8(char* out, std::uint32_t cp) {
+        if (cp < 0x80) {
+            out[0] = static_cast<char>(cp);
+            return 1;
+        }
+        if (cp < 0x800) {
+            out[0] = static_cast<char>(0xc0 | cp >> 6);
+            out[1] = static_cast<char>(0x80 | (cp & 0x3f));
+            return 2;
+        }
+        if (cp < 0x10000) {
+            out[0] = static_cast<char>(0xe0 | cp >> 12);
+            out[1] = static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+            out[2] = static_cast<char>(0x80 | (cp & 0x3f));
+            return 3;
+        }
+        out[0] = static_cast<char>(0xf0 | cp >> 18);
+        out[1] = static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+        out[2] = static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+        out[3] = static_cast<char>(0x80 | (cp & 0x3f));
+        return 4;
+    }
+
+    // Reads the claims we issue out of a flat JSON object without building a
+    // DOM. String values are unescaped in place, since unescaping never
+    // makes them longer.
+    class ClaimScanner {
+    public:
+        ClaimScanner(char* data, std::size_t size) : p_(data), end_(data + size) {}
+
+        bool scan(JWT::Claims& claims) {
+            bool has_email = false;
+            bool has_exp = false;
+            skip_ws();
+            if (!consume('{')) {
+                return false;
+            }
+            skip_ws();
+            if (consume('}')) {
+                return false;
+            }
+            for (;;) {
+                std::string_view key;
+                skip_ws();
+                if (!read_string(key)) {
+                    return false;
+                }
+                skip_ws();
+                if (!consume(':')) {
+                    return false;
+                }
+                skip_ws();
+                if (key == "email") {
+                    has_email = read_string(claims.email);
+                    if (!has_email) {
+                        return false;
+                    }
+                } else if (key == "exp") {
+                    has_exp = read_int(claims.exp);
+                    if (!has_exp) {
+                        return false;
+                    }
+                } else if (key == "iat") {
+                    if (!read_int(claims.iat)) {
+                        return false;
+                    }
+                } else if (!skip_value()) {
+                    return false;
+                }
+                skip_ws();
+                if (consume(',')) {
+                    continue;
+                }
+                if (!consume('}')) {
+                    return false;
+                }
+                skip_ws();
+                return p_ == end_ && has_email && has_exp;
+            }
+        }
+
+    private:
+        bool consume(char c) {
+            if (p_ < end_ && *p_ == c) {
+                ++p_;
+                return true;
+            }
+            return false;
+        }
+
+        void skip_ws() {
+            while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+                ++p_;
+            }
+        }
+
+        bool read_hex4(std::uint32_t& v) {
+            if (end_ - p_ < 4) {
+                return false;
+            }
+            v = 0;
+            for (int i = 0; i < 4; ++i) {
+                char c = *p_++;
+                v <<= 4;
+                if (c >= '0' && c <= '9') v |= static_cast<std::uint32_t>(c - '0');
+                else if (c >= 'a' && c <= 'f') v |= static_cast<std::uint32_t>(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F') v |= static_cast<std::uint32_t>(c - 'A' + 10);
+                else return false;
+            }
+            return true;
+        }
+
+        bool read_string(std::string_view& out) {
+            if (!consume('"')) {
+                return false;
+            }
+            char* start = p_;
+            char* w = p_;
+            while (p_ < end_) {
+                char c = *p_++;
+                if (c == '"') {
+                    out = std::string_view(start, static_cast<std::size_t>(w - start));
+                    return true;
+                }
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    return false;
+                }
+                if (c != '\\') {
+                    *w++ = c;
+                    continue;
+                }
+                if (p_ == end_) {
+                    return false;
+                }
+                switch (*p_++) {
+                    case '"': *w++ = '"'; break;
+                    case '\\': *w++ = '\\'; break;
+                    case '/': *w++ = '/'; break;
+                    case 'b': *w++ = '\b'; break;
+                    case 'f': *w++ = '\f'; break;
+                    case 'n': *w++ = '\n'; break;
+                    case 'r': *w++ = '\r'; break;
+                    case 't': *w++ = '\t'; break;
+                    case 'u': {
+                        std::uint32_t cp;
+                        if (!read_hex4(cp)) {
+                            return false;
+                        }
+                        if (cp >= 0xd800 && cp < 0xdc00) {
+                            std::uint32_t low;
+                            if (!consume('\\') || !consume('u') || !read_hex4(low) ||
+                                low < 0xdc00 || low >= 0xe000) {
+                                return false;
+                            }
+                            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        } else if (cp >= 0xdc00 && cp < 0xe000) {
+                            return false;
+                        }
+                        w += put_utf8(w, cp);
+                        break;
+                    }
+                    default:
+                        return false;
+                }
+            }
+            return false;
+        }
+
+        bool read_int(std::int64_t& out) {
+            bool negative = consume('-');
+            if (p_ == end_ || *p_ < '0' || *p_ > '9') {
+                return false;
+            }
+            std::int64_t v = 0;
+            while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+                if (v > (std::numeric_limits<std::int64_t>::max() - 9) / 10) {
+                    return false;
+                }
+                v = v * 10 + (*p_++ - '0');
+            }
+            // Claims we issue are whole seconds
+            if (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E')) {
+                return false;
+            }
+            out = negative ? -v : v;
+            return true;
+        }
+
+        // Unknown claims may be strings, numbers or literals; we never
+        // issue nested values
+        bool skip_value() {
+            std::string_view ignored;
+            if (p_ < end_ && *p_ == '"') {
+                return read_string(ignored);
+            }
+            char* start = p_;
+            while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ' ' && *p_ != '\t' &&
+                   *p_ != '\n' && *p_ != '\r') {
+                if (*p_ == '{' || *p_ == '[' || *p_ == '"') {
+                    return false;
+                }
+                ++p_;
+            }
+            return p_ != start;
+        }
+
+        char* p_;
+        char* end_;
+    };
+
+    bool scan_claims(char* data, std::size_t size, JWT::Claims& claims) {
+        return ClaimScanner(data, size).scan(claims);
     }
-    
-    return ret;
 }
 
-std::string JWT::create_signature(const std::string& header_payload) {
-    unsigned char* digest = HMAC(EVP_sha256(), 
-                                SECRET_KEY, strlen(SECRET_KEY),
-                                reinterpret_cast<const unsigned char*>(header_payload.c_str()),
-                                header_payload.length(), nullptr, nullptr);
-    return std::string(reinterpret_cast<char*>(digest), 32);
+const crypto::HmacSha256& JWT::signing_key() {
+    static const crypto::HmacSha256 token_mac(SECRET_KEY);
+    return token_mac;
 }
 
-std::string JWT::create(const std::string& email) {
-    json header = {
-        {"alg", "HS256"},
-        {"typ", "JWT"}
-    };
-    
-    auto now = std::chrono::system_clock::now();
-    auto exp = now + std::chrono::hours(24);
-    
-    json payload = {
-        {"email", email},
-        {"iat", std::chrono::system_clock::to_time_t(now)},
-        {"exp", std::chrono::system_clock::to_time_t(exp)}
-    };
-    
-    std::string header_encoded = base64_encode(header.dump());
-    std::string payload_encoded = base64_encode(payload.dump());
-    
-    std::string header_payload = header_encoded + "." + payload_encoded;
-    std::string signature = create_signature(header_payload);
-    std::string signature_encoded = base64_encode(signature);
-    
-    return header_payload + "." + signature_encoded;
+void JWT::sign(std::string_view header_payload, unsigned char* out) {
+    signing_key().mac(header_payload.data(), header_payload.size(), out);
+}
+
+std::size_t JWT::max_token_size(std::string_view email) {
+    std::size_t payload = kEmailClaimPrefix.size() + escaped_size(email) + kMaxTimeClaimsSize;
+    return kHeaderSegment.size() + 1 + base64url::encoded_size(payload) + 1 +
+           base64url::encoded_size(kSignatureSize);
+}
+
+std::size_t JWT::create(std::string_view email, char* out) {
+    return write_token(email, time_claims(now_seconds()), out);
+}
+
+std::string JWT::create(std::string_view email) {
+    return create_at(email, now_seconds());
+}
+
+std::string JWT::create_at(std::string_view email, std::int64_t iat) {
+    std::string_view times = time_claims(iat);
+    std::size_t payload = kEmailClaimPrefix.size() + escaped_size(email) + times.size();
+    std::string token(kHeaderSegment.size() + 1 + base64url::encoded_size(payload) + 1 +
+                      base64url::encoded_size(kSignatureSize), '\0');
+    write_token(email, times, token.data());
+    return token;
 }
 
-bool JWT::verify(const std::string& token, std::string& email) {
-    size_t first_dot = token.find('.');
-    size_t last_dot = token.rfind('.');
+std::int64_t JWT::current_second() {
+    return now_seconds();
+}
+
+std::string JWT::create_unsigned(std::string_view email, std::int64_t iat) {
+    std::string_view times = time_claims(iat);
+    std::size_t payload = kEmailClaimPrefix.size() + escaped_size(email) + times.size();
+    std::size_t unsigned_size = kHeaderSegment.size() + 1 + base64url::encoded_size(payload);
+    // Room for the signature, so append_signature does not reallocate
+    std::string token;
+    token.reserve(unsigned_size + 1 + base64url::encoded_size(kSignatureSize));
+    token.resize(unsigned_size);
+    write_unsigned(email, times, token.data());
+    return token;
+}
+
+void JWT::append_signature(std::string& header_payload, const unsigned char* signature) {
+    std::size_t size = header_payload.size();
+    header_payload.resize(size + 1 + base64url::encoded_size(kSignatureSize));
+    header_payload[size] = '.';
+    base64url::encode(signature, kSignatureSize, header_payload.data() + size + 1);
+}
+
+std::size_t JWT::write_token(std::string_view email, std::string_view times, char* out) {
+    char* p = out + write_unsigned(email, times, out);
+
+    unsigned char signature[kSignatureSize];
+    sign(std::string_view(out, static_cast<std::size_t>(p - out)), signature);
+    *p++ = '.';
+    base64url::encode(signature, kSignatureSize, p);
+    p += base64url::encoded_size(kSignatureSize);
+    return static_cast<std::size_t>(p - out);
+}
+
+std::size_t JWT::write_unsigned(std::string_view email, std::string_view times, char* out) {
+    char* p = append(out, kHeaderSegment);
+    *p++ = '.';
+    PayloadEncoder payload(p);
+    payload.put(kEmailClaimPrefix);
+    payload.put_escaped(email);
+    payload.put(times);
+    return static_cast<std::size_t>(payload.finish() - out);
+}
+
+bool JWT::verify(std::string_view token, Claims& claims) {
+    std::size_t first_dot = token.find('.');
+    std::size_t last_dot = token.rfind('.');
     
-    if (first_dot == std::string::npos || last_dot == std::string::npos || first_dot == last_dot) {
+    if (first_dot == std::string_view::npos || first_dot == last_dot) {
         return false;
     }
     
-    std::string header_payload = token.substr(0, last_dot);
-    std::string provided_sig = base64_decode(token.substr(last_dot + 1));
-    std::string computed_sig = create_signature(header_payload);
-    
-    if (provided_sig != computed_sig) {
+    std::string_view header_payload = token.substr(0, last_dot);
+    unsigned char provided_sig[kSignatureSize];
+    if (base64url::decode(token.substr(last_dot + 1), provided_sig, sizeof(provided_sig)) != kSignatureSize) {
+        return false;
+    }
+
+    unsigned char computed_sig[kSignatureSize];
+    sign(header_payload, computed_sig);
+    if (CRYPTO_memcmp(provided_sig, computed_sig, kSignatureSize) != 0) {
         return false;
     }
     
-    std::string payload_encoded = token.substr(first_dot + 1, last_dot - first_dot - 1);
-    std::string payload_str = base64_decode(payload_encoded);
-    
-    try {
-        json payload = json::parse(payload_str);
-        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-        
-        if (payload["exp"].get<time_t>() < now) {
-            return false;
-        }
-        
-        email = payload["email"].get<std::string>();
-        return true;
-    } catch (...) {
+    std::string_view payload_encoded = token.substr(first_dot + 1, last_dot - first_dot - 1);
+    std::ptrdiff_t payload_size = base64url::decode(payload_encoded, claims.buffer, sizeof(claims.buffer));
+    if (payload_size < 0 || !scan_claims(claims.buffer, static_cast<std::size_t>(payload_size), claims)) {
+        return false;
+    }
+
+    return claims.exp >= now_seconds();
+}
+
+bool JWT::verify(std::string_view token, std::string& email) {
+    Claims claims;
+    if (!verify(token, claims)) {
         return false;
     }
+    email.assign(claims.email);
+    return true;
 }
@@ -0,0 +1,61 @@
+#include "login_coalescer.hpp"
+#include "metrics.hpp"
+#include <cstring>
+
+namespace {
+    struct CoalescerMetrics {
+        metrics::Counter& flights = metrics::counter(
+            "auth_login_flights_total", "Password checks run for logins that went through the coalescer");
+        metrics::Counter& coalesced = metrics::counter(
+            "auth_login_coalesced_total", "Logins answered by a check another identical login had in flight");
+        metrics::Gauge& in_flight = metrics::gauge(
+            "auth_login_flights_in_progress", "Password checks in flight for the coalescer");
+    };
+
+    CoalescerMetrics& coalescer_metrics() {
+        static CoalescerMetrics m;
+        return m;
+    }
+}
+
+LoginCoalescer::LoginCoalescer() {
+    coalescer_metrics();
+}
+
+bool LoginCoalescer::join(const Key& key, Callback done) {
+    CoalescerMetrics& m = coalescer_metrics();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, opened] = flights_.try_emplace(key);
+    it->second.push_back(std::move(done));
+    if (opened) {
+        m.flights.add();
+        m.in_flight.set(static_cast<double>(flights_.size()));
+    } else {
+        m.coalesced.add();
+    }
+    return opened;
+}
+
+void LoginCoalescer::complete(const Key& key, Outcome outcome) {
+    std::vector<Callback> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = flights_.find(key);
+        if (it == flights_.end()) {
+            return;
+        }
+        waiters.swap(it->second);
+        flights_.erase(it);
+        coalescer_metrics().in_flight.set(static_cast<double>(flights_.size()));
+    }
+    for (Callback& done : waiters) {
+        done(outcome);
+    }
+}
+
+std::size_t LoginCoalescer::KeyHash::operator()(const Key& key) const {
+    // The key is already a keyed MAC, so any 8 bytes of it are uniform
+    std::size_t h;
+    std::memcpy(&h, key.data(), sizeof(h));
+    return h;
+}
@@ -0,0 +1,50 @@
+#include "login_fingerprint.hpp"
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace {
+    std::string random_key() {
+        std::string key(32, '\0');
+        if (RAND_bytes(reinterpret_cast<unsigned char*>(key.data()), static_cast<int>(key.size())) != 1) {
+            throw std::runtime_error("no randomness for the login fingerprint key");
+        }
+        return key;
+    }
+
+    void put_u32(std::string& out, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<char>(v >> (8 * i)));
+        }
+    }
+}
+
+LoginFingerprint::LoginFingerprint()
+    : mac_([] {
+          std::string key = random_key();
+          crypto::HmacSha256 hmac(key);
+          OPENSSL_cleanse(key.data(), key.size());
+          return hmac;
+      }())
+{
+}
+
+crypto::Digest LoginFingerprint::operator()(std::string_view email, const crypto::Credential& stored,
+                                            std::string_view password) const {
+    // Length-prefixed so no two inputs share an encoding
+    std::string message;
+    message.reserve(8 + email.size() + crypto::kCredentialSize + password.size());
+    put_u32(message, static_cast<std::uint32_t>(email.size()));
+    message.append(email);
+    std::size_t at = message.size();
+    message.resize(at + crypto::kCredentialSize);
+    crypto::encode_credential(stored, reinterpret_cast<unsigned char*>(message.data() + at));
+    put_u32(message, static_cast<std::uint32_t>(password.size()));
+    message.append(password);
+
+    crypto::Digest fingerprint = mac_.mac(message);
+    OPENSSL_cleanse(message.data(), message.size());
+    return fingerprint;
+}
@@ -0,0 +1,120 @@
+#include "mac_batcher.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+
+namespace {
+    struct BatchMetrics {
+        metrics::Counter& batches = metrics::counter(
+            "auth_mac_batches_total", "Batches run by the MAC batcher");
+        metrics::Counter& jobs = metrics::counter(
+            "auth_mac_batch_jobs_total", "MACs computed by the batcher; divide by batches for the mean batch size");
+        metrics::Counter& window_us = metrics::counter(
+            "auth_mac_batch_window_microseconds_total",
+            "Time from each batch's first job to its run, the most any of its jobs waited");
+        metrics::Gauge& last_size = metrics::gauge(
+            "auth_mac_batch_last_size", "Jobs in the most recent batch");
+        metrics::Gauge& last_window = metrics::gauge(
+            "auth_mac_batch_last_window_seconds", "Time the most recent batch's first job waited");
+    };
+
+    BatchMetrics& batch_metrics() {
+        static BatchMetrics m;
+        return m;
+    }
+}
+
+MacBatcher::MacBatcher(Options options)
+    : options_(options)
+{
+    options_.max_batch = std::max<std::size_t>(options_.max_batch, 1);
+    pending_.reserve(options_.max_batch);
+    batch_metrics();
+    worker_ = std::thread([this] { run(); });
+}
+
+MacBatcher::~MacBatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_one();
+    worker_.join();
+}
+
+void MacBatcher::submit(const crypto::HmacSha256& key, std::string message, Callback done) {
+    std::vector<Job> batch;
+    Clock::time_point opened;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(Job{&key, std::move(message), std::move(done)});
+        if (pending_.size() == 1) {
+            // Opens a window. Only its first job is timestamped, and the
+            // worker only needs waking if it is not already timing one.
+            opened_ = Clock::now();
+            if (worker_idle_) {
+                ready_.notify_one();
+            }
+            return;
+        }
+        if (pending_.size() < options_.max_batch) {
+            return;
+        }
+        // A full batch runs right here, which under load spares the
+        // handoff to the worker and back
+        batch.swap(pending_);
+        pending_.reserve(options_.max_batch);
+        opened = opened_;
+    }
+    run_batch(batch, opened);
+}
+
+void MacBatcher::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        worker_idle_ = true;
+        ready_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        worker_idle_ = false;
+        if (pending_.empty()) {
+            return;
+        }
+        // The window may have been taken by a full batch and reopened by
+        // a later job while we slept, so recheck whose deadline applies
+        Clock::time_point deadline = opened_ + options_.max_delay;
+        if (!stopping_ && Clock::now() < deadline) {
+            ready_.wait_until(lock, deadline);
+            continue;
+        }
+        std::vector<Job> batch;
+        batch.swap(pending_);
+        pending_.reserve(options_.max_batch);
+        Clock::time_point opened = opened_;
+        lock.unlock();
+        run_batch(batch, opened);
+        lock.lock();
+    }
+}
+
+void MacBatcher::run_batch(std::vector<Job>& batch, Clock::time_point opened) {
+    // Callbacks may submit again from this thread, and a batch they fill
+    // runs nested in here, so nothing below may be shared between calls
+    std::vector<crypto::MacJob> jobs(batch.size());
+    std::vector<crypto::Digest> macs(batch.size());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        jobs[i] = crypto::MacJob{batch[i].key, batch[i].message.data(), batch[i].message.size(),
+                                 macs[i].data()};
+    }
+
+    auto window = Clock::now() - opened;
+    BatchMetrics& m = batch_metrics();
+    m.batches.add();
+    m.jobs.add(batch.size());
+    m.window_us.add(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(window).count()));
+    m.last_size.set(static_cast<double>(batch.size()));
+    m.last_window.set(std::chrono::duration<double>(window).count());
+
+    crypto::hmac_many(jobs.data(), jobs.size());
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch[i].done(batch[i].message, macs[i]);
+    }
+}
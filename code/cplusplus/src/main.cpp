@@ -1,220 +1,492 @@
 #include <boost/beast/core.hpp>
-#include <boost/beast/http.hpp>
-#include <boost/beast/version.hpp>
 #include <boost/asio.hpp>
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
-#include <ctime>
+#include <filesystem>
 #include <iostream>
+#include <future>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
 #include "user_store.hpp"
+#include "base64url.hpp"
+#include "compute_pool.hpp"
+#include "cpu_topology.hpp"
+#include "credentials_body.hpp"
+#include "credential_cache.hpp"
+#include "crc32c.hpp"
+#include "crypto.hpp"
+#include "hmac.hpp"
+#include "http_session.hpp"
+#include "import_runner.hpp"
 #include "jwt.hpp"
-#include <nlohmann/json.hpp>
+#include "login_coalescer.hpp"
+#include "login_fingerprint.hpp"
+#include "mac_batcher.hpp"
+#include "revocation_list.hpp"
+#include "metrics.hpp"
+#include "password_hash.hpp"
+#include "sha256.hpp"
+#include "snapshot.hpp"
+#include "snapshot_saver.hpp"
+#include "token_cache.hpp"
+#include "user_import.hpp"
+#include "wal.hpp"
 
 namespace beast = boost::beast;
-namespace http = beast::http;
 namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
-using json = nlohmann::json;
-
-// This function produces a JSON response
-template<class Body, class Allocator>
-http::response<http::string_body> 
-make_json_response(
-    const http::request<Body, http::basic_fields<Allocator>>& req,
-    const std::string& json_str,
-    http::status status)
-{
-    http::response<http::string_body> res{status, req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "application/json");
-    res.set(http::field::access_control_allow_origin, "*");
-    res.keep_alive(req.keep_alive());
-    res.body() = json_str;
-    res.prepare_payload();
-    return res;
-}
 
-class HttpSession : public std::enable_shared_from_this<HttpSession> {
-    tcp::socket socket_;
-    beast::flat_buffer buffer_;
-    std::shared_ptr<UserStore> user_store_;
-    http::request<http::string_body> request_;
-    http::response<http::string_body> response_;
+class Listener : public std::enable_shared_from_this<Listener> {
+    net::io_context& ioc_;
+    tcp::acceptor acceptor_;
+    std::shared_ptr<const Services> services_;
+    metrics::Counter* accepted_ = nullptr;
 
 public:
-    HttpSession(tcp::socket socket, std::shared_ptr<UserStore> store)
-        : socket_(std::move(socket))
-        , user_store_(store)
+    Listener(net::io_context& ioc, tcp::endpoint endpoint, std::shared_ptr<const Services> services)
+        : ioc_(ioc)
+        , acceptor_(ioc)
+        , services_(std::move(services))
+    {
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(net::socket_base::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen(net::socket_base::max_listen_connections);
+    }
+
+    // One of several acceptors sharing endpoint, each owned by the thread
+    // pinned to cpu. SO_INCOMING_CPU asks the kernel to prefer this one
+    // for connections whose packets arrive on that CPU.
+    Listener(net::io_context& ioc, tcp::endpoint endpoint, std::shared_ptr<const Services> services, unsigned cpu)
+        : ioc_(ioc)
+        , acceptor_(ioc)
+        , services_(std::move(services))
+        , accepted_(&metrics::counter("auth_io_accepted_connections_total{cpu=\"" + std::to_string(cpu) + "\"}",
+                                      "Connections accepted, by the CPU whose thread serves them"))
     {
+        using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        using incoming_cpu = net::detail::socket_option::integer<SOL_SOCKET, SO_INCOMING_CPU>;
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(net::socket_base::reuse_address(true));
+        acceptor_.set_option(reuse_port(true));
+        beast::error_code ec;
+        acceptor_.set_option(incoming_cpu(static_cast<int>(cpu)), ec); // only a hint
+        acceptor_.bind(endpoint);
+        acceptor_.listen(net::socket_base::max_listen_connections);
     }
 
     void run() {
-        do_read();
+        do_accept();
     }
 
 private:
-    void do_read() {
-        request_ = {};
-        buffer_.consume(buffer_.size());
-
+    void do_accept() {
         auto self = shared_from_this();
-        http::async_read(
-            socket_,
-            buffer_,
-            request_,
-            [self](beast::error_code ec, std::size_t) {
-                if (ec == http::error::end_of_stream) {
-                    return self->do_close();
-                }
-                if (ec) {
-                    return;
+        acceptor_.async_accept(
+            [self](beast::error_code ec, tcp::socket socket) {
+                if (!ec) {
+                    if (self->accepted_) {
+                        self->accepted_->add();
+                    }
+                    serve_http(std::move(socket), self->services_);
                 }
-                self->handle_request();
+                self->do_accept();
             });
     }
+};
 
-    void handle_request() {
-        if (request_.target() == "/register" && request_.method() == http::verb::post) {
-            try {
-                auto data = json::parse(request_.body());
-                std::string email = data["email"];
-                std::string password = data["password"];
-
-                if (user_store_->add_user(email, password)) {
-                    std::string token = JWT::create(email);
-                    response_ = make_json_response(request_, "{\"token\": \"" + token + "\"}", http::status::ok);
-                } else {
-                    response_ = make_json_response(request_, "{\"error\": \"User already exists\"}", http::status::bad_request);
-                }
-            } catch (...) {
-                response_ = make_json_response(request_, "{\"error\": \"Invalid JSON or missing fields\"}", http::status::bad_request);
+// One thread, io_context and acceptor per CPU. The kernel spreads new
+// connections over the SO_REUSEPORT acceptors and each connection stays
+// with the thread that accepted it, so its handlers never migrate between
+// cores or contend on a shared scheduler queue. Everything a thread owns
+// is created after it is pinned, so it lands on that CPU's NUMA node.
+void serve_per_core(const std::vector<cpu_topology::Cpu>& cpus, tcp::endpoint endpoint,
+                    std::shared_ptr<const Services> services) {
+    std::vector<std::thread> threads;
+    std::vector<std::future<void>> listening;
+    threads.reserve(cpus.size());
+    for (const cpu_topology::Cpu& cpu : cpus) {
+        std::promise<void> bound;
+        listening.push_back(bound.get_future());
+        threads.emplace_back([id = cpu.id, endpoint, services, bound = std::move(bound)]() mutable {
+            if (!cpu_topology::pin_current_thread(id)) {
+                std::cerr << "Could not pin the I/O thread for CPU " << id << std::endl;
             }
-        }
-        else if (request_.target() == "/login" && request_.method() == http::verb::post) {
+            net::io_context ioc{1};
             try {
-                auto data = json::parse(request_.body());
-                std::string email = data["email"];
-                std::string password = data["password"];
-
-                if (user_store_->authenticate_user(email, password)) {
-                    std::string token = JWT::create(email);
-                    response_ = make_json_response(request_, "{\"token\": \"" + token + "\"}", http::status::ok);
-                } else {
-                    response_ = make_json_response(request_, "{\"error\": \"Invalid credentials\"}", http::status::unauthorized);
-                }
+                std::make_shared<Listener>(ioc, endpoint, services, id)->run();
             } catch (...) {
-                response_ = make_json_response(request_, "{\"error\": \"Invalid JSON or missing fields\"}", http::status::bad_request);
+                bound.set_exception(std::current_exception());
+                return;
             }
+            bound.set_value();
+            ioc.run();
+        });
+    }
+    try {
+        for (std::future<void>& f : listening) {
+            f.get();
         }
-        else if (request_.target() == "/delete" && request_.method() == http::verb::delete_) {
-            auto auth_it = request_.find("Authorization");
-            if (auth_it == request_.end()) {
-                response_ = make_json_response(request_, "{\"error\": \"Missing Authorization header\"}", http::status::unauthorized);
-            }
-            else {
-                std::string auth_header = auth_it->value();
-                if (auth_header.substr(0, 7) != "Bearer ") {
-                    response_ = make_json_response(request_, "{\"error\": \"Malformed Authorization header\"}", http::status::unauthorized);
-                }
-                else {
-                    std::string token = auth_header.substr(7);
-                    std::string email;
-
-                    if (!JWT::verify(token, email)) {
-                        response_ = make_json_response(request_, "{\"error\": \"Invalid or expired token\"}", http::status::unauthorized);
-                    }
-                    else if (user_store_->delete_user(email)) {
-                        response_ = make_json_response(request_, "{\"success\": true}", http::status::ok);
-                    }
-                    else {
-                        response_ = make_json_response(request_, "{\"success\": false, \"error\": \"User not found\"}", http::status::bad_request);
-                    }
-                }
-            }
+    } catch (...) {
+        for (std::thread& t : threads) {
+            t.detach();
         }
-        else {
-            response_ = make_json_response(request_, "{\"error\": \"Not Found\"}", http::status::not_found);
+        throw;
+    }
+
+    std::cout << "Server listening on port " << endpoint.port() << " with one thread per CPU:";
+    int node = -2;
+    for (const cpu_topology::Cpu& cpu : cpus) {
+        if (cpu.node != node && cpu.node >= 0) {
+            std::cout << " [node " << cpu.node << "]";
         }
+        node = cpu.node;
+        std::cout << ' ' << cpu.id;
+    }
+    std::cout << std::endl;
+    metrics::gauge("auth_io_threads", "Threads serving connections").set(static_cast<double>(cpus.size()));
 
-        do_write();
+    for (std::thread& t : threads) {
+        t.join();
     }
+}
 
-    void do_write() {
-        auto self = shared_from_this();
-        http::async_write(
-            socket_,
-            response_,
-            [self](beast::error_code ec, std::size_t) {
-                if (ec) {
-                    return;
-                }
-                if (self->response_.need_eof()) {
-                    return self->do_close();
-                }
-                self->do_read();
-            });
+// Hashing and encoding kernels are picked for the CPU at startup rather
+// than at build time; log and export the picks so a fleet running one
+// binary shows what each host ended up with
+void report_cpu_kernels() {
+    const std::pair<const char*, const char*> kernels[] = {
+        {"sha256", sha256::implementation()},
+        {"hmac_many", crypto::hmac_many_implementation()},
+        {"base64url", base64url::implementation()},
+        {"crc32c", crc32c_implementation()},
+        {"json_scan", credentials_body::implementation()},
+    };
+    std::cout << "CPU kernels:";
+    for (const auto& [component, kernel] : kernels) {
+        std::cout << ' ' << component << '=' << kernel;
+        metrics::gauge(std::string("auth_cpu_kernel_info{component=\"") + component + "\",kernel=\"" + kernel + "\"}",
+                       "Kernel picked for this CPU at startup, by component").set(1);
     }
+    std::cout << std::endl;
+}
 
-    void do_close() {
-        beast::error_code ec;
-        socket_.shutdown(tcp::socket::shutdown_send, ec);
+// New credentials use AUTH_PASSWORD_SCHEME (hmac-sha256 by default). The
+// KDF schemes take their cost from AUTH_PASSWORD_COST or else calibrate it
+// to about AUTH_PASSWORD_HASH_MS (default 50) per hash on this machine.
+bool configure_password_policy() {
+    const crypto::PasswordScheme* scheme = &crypto::password_scheme();
+    if (const char* name = std::getenv("AUTH_PASSWORD_SCHEME")) {
+        scheme = crypto::find_scheme(name);
+        if (!scheme) {
+            std::cerr << "Error: AUTH_PASSWORD_SCHEME must be hmac-sha256, pbkdf2-sha256 or scrypt" << std::endl;
+            return false;
+        }
     }
-};
 
-class Listener : public std::enable_shared_from_this<Listener> {
-    net::io_context& ioc_;
-    tcp::acceptor acceptor_;
-    std::shared_ptr<UserStore> user_store_;
+    std::uint32_t cost = 0;
+    if (const char* value = std::getenv("AUTH_PASSWORD_COST")) {
+        cost = static_cast<std::uint32_t>(std::strtoul(value, nullptr, 10));
+    } else if (scheme->expensive()) {
+        std::chrono::milliseconds target{50};
+        if (const char* ms = std::getenv("AUTH_PASSWORD_HASH_MS")) {
+            target = std::chrono::milliseconds(std::strtoul(ms, nullptr, 10));
+        }
+        cost = scheme->calibrate(target);
+    }
+    crypto::set_password_policy(*scheme, cost);
 
-public:
-    Listener(net::io_context& ioc, tcp::endpoint endpoint, std::shared_ptr<UserStore> store)
-        : ioc_(ioc)
-        , acceptor_(ioc)
-        , user_store_(store)
-    {
-        acceptor_.open(endpoint.protocol());
-        acceptor_.set_option(net::socket_base::reuse_address(true));
-        acceptor_.bind(endpoint);
-        acceptor_.listen(net::socket_base::max_listen_connections);
+    // Fail now rather than on the first registration if the cost is unusable
+    auto started = std::chrono::steady_clock::now();
+    try {
+        crypto::make_credential("");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: password scheme " << scheme->name() << " at cost " << cost << ": " << e.what() << std::endl;
+        return false;
     }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
 
-    void run() {
-        do_accept();
+    std::cout << "Password scheme " << scheme->name() << " at cost " << cost << " ("
+              << elapsed.count() / 1000.0 << " ms per hash)" << std::endl;
+    metrics::gauge(std::string("auth_password_scheme_info{scheme=\"") + scheme->name() + "\"}",
+                   "Scheme new credentials are made with").set(1);
+    metrics::gauge("auth_password_cost", "Cost new credentials are made with: PBKDF2 iterations or scrypt log2(N)")
+        .set(cost);
+    return true;
+}
+
+// AUTH_IO_MODE picks how connections are served: "shared" (default), one
+// io_context run by every hardware thread, or "per-core", one pinned
+// thread per CPU (see serve_per_core). Per-core mode uses the CPUs in
+// AUTH_IO_CPUS (a list like 0-3,8; default all the process may use),
+// narrowed to the NUMA nodes in AUTH_IO_NODES when that is set.
+bool configure_io_cpus(bool& per_core, std::vector<cpu_topology::Cpu>& cpus) {
+    const char* mode = std::getenv("AUTH_IO_MODE");
+    per_core = mode && std::string_view(mode) == "per-core";
+    if (mode && !per_core && std::string_view(mode) != "shared") {
+        std::cerr << "Error: AUTH_IO_MODE must be shared or per-core" << std::endl;
+        return false;
+    }
+    if (!per_core) {
+        return true;
     }
 
-private:
-    void do_accept() {
-        auto self = shared_from_this();
-        acceptor_.async_accept(
-            [self](beast::error_code ec, tcp::socket socket) {
-                if (!ec) {
-                    std::make_shared<HttpSession>(
-                        std::move(socket),
-                        self->user_store_)->run();
-                }
-                self->do_accept();
-            });
+    if (const char* list = std::getenv("AUTH_IO_CPUS")) {
+        std::vector<unsigned> ids;
+        if (!cpu_topology::parse_cpu_list(list, ids)) {
+            std::cerr << "Error: AUTH_IO_CPUS must be a CPU list such as 0-3,8" << std::endl;
+            return false;
+        }
+        cpus = cpu_topology::resolve(ids);
+    } else {
+        cpus = cpu_topology::allowed();
+    }
+    if (const char* list = std::getenv("AUTH_IO_NODES")) {
+        std::vector<unsigned> nodes;
+        if (!cpu_topology::parse_cpu_list(list, nodes)) {
+            std::cerr << "Error: AUTH_IO_NODES must be a node list such as 0 or 0-1" << std::endl;
+            return false;
+        }
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&nodes](const cpu_topology::Cpu& cpu) {
+            return cpu.node < 0 || !std::binary_search(nodes.begin(), nodes.end(), static_cast<unsigned>(cpu.node));
+        }), cpus.end());
+    }
+    if (cpus.empty()) {
+        std::cerr << "Error: none of the CPUs chosen for per-core serving are available to this process" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    // `auth_service import <file>` bulk-loads users into the persisted
+    // state (log and/or snapshot) and exits instead of serving
+    const char* import_path = nullptr;
+    if (argc == 3 && std::string_view(argv[1]) == "import") {
+        import_path = argv[2];
+    } else if (argc != 1) {
+        std::cerr << "Usage: " << argv[0] << " [import <file.ndjson|file.bin>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    report_cpu_kernels();
+    if (!configure_password_policy()) {
+        return EXIT_FAILURE;
+    }
+    bool per_core = false;
+    std::vector<cpu_topology::Cpu> io_cpus;
+    if (!configure_io_cpus(per_core, io_cpus)) {
+        return EXIT_FAILURE;
     }
-};
 
-int main() {
     try {
         auto const address = net::ip::make_address("0.0.0.0");
         auto const port = static_cast<unsigned short>(3000);
-        auto const threads = std::thread::hardware_concurrency();
+        auto const threads = per_core ? static_cast<unsigned>(io_cpus.size()) : std::thread::hardware_concurrency();
 
-        net::io_context ioc{static_cast<int>(threads)};
         auto user_store = std::make_shared<UserStore>();
 
+        // Pre-size the user table so a known population never triggers
+        // a resize at runtime
+        if (const char* expected = std::getenv("AUTH_EXPECTED_USERS")) {
+            user_store->reserve(std::strtoull(expected, nullptr, 10));
+        }
+
+        // Serve straight from the mapped snapshot; the log then only has to
+        // replay what happened after it was taken
+        const char* snapshot_path = std::getenv("AUTH_SNAPSHOT_PATH");
+        std::uint64_t replay_from = 0;
+        // Tokens from before this start are refused unless the log can say
+        // which of them were revoked
+        std::int64_t start_second = JWT::current_second();
+        std::int64_t revoked_through = std::getenv("AUTH_WAL_PATH") ? -1 : start_second;
+        if (snapshot_path && std::filesystem::exists(snapshot_path)) {
+            auto started = std::chrono::steady_clock::now();
+            auto snapshot = Snapshot::open(snapshot_path, threads);
+            user_store->attach_snapshot(snapshot);
+            replay_from = snapshot->wal_lsn();
+            // Deletes folded into the snapshot left no revocation times,
+            // so everything issued until it was written stays refused
+            struct stat st;
+            if (::stat(snapshot_path, &st) == 0) {
+                revoked_through = std::min<std::int64_t>(start_second, st.st_mtime);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started);
+            std::cout << "Loaded snapshot of " << snapshot->user_count() << " users from "
+                      << snapshot_path << " in " << elapsed.count() << " ms" << std::endl;
+        }
+
+        auto revocations = std::make_shared<RevocationList>(revoked_through);
+
+        // Persistence is opt-in: without a log path every restart starts
+        // from an empty store (or the snapshot), as before
+        if (const char* wal_path = std::getenv("AUTH_WAL_PATH")) {
+            WriteAheadLog::Options wal_options;
+            wal_options.path = wal_path;
+            if (const char* mode = std::getenv("AUTH_WAL_DURABILITY")) {
+                if (!WriteAheadLog::parse_durability(mode, wal_options.durability)) {
+                    std::cerr << "Error: AUTH_WAL_DURABILITY must be sync, group or async" << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            if (const char* delay = std::getenv("AUTH_WAL_GROUP_DELAY_US")) {
+                wal_options.group_delay = std::chrono::microseconds(std::strtoull(delay, nullptr, 10));
+            }
+
+            // A delete is followed by the revocation it caused; one without
+            // (from a crash in between, or a log older than revocation
+            // records) revokes its email through this start instead
+            std::unordered_set<std::string> unrevoked;
+            std::size_t replayed = WriteAheadLog::replay(
+                wal_options.path,
+                [&](const WriteAheadLog::Record& record) {
+                    std::string email(record.email);
+                    if (record.type == WriteAheadLog::RecordType::AddUser) {
+                        user_store->restore_user(email, record.credential);
+                    } else if (record.type == WriteAheadLog::RecordType::DeleteUser) {
+                        user_store->delete_user(email);
+                        unrevoked.insert(std::move(email));
+                    } else {
+                        unrevoked.erase(email);
+                        if (record.revoked_through + JWT::kTokenLifetime >= start_second) {
+                            revocations->revoke(email, record.revoked_through);
+                        }
+                    }
+                },
+                replay_from);
+            for (const std::string& email : unrevoked) {
+                revocations->revoke(email, start_second);
+            }
+            std::cout << "Replayed " << replayed << " log records from " << wal_options.path << " ("
+                      << revocations->size() << " live revocations)" << std::endl;
+
+            user_store->attach_log(std::make_shared<WriteAheadLog>(wal_options));
+        }
+
+        if (import_path) {
+            if (!snapshot_path && !std::getenv("AUTH_WAL_PATH")) {
+                std::cerr << "Error: importing needs AUTH_WAL_PATH or AUTH_SNAPSHOT_PATH to keep the users" << std::endl;
+                return EXIT_FAILURE;
+            }
+            user_import::Stats stats = user_import::run_file(*user_store, import_path);
+            std::cout << "Imported " << stats.imported << " users (" << stats.duplicates << " duplicates, "
+                      << stats.invalid << " invalid) in " << stats.seconds << " s, "
+                      << static_cast<std::uint64_t>(stats.users_per_second()) << " users/s" << std::endl;
+
+            std::promise<void> durable;
+            user_store->when_durable(stats.lsn, [&durable] { durable.set_value(); });
+            durable.get_future().wait();
+            if (snapshot_path) {
+                std::size_t users = user_store->save_snapshot(snapshot_path);
+                std::cout << "Saved snapshot of " << users << " users to " << snapshot_path << std::endl;
+            }
+            return EXIT_SUCCESS;
+        }
+
+        auto services = std::make_shared<Services>();
+        services->user_store = user_store;
+        if (const char* admin_token = std::getenv("AUTH_ADMIN_TOKEN")) {
+            services->admin_token = admin_token;
+        }
+        if (!services->admin_token.empty()) {
+            services->import_runner = std::make_shared<ImportRunner>(user_store);
+        }
+        if (const char* max_bytes = std::getenv("AUTH_IMPORT_MAX_BYTES")) {
+            services->import_max_bytes = std::strtoull(max_bytes, nullptr, 10);
+        }
+        if (const char* depth = std::getenv("AUTH_PIPELINE_DEPTH")) {
+            services->pipeline_depth = std::max<std::size_t>(1, std::strtoull(depth, nullptr, 10));
+        }
+        register_http_metrics();
+        if (const char* delay = std::getenv("AUTH_MAC_BATCH_DELAY_US")) {
+            MacBatcher::Options batch_options;
+            batch_options.max_delay = std::chrono::microseconds(std::strtoull(delay, nullptr, 10));
+            if (const char* size = std::getenv("AUTH_MAC_BATCH_SIZE")) {
+                batch_options.max_batch = std::strtoull(size, nullptr, 10);
+            }
+            services->mac_batcher = std::make_shared<MacBatcher>(batch_options);
+            std::cout << "Batching login MACs (up to "
+                      << batch_options.max_batch << " per batch, " << batch_options.max_delay.count()
+                      << " us window)" << std::endl;
+        }
+
+        ComputePool::Options pool_options;
+        if (const char* count = std::getenv("AUTH_COMPUTE_THREADS")) {
+            pool_options.threads = static_cast<unsigned>(std::strtoul(count, nullptr, 10));
+        }
+        if (const char* queued = std::getenv("AUTH_COMPUTE_QUEUE")) {
+            pool_options.max_queued = std::strtoull(queued, nullptr, 10);
+        }
+        services->compute_pool = std::make_shared<ComputePool>(pool_options);
+        services->login_fingerprint = std::make_shared<LoginFingerprint>();
+        services->revocations = revocations;
+        // Revocations only need dropping once the tokens they cover expire
+        std::thread([revocations] {
+            for (;;) {
+                std::this_thread::sleep_for(std::chrono::minutes(1));
+                revocations->sweep(JWT::current_second());
+            }
+        }).detach();
+        services->login_coalescer = std::make_shared<LoginCoalescer>();
+        if (const char* ttl = std::getenv("AUTH_CREDENTIAL_CACHE_TTL_MS")) {
+            CredentialCache::Options cache_options;
+            cache_options.ttl = std::chrono::milliseconds(std::strtoull(ttl, nullptr, 10));
+            if (const char* entries = std::getenv("AUTH_CREDENTIAL_CACHE_ENTRIES")) {
+                cache_options.capacity = std::strtoull(entries, nullptr, 10);
+            }
+            services->credential_cache = std::make_shared<CredentialCache>(cache_options);
+            std::cout << "Caching verified credentials for " << cache_options.ttl.count() << " ms (up to "
+                      << cache_options.capacity << " accounts)" << std::endl;
+        }
+        // Logins of one user within a second get identical tokens, so they
+        // are minted once and then served from a cache
+        std::size_t token_cache_entries = 4096;
+        if (const char* entries = std::getenv("AUTH_TOKEN_CACHE_ENTRIES")) {
+            token_cache_entries = std::strtoull(entries, nullptr, 10);
+        }
+        if (token_cache_entries > 0) {
+            services->token_cache = std::make_shared<TokenCache>(token_cache_entries);
+        }
+
+        // Snapshots are written by a forked child, so writers only stall
+        // for the fork itself rather than for the whole save
+        if (snapshot_path) {
+            auto saver = std::make_shared<SnapshotSaver>(user_store, snapshot_path);
+            services->snapshot_saver = saver;
+            if (const char* interval = std::getenv("AUTH_SNAPSHOT_INTERVAL_S")) {
+                std::chrono::seconds period(std::strtoull(interval, nullptr, 10));
+                std::thread([saver, period] {
+                    for (;;) {
+                        std::this_thread::sleep_for(period);
+                        if (!saver->start()) {
+                            std::cerr << "Skipping periodic snapshot, previous one still running" << std::endl;
+                        }
+                    }
+                }).detach();
+            }
+        }
+
+        if (per_core) {
+            serve_per_core(io_cpus, tcp::endpoint{address, port}, services);
+            return EXIT_SUCCESS;
+        }
+
+        net::io_context ioc{static_cast<int>(threads)};
         std::make_shared<Listener>(
             ioc,
             tcp::endpoint{address, port},
-            user_store)->run();
+            services)->run();
 
         std::cout << "Server listening on port " << port << std::endl;
+        metrics::gauge("auth_io_threads", "Threads serving connections").set(threads);
 
         std::vector<std::thread> v;
         v.reserve(threads - 1);
@@ -0,0 +1,92 @@
+#include "metrics.hpp"
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace {
+    struct Entry {
+        std::string help;
+        std::unique_ptr<metrics::Counter> counter;
+        std::unique_ptr<metrics::Gauge> gauge;
+    };
+
+    std::mutex registry_mutex;
+
+    // Ordered so metrics with the same base name render next to each other
+    std::map<std::string, Entry>& registry() {
+        static std::map<std::string, Entry> entries;
+        return entries;
+    }
+
+    std::size_t thread_stripe() {
+        static std::atomic<std::size_t> next{0};
+        thread_local std::size_t stripe = next.fetch_add(1, std::memory_order_relaxed);
+        return stripe;
+    }
+
+    std::string base_name(const std::string& name) {
+        return name.substr(0, name.find('{'));
+    }
+}
+
+namespace metrics {
+    void Counter::add(std::uint64_t n) {
+        stripes_[thread_stripe() % kStripes].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t Counter::value() const {
+        std::uint64_t total = 0;
+        for (const auto& stripe : stripes_) {
+            total += stripe.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    Counter& counter(const std::string& name, const std::string& help) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        Entry& entry = registry()[name];
+        if (!entry.counter) {
+            entry.help = help;
+            entry.counter = std::make_unique<Counter>();
+        }
+        return *entry.counter;
+    }
+
+    Gauge& gauge(const std::string& name, const std::string& help) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        Entry& entry = registry()[name];
+        if (!entry.gauge) {
+            entry.help = help;
+            entry.gauge = std::make_unique<Gauge>();
+        }
+        return *entry.gauge;
+    }
+
+    std::string render() {
+        std::ostringstream out;
+        // Timestamps need more than the default six significant digits
+        out.precision(std::numeric_limits<double>::digits10);
+        std::string last_base;
+
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (const auto& item : registry()) {
+            const Entry& entry = item.second;
+            std::string base = base_name(item.first);
+            if (base != last_base) {
+                out << "# HELP " << base << ' ' << entry.help << '\n'
+                    << "# TYPE " << base << ' ' << (entry.counter ? "counter" : "gauge") << '\n';
+                last_base = base;
+            }
+            out << item.first << ' ';
+            if (entry.counter) {
+                out << entry.counter->value();
+            } else {
+                out << entry.gauge->value();
+            }
+            out << '\n';
+        }
+        return out.str();
+    }
+}
@@ -0,0 +1,217 @@
+#include "password_hash.hpp"
+#include "hmac.hpp"
+#include "sha256.hpp"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    using crypto::Credential;
+    using crypto::Digest;
+    using crypto::Scheme;
+    using Clock = std::chrono::steady_clock;
+
+    void store_be32(unsigned char* p, std::uint32_t v) {
+        v = __builtin_bswap32(v);
+        std::memcpy(p, &v, sizeof(v));
+    }
+
+    // Best of a few runs, so a preempted run does not skew calibration
+    double seconds_per_derive(const crypto::PasswordScheme& scheme, std::uint32_t cost) {
+        Credential params;
+        params.scheme = scheme.id();
+        params.cost = cost;
+        double best = 0;
+        for (int i = 0; i < 3; ++i) {
+            auto started = Clock::now();
+            scheme.derive("calibration", params);
+            double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+            best = i == 0 ? elapsed : std::min(best, elapsed);
+        }
+        return best;
+    }
+
+    class HmacScheme : public crypto::PasswordScheme {
+    public:
+        Scheme id() const override { return Scheme::HmacSha256; }
+        const char* name() const override { return "hmac-sha256"; }
+        bool expensive() const override { return false; }
+
+        Digest derive(std::string_view password, const Credential&) const override {
+            return crypto::hash_password(password);
+        }
+
+        std::uint32_t calibrate(std::chrono::milliseconds) const override { return 0; }
+    };
+
+    // PBKDF2-HMAC-SHA256 (RFC 8018) with a 32-byte output, i.e. one block
+    class Pbkdf2Scheme : public crypto::PasswordScheme {
+    public:
+        static constexpr std::uint32_t kMinIterations = 10000;
+
+        Scheme id() const override { return Scheme::Pbkdf2Sha256; }
+        const char* name() const override { return "pbkdf2-sha256"; }
+        bool expensive() const override { return true; }
+
+        Digest derive(std::string_view password, const Credential& params) const override {
+            crypto::HmacSha256 prf(password);
+
+            unsigned char first[crypto::kSaltSize + 4];
+            std::memcpy(first, params.salt.data(), crypto::kSaltSize);
+            store_be32(first + crypto::kSaltSize, 1);
+            Digest u;
+            prf.mac(first, sizeof(first), u.data());
+
+            // Every later U is the MAC of a 32-byte value, which is one
+            // inner and one outer block with the same fixed padding, so
+            // iterate on the compression function and the key midstates
+            unsigned char block[sha256::kBlockSize] = {};
+            std::memcpy(block, u.data(), u.size());
+            block[32] = 0x80;
+            block[62] = 0x03; // (64 + 32) * 8 bits
+            std::uint32_t acc[8];
+            for (int i = 0; i < 8; ++i) {
+                acc[i] = static_cast<std::uint32_t>(u[4 * i]) << 24 | u[4 * i + 1] << 16 |
+                         u[4 * i + 2] << 8 | u[4 * i + 3];
+            }
+            for (std::uint32_t i = 1; i < params.cost; ++i) {
+                std::uint32_t state[8];
+                std::memcpy(state, prf.inner_midstate(), sizeof(state));
+                sha256::compress(state, block, 1);
+                for (int j = 0; j < 8; ++j) {
+                    store_be32(block + 4 * j, state[j]);
+                }
+                std::memcpy(state, prf.outer_midstate(), sizeof(state));
+                sha256::compress(state, block, 1);
+                for (int j = 0; j < 8; ++j) {
+                    store_be32(block + 4 * j, state[j]);
+                    acc[j] ^= state[j];
+                }
+            }
+
+            Digest out;
+            for (int i = 0; i < 8; ++i) {
+                store_be32(out.data() + 4 * i, acc[i]);
+            }
+            OPENSSL_cleanse(block, sizeof(block));
+            return out;
+        }
+
+        std::uint32_t calibrate(std::chrono::milliseconds target) const override {
+            constexpr std::uint32_t kProbe = 20000;
+            double per_iteration = seconds_per_derive(*this, kProbe) / kProbe;
+            double iterations = std::chrono::duration<double>(target).count() / per_iteration;
+            return static_cast<std::uint32_t>(std::clamp(iterations, double{kMinIterations}, 1e9));
+        }
+    };
+
+    // scrypt (RFC 7914) with r = 8, p = 1; cost is log2(N), so memory per
+    // hash is 1 KiB << cost
+    class ScryptScheme : public crypto::PasswordScheme {
+    public:
+        static constexpr std::uint32_t kMinLogN = 14;
+        static constexpr std::uint32_t kMaxLogN = 18;
+
+        Scheme id() const override { return Scheme::Scrypt; }
+        const char* name() const override { return "scrypt"; }
+        bool expensive() const override { return true; }
+
+        Digest derive(std::string_view password, const Credential& params) const override {
+            if (params.cost < 1 || params.cost > 30) {
+                throw std::runtime_error("scrypt cost out of range");
+            }
+            std::uint64_t n = std::uint64_t{1} << params.cost;
+            std::uint64_t max_memory = 128 * 8 * (n + 2) + (1 << 20);
+            Digest out;
+            if (EVP_PBE_scrypt(password.data(), password.size(), params.salt.data(), params.salt.size(), n, 8, 1,
+                               max_memory, out.data(), out.size()) != 1) {
+                throw std::runtime_error("scrypt failed");
+            }
+            return out;
+        }
+
+        std::uint32_t calibrate(std::chrono::milliseconds target) const override {
+            double wanted = std::chrono::duration<double>(target).count();
+            std::uint32_t cost = kMinLogN;
+            // Each step doubles both time and memory
+            while (cost < kMaxLogN && seconds_per_derive(*this, cost) * 2 <= wanted * 1.4) {
+                ++cost;
+            }
+            return cost;
+        }
+    };
+
+    const HmacScheme kHmac;
+    const Pbkdf2Scheme kPbkdf2;
+    const ScryptScheme kScrypt;
+    const crypto::PasswordScheme* const kSchemes[] = {&kHmac, &kPbkdf2, &kScrypt};
+
+    struct Policy {
+        const crypto::PasswordScheme* scheme = &kHmac;
+        std::uint32_t cost = 0;
+    };
+
+    Policy policy;
+}
+
+namespace crypto {
+    const PasswordScheme* find_scheme(Scheme id) {
+        for (const PasswordScheme* scheme : kSchemes) {
+            if (scheme->id() == id) {
+                return scheme;
+            }
+        }
+        return nullptr;
+    }
+
+    const PasswordScheme* find_scheme(std::string_view name) {
+        for (const PasswordScheme* scheme : kSchemes) {
+            if (name == scheme->name()) {
+                return scheme;
+            }
+        }
+        return nullptr;
+    }
+
+    void set_password_policy(const PasswordScheme& scheme, std::uint32_t cost) {
+        policy.scheme = &scheme;
+        policy.cost = cost;
+    }
+
+    const PasswordScheme& password_scheme() {
+        return *policy.scheme;
+    }
+
+    std::uint32_t password_cost() {
+        return policy.cost;
+    }
+
+    Credential make_credential(std::string_view password) {
+        Credential credential;
+        credential.scheme = policy.scheme->id();
+        credential.cost = policy.cost;
+        if (policy.scheme->id() != Scheme::HmacSha256 &&
+            RAND_bytes(credential.salt.data(), static_cast<int>(credential.salt.size())) != 1) {
+            throw std::runtime_error("no randomness for a password salt");
+        }
+        credential.hash = policy.scheme->derive(password, credential);
+        return credential;
+    }
+
+    bool verify_credential(std::string_view password, const Credential& credential) {
+        const PasswordScheme* scheme = find_scheme(credential.scheme);
+        return scheme && digest_equal(scheme->derive(password, credential), credential.hash);
+    }
+
+    bool is_expensive(const Credential& credential) {
+        const PasswordScheme* scheme = find_scheme(credential.scheme);
+        return scheme && scheme->expensive();
+    }
+
+    bool is_expensive() {
+        return policy.scheme->expensive();
+    }
+}
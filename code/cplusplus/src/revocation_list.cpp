@@ -0,0 +1,257 @@
+#include "revocation_list.hpp"
+#include "epoch.hpp"
+#include "jwt.hpp"
+#include "metrics.hpp"
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    constexpr std::int64_t kBucketSeconds = 60 * 60;
+    constexpr std::size_t kInitialCapacity = 16;
+
+    struct RevocationMetrics {
+        metrics::Gauge& entries = metrics::gauge(
+            "auth_revocation_entries", "Revoked emails whose tokens may not have expired yet");
+        metrics::Gauge& buckets = metrics::gauge(
+            "auth_revocation_buckets", "Expiry-hour buckets holding revocations");
+        metrics::Gauge& bytes = metrics::gauge(
+            "auth_revocation_table_bytes", "Memory held by the revocation table");
+    };
+
+    RevocationMetrics& revocation_metrics() {
+        static RevocationMetrics m;
+        return m;
+    }
+
+    std::int64_t expiry_hour(std::int64_t iat) {
+        return (iat + JWT::kTokenLifetime) / kBucketSeconds;
+    }
+
+    std::uint64_t rotl(std::uint64_t x, int b) {
+        return x << b | x >> (64 - b);
+    }
+
+    void sip_round(std::uint64_t& v0, std::uint64_t& v1, std::uint64_t& v2, std::uint64_t& v3) {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    }
+
+    // SipHash-1-3: keyed, so collisions cannot be chosen, and fast on
+    // short inputs like emails
+    std::uint64_t siphash13(const std::uint64_t key[2], const char* data, std::size_t len) {
+        std::uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+        std::uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+        std::uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+        std::uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+        std::size_t full = len & ~std::size_t{7};
+        for (std::size_t i = 0; i < full; i += 8) {
+            std::uint64_t m;
+            std::memcpy(&m, data + i, sizeof(m)); // little-endian hosts only
+            v3 ^= m;
+            sip_round(v0, v1, v2, v3);
+            v0 ^= m;
+        }
+        std::uint64_t last = static_cast<std::uint64_t>(len) << 56;
+        for (std::size_t i = full; i < len; ++i) {
+            last |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i])) << (8 * (i - full));
+        }
+        v3 ^= last;
+        sip_round(v0, v1, v2, v3);
+        v0 ^= last;
+
+        v2 ^= 0xff;
+        sip_round(v0, v1, v2, v3);
+        sip_round(v0, v1, v2, v3);
+        sip_round(v0, v1, v2, v3);
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+}
+
+// Open addressing with linear probing, at most half full. Key 0 marks a
+// free slot; a slot's time is written before its key is published.
+struct RevocationList::Table {
+    struct Slot {
+        std::atomic<std::uint64_t> key{0};
+        std::atomic<std::int64_t> at{0};
+    };
+
+    explicit Table(std::size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+
+    std::size_t capacity() const { return mask + 1; }
+
+    std::size_t mask;
+    std::unique_ptr<Slot[]> slots;
+};
+
+RevocationList::RevocationList(std::int64_t revoked_through) : revoked_through_(revoked_through) {
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(hash_key_), sizeof(hash_key_)) != 1) {
+        throw std::runtime_error("no randomness for the revocation list key");
+    }
+    revocation_metrics();
+}
+
+RevocationList::~RevocationList() {
+    delete table_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t RevocationList::key_for(std::string_view email) const {
+    std::uint64_t key = siphash13(hash_key_, email.data(), email.size());
+    return key == 0 ? 1 : key;
+}
+
+bool RevocationList::is_revoked(std::string_view email, std::int64_t iat) const {
+    if (iat <= revoked_through_) {
+        return true;
+    }
+    if (iat > latest_.load(std::memory_order_relaxed) || entries_.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    std::uint64_t key = key_for(email);
+    epoch::Guard guard;
+    const Table* table = table_.load(std::memory_order_acquire);
+    if (!table) {
+        return false;
+    }
+    for (std::size_t i = key & table->mask;; i = (i + 1) & table->mask) {
+        std::uint64_t k = table->slots[i].key.load(std::memory_order_acquire);
+        if (k == 0) {
+            return false;
+        }
+        if (k == key) {
+            return table->slots[i].at.load(std::memory_order_relaxed) >= iat;
+        }
+    }
+}
+
+void RevocationList::note_issued(std::int64_t iat) {
+    // Usually already this second, so most logins only read the line
+    std::int64_t latest = latest_issued_.load(std::memory_order_relaxed);
+    while (iat > latest) {
+        if (latest_issued_.compare_exchange_weak(latest, iat)) {
+            break;
+        }
+    }
+}
+
+std::int64_t RevocationList::revoke(std::string_view email, std::int64_t at) {
+    at = std::max(at, latest_issued_.load(std::memory_order_seq_cst));
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::int64_t hour = expiry_hour(at);
+    Bucket& bucket = buckets_[static_cast<std::size_t>(hour) % kBuckets];
+    if (bucket.hour > hour) {
+        // Older than anything the buckets still cover, so every token it
+        // could revoke has expired
+        return at;
+    }
+    if (bucket.hour != hour) {
+        // Whatever the bucket held has expired; reusing it drops that
+        bool stale = bucket.size > 0;
+        bucket.hour = hour;
+        bucket.size = 0;
+        if (stale) {
+            rebuild_locked(entries_.load(std::memory_order_relaxed));
+        }
+    }
+
+    std::size_t entries = entries_.load(std::memory_order_relaxed);
+    Table* table = table_.load(std::memory_order_relaxed);
+    if (!table || (entries + 1) * 2 > table->capacity()) {
+        rebuild_locked(entries + 1);
+        table = table_.load(std::memory_order_relaxed);
+    }
+
+    if (at > latest_.load(std::memory_order_relaxed)) {
+        latest_.store(at, std::memory_order_relaxed);
+    }
+
+    std::uint64_t key = key_for(email);
+    for (std::size_t i = key & table->mask;; i = (i + 1) & table->mask) {
+        Table::Slot& slot = table->slots[i];
+        std::uint64_t k = slot.key.load(std::memory_order_relaxed);
+        if (k == key) {
+            std::int64_t previous = slot.at.load(std::memory_order_relaxed);
+            if (previous < at) {
+                // Only the latest revocation matters; it moves to a later
+                // bucket
+                --buckets_[static_cast<std::size_t>(expiry_hour(previous)) % kBuckets].size;
+                ++bucket.size;
+                slot.at.store(at, std::memory_order_relaxed);
+            }
+            break;
+        }
+        if (k == 0) {
+            slot.at.store(at, std::memory_order_relaxed);
+            slot.key.store(key, std::memory_order_release);
+            ++bucket.size;
+            entries_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    update_metrics_locked();
+    return at;
+}
+
+void RevocationList::sweep(std::int64_t now) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    bool dropped = false;
+    for (Bucket& bucket : buckets_) {
+        // Every token this bucket revokes expires within its hour
+        if (bucket.hour >= 0 && (bucket.hour + 1) * kBucketSeconds <= now) {
+            dropped = dropped || bucket.size > 0;
+            bucket.hour = -1;
+            bucket.size = 0;
+        }
+    }
+    if (dropped) {
+        rebuild_locked(entries_.load(std::memory_order_relaxed));
+    }
+    update_metrics_locked();
+}
+
+void RevocationList::rebuild_locked(std::size_t entries) {
+    std::size_t capacity = kInitialCapacity;
+    while (capacity < entries * 2) {
+        capacity *= 2;
+    }
+    auto* rebuilt = new Table(capacity);
+    std::size_t kept = 0;
+    if (Table* table = table_.load(std::memory_order_relaxed)) {
+        for (std::size_t i = 0; i < table->capacity(); ++i) {
+            std::uint64_t k = table->slots[i].key.load(std::memory_order_relaxed);
+            std::int64_t at = table->slots[i].at.load(std::memory_order_relaxed);
+            std::int64_t hour = expiry_hour(at);
+            if (k == 0 || buckets_[static_cast<std::size_t>(hour) % kBuckets].hour != hour) {
+                continue;
+            }
+            std::size_t j = k & rebuilt->mask;
+            while (rebuilt->slots[j].key.load(std::memory_order_relaxed) != 0) {
+                j = (j + 1) & rebuilt->mask;
+            }
+            rebuilt->slots[j].at.store(at, std::memory_order_relaxed);
+            rebuilt->slots[j].key.store(k, std::memory_order_relaxed);
+            ++kept;
+        }
+    }
+    Table* old = table_.exchange(rebuilt, std::memory_order_acq_rel);
+    entries_.store(kept, std::memory_order_relaxed);
+    if (old) {
+        epoch::retire(old);
+    }
+}
+
+void RevocationList::update_metrics_locked() {
+    std::size_t buckets = 0;
+    for (const Bucket& bucket : buckets_) {
+        buckets += bucket.size > 0;
+    }
+    const Table* table = table_.load(std::memory_order_relaxed);
+    RevocationMetrics& m = revocation_metrics();
+    m.entries.set(static_cast<double>(entries_.load(std::memory_order_relaxed)));
+    m.buckets.set(static_cast<double>(buckets));
+    m.bytes.set(static_cast<double>(table ? table->capacity() * sizeof(Table::Slot) : 0));
+}
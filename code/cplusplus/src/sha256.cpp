@@ -0,0 +1,241 @@
+#include "sha256.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+namespace sha256 {
+    const std::uint32_t kInitialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    const std::uint32_t kRoundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+}
+
+namespace {
+    using sha256::Kernel;
+    using sha256::kRoundConstants;
+
+    std::uint32_t rotr(std::uint32_t x, int n) {
+        return x >> n | x << (32 - n);
+    }
+
+    std::uint32_t load_be32(const unsigned char* p) {
+        return std::uint32_t{p[0]} << 24 | std::uint32_t{p[1]} << 16 | std::uint32_t{p[2]} << 8 | p[3];
+    }
+
+    void compress_portable(std::uint32_t state[8], const unsigned char* p, std::size_t nblocks) {
+        for (; nblocks > 0; --nblocks, p += sha256::kBlockSize) {
+            std::uint32_t w[64];
+            for (int t = 0; t < 16; ++t) {
+                w[t] = load_be32(p + 4 * t);
+            }
+            for (int t = 16; t < 64; ++t) {
+                std::uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                std::uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+            }
+
+            std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int t = 0; t < 64; ++t) {
+                std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                                   kRoundConstants[t] + w[t];
+                std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+    }
+
+#if defined(__x86_64__)
+    // The SHA extensions keep the state as ABEF / CDGH and run two rounds
+    // per sha256rnds2, four message words at a time
+    __attribute__((target("sha,sse4.1")))
+    void compress_shani(std::uint32_t state[8], const unsigned char* p, std::size_t nblocks) {
+        const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+        __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xb1);
+        __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1b);
+        __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+        cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+        for (; nblocks > 0; --nblocks, p += sha256::kBlockSize) {
+            __m128i abef_saved = abef;
+            __m128i cdgh_saved = cdgh;
+
+            // msg[g & 3] holds words 4g..4g+3 of the schedule
+            __m128i msg[4];
+            for (int i = 0; i < 4; ++i) {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i)), byteswap);
+            }
+#pragma GCC unroll 16
+            for (int g = 0; g < 16; ++g) {
+                if (g >= 4) {
+                    __m128i next = _mm_sha256msg1_epu32(msg[g & 3], msg[(g + 1) & 3]);
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(msg[(g + 3) & 3], msg[(g + 2) & 3], 4));
+                    msg[g & 3] = _mm_sha256msg2_epu32(next, msg[(g + 3) & 3]);
+                }
+                __m128i wk = _mm_add_epi32(
+                    msg[g & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(kRoundConstants + 4 * g)));
+                cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+                abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+            }
+
+            abef = _mm_add_epi32(abef, abef_saved);
+            cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+        }
+
+        tmp = _mm_shuffle_epi32(abef, 0x1b);
+        cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, cdgh, 0xf0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+    }
+#elif defined(__aarch64__)
+#if defined(__clang__)
+    __attribute__((target("sha2")))
+#else
+    __attribute__((target("+crypto")))
+#endif
+    void compress_armv8(std::uint32_t state[8], const unsigned char* p, std::size_t nblocks) {
+        uint32x4_t abcd = vld1q_u32(state);
+        uint32x4_t efgh = vld1q_u32(state + 4);
+
+        for (; nblocks > 0; --nblocks, p += sha256::kBlockSize) {
+            uint32x4_t abcd_saved = abcd;
+            uint32x4_t efgh_saved = efgh;
+
+            // msg[g & 3] holds words 4g..4g+3 of the schedule
+            uint32x4_t msg[4];
+            for (int i = 0; i < 4; ++i) {
+                msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * i)));
+            }
+            for (int g = 0; g < 16; ++g) {
+                if (g >= 4) {
+                    msg[g & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[g & 3], msg[(g + 1) & 3]),
+                                                 msg[(g + 2) & 3], msg[(g + 3) & 3]);
+                }
+                uint32x4_t wk = vaddq_u32(msg[g & 3], vld1q_u32(kRoundConstants + 4 * g));
+                uint32x4_t abcd_before = abcd;
+                abcd = vsha256hq_u32(abcd, efgh, wk);
+                efgh = vsha256h2q_u32(efgh, abcd_before, wk);
+            }
+
+            abcd = vaddq_u32(abcd, abcd_saved);
+            efgh = vaddq_u32(efgh, efgh_saved);
+        }
+
+        vst1q_u32(state, abcd);
+        vst1q_u32(state + 4, efgh);
+    }
+
+    bool has_armv8_sha2() {
+#if defined(__APPLE__)
+        return true; // every Apple arm64 core has it
+#elif defined(__linux__) && defined(HWCAP_SHA2)
+        return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+        return false;
+#endif
+    }
+#endif
+
+    Kernel pick_kernel() {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+            return {compress_shani, true, "sha-ni"};
+        }
+#elif defined(__aarch64__)
+        if (has_armv8_sha2()) {
+            return {compress_armv8, true, "armv8-sha2"};
+        }
+#endif
+        return {compress_portable, false, "portable"};
+    }
+
+    // Function-local so other translation units can hash (or ask which
+    // kernel is in use) during their own static initialization
+    const Kernel& kernel() {
+        static const Kernel k = pick_kernel();
+        return k;
+    }
+}
+
+namespace sha256 {
+    void compress(std::uint32_t state[8], const unsigned char* blocks, std::size_t nblocks) {
+        kernel().compress(state, blocks, nblocks);
+    }
+
+    void hash(const void* data, std::size_t len, unsigned char* out) {
+        const auto* p = static_cast<const unsigned char*>(data);
+        std::uint32_t state[8];
+        std::memcpy(state, kInitialState, sizeof(state));
+
+        std::size_t full = len / kBlockSize;
+        compress(state, p, full);
+
+        unsigned char tail[2 * kBlockSize] = {};
+        std::size_t rest = len % kBlockSize;
+        std::memcpy(tail, p + full * kBlockSize, rest);
+        tail[rest] = 0x80;
+        std::size_t tail_size = rest + 9 <= kBlockSize ? kBlockSize : 2 * kBlockSize;
+        std::uint64_t bits = static_cast<std::uint64_t>(len) * 8;
+        for (int i = 1; i <= 8; ++i) {
+            tail[tail_size - i] = static_cast<unsigned char>(bits >> (8 * (i - 1)));
+        }
+        compress(state, tail, tail_size / kBlockSize);
+
+        for (int i = 0; i < 8; ++i) {
+            out[4 * i] = static_cast<unsigned char>(state[i] >> 24);
+            out[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+            out[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+            out[4 * i + 3] = static_cast<unsigned char>(state[i]);
+        }
+    }
+
+    bool hardware_accelerated() {
+        return kernel().hardware;
+    }
+
+    const char* implementation() {
+        return kernel().name;
+    }
+
+    std::vector<Kernel> supported_kernels() {
+        std::vector<Kernel> kernels{kernel()};
+        if (kernel().compress != compress_portable) {
+            kernels.push_back({compress_portable, false, "portable"});
+        }
+        return kernels;
+    }
+}
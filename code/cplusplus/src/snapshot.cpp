@@ -0,0 +1,368 @@
+#include "snapshot.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "snapshot files are little endian; add byte swapping before using them here");
+
+namespace {
+    constexpr char kMagic[8] = {'A', 'U', 'T', 'H', 'S', 'N', 'A', 'P'};
+    // Version 1 stored a bare HMAC digest per user, version 2 a credential
+    constexpr std::uint32_t kVersion = 2;
+
+    constexpr std::size_t kHeaderSize = 128;
+    constexpr std::uint32_t kChunkSizeLog2 = 22; // 4 MiB checksum chunks
+    constexpr std::uint64_t kChunkSize = std::uint64_t{1} << kChunkSizeLog2;
+    constexpr std::size_t kWriteBufferSize = 1 << 20;
+
+    constexpr std::uint64_t kOffsetMask = (std::uint64_t{1} << 48) - 1;
+
+    // Fixed header layout; every field is naturally aligned
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t chunk_size_log2;
+        std::uint64_t user_count;
+        std::uint64_t wal_lsn;
+        std::uint64_t heap_offset;
+        std::uint64_t heap_size;
+        std::uint64_t index_offset;
+        std::uint64_t index_capacity;
+        std::uint64_t crc_offset;
+        std::uint32_t chunk_count;
+        std::uint32_t header_crc; // over every byte before this field
+    };
+    static_assert(sizeof(Header) <= kHeaderSize, "header must fit its reserved space");
+
+    // The on-disk index must not depend on the standard library's hash, so
+    // the snapshot has its own: FNV-1a followed by a murmur3 finalizer
+    std::uint64_t snapshot_hash(std::string_view s) {
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : s) {
+            h = (h ^ c) * 0x100000001b3ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::uint16_t tag_of(std::uint64_t hash) {
+        return static_cast<std::uint16_t>(hash >> 48);
+    }
+
+    std::system_error os_error(const std::string& what) {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+
+    void write_all(int fd, const unsigned char* data, std::size_t len, const std::string& path) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw os_error("write " + path);
+            }
+            data += n;
+            len -= static_cast<std::size_t>(n);
+        }
+    }
+}
+
+const unsigned char* Snapshot::read_record(const unsigned char* p, crypto::Credential* credential,
+                                           std::uint32_t* size) const {
+    if (version_ == 1) {
+        crypto::Digest digest;
+        std::memcpy(digest.data(), p, crypto::kDigestSize);
+        *credential = crypto::Credential::legacy(digest);
+    } else if (!crypto::decode_credential(p, *credential)) {
+        // Only a newer build writes schemes we do not know; an all-zero
+        // legacy hash matches no password
+        *credential = crypto::Credential{};
+    }
+    std::memcpy(size, p + credential_size_, sizeof(*size));
+    return p + credential_size_ + sizeof(*size);
+}
+
+std::shared_ptr<const Snapshot> Snapshot::open(const std::string& path, unsigned verify_threads) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw os_error("open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw os_error("stat " + path);
+    }
+    auto file_size = static_cast<std::uint64_t>(st.st_size);
+    if (file_size < kHeaderSize) {
+        ::close(fd);
+        throw std::runtime_error(path + ": truncated snapshot");
+    }
+
+    void* map = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw os_error("mmap " + path);
+    }
+
+    std::shared_ptr<Snapshot> snapshot(new Snapshot);
+    snapshot->map_ = map;
+    snapshot->map_size_ = file_size;
+    const auto* base = static_cast<const unsigned char*>(map);
+
+    Header h;
+    std::memcpy(&h, base, sizeof(h));
+    auto corrupt = [&path](const char* why) {
+        return std::runtime_error(path + ": " + why);
+    };
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw corrupt("not a snapshot file");
+    }
+    if (h.version != 1 && h.version != kVersion) {
+        throw corrupt("unsupported snapshot version");
+    }
+    if (crc32c(&h, offsetof(Header, header_crc)) != h.header_crc) {
+        throw corrupt("header checksum mismatch");
+    }
+
+    if (h.chunk_size_log2 < 12 || h.chunk_size_log2 > 40) {
+        throw corrupt("invalid checksum chunk size");
+    }
+    std::uint64_t chunk_size = std::uint64_t{1} << h.chunk_size_log2;
+    std::uint64_t covered = h.crc_offset - h.heap_offset;
+    bool layout_ok = h.heap_offset == kHeaderSize &&
+                     h.heap_offset + h.heap_size <= h.index_offset &&
+                     h.index_offset % 8 == 0 &&
+                     h.index_capacity != 0 && (h.index_capacity & (h.index_capacity - 1)) == 0 &&
+                     h.index_offset + h.index_capacity * 8 == h.crc_offset &&
+                     h.chunk_count == (covered + chunk_size - 1) / chunk_size &&
+                     h.crc_offset + std::uint64_t{h.chunk_count} * 4 == file_size;
+    if (!layout_ok) {
+        throw corrupt("inconsistent snapshot layout");
+    }
+
+    // Checksum the chunks in parallel; this is the only full pass over the
+    // file and it reads pages in order, which the kernel prefetches well
+    const unsigned char* crcs = base + h.crc_offset;
+    unsigned threads = std::max(1u, std::min<unsigned>(verify_threads, h.chunk_count));
+    std::atomic<bool> valid{true};
+    auto verify = [&](std::uint32_t first, std::uint32_t last) {
+        for (std::uint32_t c = first; c < last && valid.load(std::memory_order_relaxed); ++c) {
+            std::uint64_t begin = h.heap_offset + c * chunk_size;
+            std::uint64_t len = std::min(chunk_size, h.crc_offset - begin);
+            std::uint32_t expected;
+            std::memcpy(&expected, crcs + 4 * c, 4);
+            if (crc32c(base + begin, len) != expected) {
+                valid.store(false, std::memory_order_relaxed);
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    std::uint32_t per_thread = (h.chunk_count + threads - 1) / threads;
+    for (unsigned t = 1; t < threads; ++t) {
+        std::uint32_t first = std::min(h.chunk_count, t * per_thread);
+        workers.emplace_back(verify, first, std::min(h.chunk_count, first + per_thread));
+    }
+    verify(0, std::min(h.chunk_count, per_thread));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (!valid) {
+        throw corrupt("data checksum mismatch");
+    }
+
+    // From here on access is by hash, so don't waste readahead on it
+    ::madvise(map, file_size, MADV_RANDOM);
+
+    snapshot->heap_ = base + h.heap_offset;
+    snapshot->heap_size_ = h.heap_size;
+    snapshot->index_ = base + h.index_offset;
+    snapshot->index_mask_ = h.index_capacity - 1;
+    snapshot->user_count_ = h.user_count;
+    snapshot->wal_lsn_ = h.wal_lsn;
+    snapshot->version_ = h.version;
+    snapshot->credential_size_ = h.version == 1 ? crypto::kDigestSize : crypto::kCredentialSize;
+    return snapshot;
+}
+
+Snapshot::~Snapshot() {
+    if (map_) {
+        ::munmap(map_, map_size_);
+    }
+}
+
+bool Snapshot::find(std::string_view email, crypto::Credential* credential) const {
+    std::uint64_t hash = snapshot_hash(email);
+    std::uint16_t tag = tag_of(hash);
+
+    for (std::uint64_t pos = hash & index_mask_;; pos = (pos + 1) & index_mask_) {
+        std::uint64_t entry;
+        std::memcpy(&entry, index_ + pos * 8, sizeof(entry));
+        if (entry == 0) {
+            return false;
+        }
+        if ((entry >> 48) != tag) {
+            continue;
+        }
+
+        std::uint64_t offset = (entry & kOffsetMask) - 1;
+        if (offset + credential_size_ + 4 > heap_size_) {
+            return false;
+        }
+        crypto::Credential stored;
+        std::uint32_t size;
+        const unsigned char* p = read_record(heap_ + offset, &stored, &size);
+        if (size == email.size() && offset + credential_size_ + 4 + size <= heap_size_ &&
+            std::memcmp(p, email.data(), size) == 0) {
+            if (credential) {
+                *credential = stored;
+            }
+            return true;
+        }
+    }
+}
+
+SnapshotWriter::SnapshotWriter(std::string path)
+    : path_(std::move(path))
+    , tmp_path_(path_ + ".tmp")
+{
+    fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        throw os_error("open " + tmp_path_);
+    }
+    buffer_.reserve(kWriteBufferSize);
+
+    // Placeholder; the real header is written last, once everything it
+    // describes is on disk
+    unsigned char zeros[kHeaderSize] = {};
+    write_all(fd_, zeros, sizeof(zeros), tmp_path_);
+    offset_ = kHeaderSize;
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    if (!committed_) {
+        ::unlink(tmp_path_.c_str());
+    }
+}
+
+void SnapshotWriter::flush_buffer() {
+    write_all(fd_, buffer_.data(), buffer_.size(), tmp_path_);
+    buffer_.clear();
+}
+
+// Appends to the checksummed region, closing a chunk every kChunkSize bytes
+void SnapshotWriter::write(const void* data, std::size_t len) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    while (len > 0) {
+        std::uint64_t in_chunk = (offset_ - kHeaderSize) % kChunkSize;
+        std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(len, kChunkSize - in_chunk));
+
+        chunk_crc_ = crc32c(p, n, chunk_crc_);
+        buffer_.insert(buffer_.end(), p, p + n);
+        offset_ += n;
+        p += n;
+        len -= n;
+
+        if ((offset_ - kHeaderSize) % kChunkSize == 0) {
+            chunk_crcs_.push_back(chunk_crc_);
+            chunk_crc_ = 0;
+        }
+        if (buffer_.size() >= kWriteBufferSize) {
+            flush_buffer();
+        }
+    }
+}
+
+void SnapshotWriter::add(std::string_view email, const crypto::Credential& credential) {
+    entries_.emplace_back(snapshot_hash(email), offset_ - kHeaderSize);
+
+    unsigned char encoded[crypto::kCredentialSize];
+    crypto::encode_credential(credential, encoded);
+    auto size = static_cast<std::uint32_t>(email.size());
+    write(encoded, sizeof(encoded));
+    write(&size, sizeof(size));
+    write(email.data(), email.size());
+}
+
+void SnapshotWriter::commit(std::uint64_t wal_lsn) {
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.chunk_size_log2 = kChunkSizeLog2;
+    h.user_count = entries_.size();
+    h.wal_lsn = wal_lsn;
+    h.heap_offset = kHeaderSize;
+    h.heap_size = offset_ - kHeaderSize;
+
+    static const unsigned char kPadding[8] = {};
+    write(kPadding, (8 - offset_ % 8) % 8);
+    h.index_offset = offset_;
+
+    // Half full at most, so misses (every registration) stop early
+    h.index_capacity = 16;
+    while (h.index_capacity < entries_.size() * 2) {
+        h.index_capacity <<= 1;
+    }
+    std::vector<std::uint64_t> index(h.index_capacity, 0);
+    std::uint64_t mask = h.index_capacity - 1;
+    for (const auto& entry : entries_) {
+        std::uint64_t pos = entry.first & mask;
+        while (index[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        index[pos] = (std::uint64_t{tag_of(entry.first)} << 48) | (entry.second + 1);
+    }
+    write(index.data(), index.size() * sizeof(std::uint64_t));
+    h.crc_offset = offset_;
+
+    if ((offset_ - kHeaderSize) % kChunkSize != 0) {
+        chunk_crcs_.push_back(chunk_crc_);
+    }
+    h.chunk_count = static_cast<std::uint32_t>(chunk_crcs_.size());
+    buffer_.insert(buffer_.end(),
+                   reinterpret_cast<const unsigned char*>(chunk_crcs_.data()),
+                   reinterpret_cast<const unsigned char*>(chunk_crcs_.data() + chunk_crcs_.size()));
+    flush_buffer();
+
+    h.header_crc = crc32c(&h, offsetof(Header, header_crc));
+    if (::pwrite(fd_, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+        throw os_error("write " + tmp_path_);
+    }
+    if (::fdatasync(fd_) != 0) {
+        throw os_error("fdatasync " + tmp_path_);
+    }
+    ::close(fd_);
+    fd_ = -1;
+
+    if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+        throw os_error("rename " + tmp_path_);
+    }
+    committed_ = true;
+
+    auto slash = path_.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path_.substr(0, slash + 1);
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
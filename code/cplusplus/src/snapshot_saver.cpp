@@ -0,0 +1,183 @@
+#include "snapshot_saver.hpp"
+#include "metrics.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct SaverMetrics {
+        metrics::Gauge& in_progress = metrics::gauge(
+            "auth_snapshot_in_progress", "1 while a background snapshot is being written");
+        metrics::Gauge& progress = metrics::gauge(
+            "auth_snapshot_progress_ratio", "Fraction of users written by the running snapshot");
+        metrics::Gauge& pause_seconds = metrics::gauge(
+            "auth_snapshot_pause_seconds", "Time writers were paused to fork the last snapshot");
+        metrics::Gauge& duration_seconds = metrics::gauge(
+            "auth_snapshot_duration_seconds", "Wall time of the last completed snapshot");
+        metrics::Gauge& last_users = metrics::gauge(
+            "auth_snapshot_users", "Users written by the last successful snapshot");
+        metrics::Gauge& last_success = metrics::gauge(
+            "auth_snapshot_last_success_timestamp_seconds", "Unix time of the last successful snapshot");
+        metrics::Counter& succeeded = metrics::counter(
+            "auth_snapshots_total{result=\"ok\"}", "Snapshots attempted, by outcome");
+        metrics::Counter& failed = metrics::counter(
+            "auth_snapshots_total{result=\"error\"}", "Snapshots attempted, by outcome");
+        metrics::Counter& rejected = metrics::counter(
+            "auth_snapshots_total{result=\"busy\"}", "Snapshots attempted, by outcome");
+    };
+
+    SaverMetrics& saver_metrics() {
+        static SaverMetrics m;
+        return m;
+    }
+
+    void record_success(std::size_t users, Clock::time_point started) {
+        SaverMetrics& m = saver_metrics();
+        m.succeeded.add();
+        m.duration_seconds.set(seconds_since(started));
+        m.last_users.set(static_cast<double>(users));
+        m.last_success.set(static_cast<double>(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count()));
+    }
+}
+
+SnapshotSaver::SnapshotSaver(std::shared_ptr<UserStore> store, std::string path)
+    : store_(std::move(store))
+    , path_(std::move(path))
+{
+    void* shared = ::mmap(nullptr, sizeof(Progress), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap snapshot progress");
+    }
+    progress_ = new (shared) Progress;
+    saver_metrics();
+}
+
+SnapshotSaver::~SnapshotSaver() {
+    {
+        std::lock_guard<std::mutex> lock(reaper_mutex_);
+        if (reaper_.joinable()) {
+            reaper_.join();
+        }
+    }
+    ::munmap(progress_, sizeof(Progress));
+}
+
+bool SnapshotSaver::start() {
+    bool expected = false;
+    if (!running_.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+        saver_metrics().rejected.add();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(reaper_mutex_);
+    if (reaper_.joinable()) {
+        // The previous reaper has already cleared running_, so this is quick
+        reaper_.join();
+    }
+
+    SaverMetrics& m = saver_metrics();
+    m.in_progress.set(1);
+    m.progress.set(0);
+    progress_->written.store(0, std::memory_order_relaxed);
+
+    auto started = Clock::now();
+    std::size_t expected_users = store_->approximate_size();
+    pid_t pid = -1;
+    int fork_errno = 0;
+
+    store_->pause_writers([&] {
+        // Captured with writers paused, so the snapshot covers exactly the
+        // log up to here
+        std::uint64_t wal_lsn = store_->log_position();
+        pid = ::fork();
+        if (pid == 0) {
+            // Child: every shard mutex is held by the thread that forked
+            // (us), so write without locking and never return
+            int status = 0;
+            try {
+                SnapshotWriter writer(path_);
+                store_->write_frozen_snapshot(writer, &progress_->written);
+                writer.commit(wal_lsn);
+            } catch (const std::exception& e) {
+                // Plain write(2): stdio locks may be held by parent threads
+                const char prefix[] = "Snapshot child failed: ";
+                ::write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+                ::write(STDERR_FILENO, e.what(), std::strlen(e.what()));
+                ::write(STDERR_FILENO, "\n", 1);
+                status = 1;
+            }
+            ::_exit(status);
+        }
+        fork_errno = errno;
+    });
+    m.pause_seconds.set(seconds_since(started));
+
+    if (pid < 0) {
+        // Typically ENOMEM under strict overcommit; an in-process save is
+        // slower for writers but still gets the data out
+        std::cerr << "Snapshot fork failed (" << std::strerror(fork_errno)
+                  << "), saving in process instead" << std::endl;
+        reaper_ = std::thread([this, started] { save_in_process(started); });
+        return true;
+    }
+
+    reaper_ = std::thread([this, pid, expected_users, started] { reap(pid, expected_users, started); });
+    return true;
+}
+
+void SnapshotSaver::reap(pid_t pid, std::size_t expected_users, Clock::time_point started) {
+    SaverMetrics& m = saver_metrics();
+    int status = 0;
+    for (;;) {
+        pid_t done = ::waitpid(pid, &status, WNOHANG);
+        if (done == pid || (done < 0 && errno != EINTR)) {
+            break;
+        }
+        if (expected_users > 0) {
+            double ratio = static_cast<double>(progress_->written.load(std::memory_order_relaxed)) /
+                           static_cast<double>(expected_users);
+            m.progress.set(ratio < 1 ? ratio : 1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        std::uint64_t users = progress_->written.load(std::memory_order_relaxed);
+        record_success(users, started);
+        m.progress.set(1);
+        std::cout << "Background snapshot of " << users << " users saved to " << path_
+                  << " in " << seconds_since(started) << " s" << std::endl;
+    } else {
+        m.failed.add();
+        std::cerr << "Background snapshot to " << path_ << " failed" << std::endl;
+    }
+    m.in_progress.set(0);
+    running_.store(false, std::memory_order_release);
+}
+
+void SnapshotSaver::save_in_process(Clock::time_point started) {
+    SaverMetrics& m = saver_metrics();
+    try {
+        std::size_t users = store_->save_snapshot(path_);
+        record_success(users, started);
+        m.progress.set(1);
+    } catch (const std::exception& e) {
+        m.failed.add();
+        std::cerr << "Snapshot to " << path_ << " failed: " << e.what() << std::endl;
+    }
+    m.in_progress.set(0);
+    running_.store(false, std::memory_order_release);
+}
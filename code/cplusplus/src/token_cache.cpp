@@ -0,0 +1,98 @@
+#include "token_cache.hpp"
+#include "jwt.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace {
+    constexpr std::size_t kShardBits = 6;
+    constexpr std::size_t kShardCount = std::size_t{1} << kShardBits;
+
+    struct CacheMetrics {
+        metrics::Counter& hits = metrics::counter(
+            "auth_token_cache_hits_total", "Tokens served from the cache instead of being minted");
+        metrics::Counter& misses = metrics::counter(
+            "auth_token_cache_misses_total", "Tokens minted because the cache had none for that email and second");
+        metrics::Counter& invalidations = metrics::counter(
+            "auth_token_cache_invalidations_total", "Cached tokens dropped because their account was deleted");
+    };
+
+    CacheMetrics& cache_metrics() {
+        static CacheMetrics m;
+        return m;
+    }
+}
+
+TokenCache::TokenCache(std::size_t capacity)
+    : shards_(new Shard[kShardCount])
+{
+    std::size_t per_shard = 1;
+    while (per_shard * kShardCount < capacity) {
+        per_shard <<= 1;
+    }
+    slot_mask_ = per_shard - 1;
+    for (std::size_t i = 0; i < kShardCount; ++i) {
+        shards_[i].slots.resize(per_shard);
+    }
+    cache_metrics();
+}
+
+TokenCache::Slot& TokenCache::slot_for(std::string_view email, std::unique_lock<std::mutex>& lock) {
+    std::size_t hash = std::hash<std::string_view>{}(email);
+    Shard& shard = shards_[hash & (kShardCount - 1)];
+    lock = std::unique_lock<std::mutex>(shard.mutex);
+    return shard.slots[(hash >> kShardBits) & slot_mask_];
+}
+
+bool TokenCache::find(std::string_view email, std::int64_t iat, std::string& token) {
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    if (slot.iat != iat || slot.token.empty() || slot.email != email) {
+        lock.unlock();
+        cache_metrics().misses.add();
+        return false;
+    }
+    token = slot.token;
+    lock.unlock();
+    cache_metrics().hits.add();
+    return true;
+}
+
+void TokenCache::put(std::string_view email, std::int64_t iat, const std::string& token) {
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    // A slot only ever moves forward in time, so a slow minter cannot put
+    // back a token from a second that has already been replaced, nor one
+    // for an account deleted in this second
+    if (slot.iat > iat || (slot.iat == iat && slot.token.empty() && slot.email == email)) {
+        return;
+    }
+    slot.iat = iat;
+    slot.email.assign(email);
+    slot.token = token;
+}
+
+std::string TokenCache::mint(std::string_view email, std::int64_t iat) {
+    std::string token;
+    if (!find(email, iat, token)) {
+        token = JWT::create_at(email, iat);
+        put(email, iat, token);
+    }
+    return token;
+}
+
+void TokenCache::invalidate(std::string_view email) {
+    std::unique_lock<std::mutex> lock;
+    Slot& slot = slot_for(email, lock);
+    bool cached = slot.email == email && !slot.token.empty();
+    // Leaves a tombstone for the current second in place of the token, so
+    // a login that looked the account up just before the delete cannot
+    // cache its token again
+    slot.iat = std::max(slot.iat, JWT::current_second());
+    slot.email.assign(email);
+    slot.token.clear();
+    lock.unlock();
+    if (cached) {
+        cache_metrics().invalidations.add();
+    }
+}
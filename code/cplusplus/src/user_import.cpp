@@ -0,0 +1,465 @@
+#include "user_import.hpp"
+#include "crypto.hpp"
+#include "email_limits.hpp"
+#include "metrics.hpp"
+#include "password_hash.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+namespace {
+    constexpr char kMagic[8] = {'A', 'U', 'T', 'H', 'I', 'M', 'P', '\x01'};
+    constexpr unsigned char kDigestRecord = 1;
+    constexpr unsigned char kPasswordRecord = 2;
+
+    // Work is handed out in chunks of about this size, and parsed users go
+    // to the store in batches of kBatchSize
+    constexpr std::size_t kChunkSize = 1 << 20;
+    constexpr std::size_t kBatchSize = 4096;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct ImportMetrics {
+        metrics::Counter& imported = metrics::counter(
+            "auth_import_users_total{result=\"imported\"}", "Users processed by bulk imports, by outcome");
+        metrics::Counter& duplicates = metrics::counter(
+            "auth_import_users_total{result=\"duplicate\"}", "Users processed by bulk imports, by outcome");
+        metrics::Counter& invalid = metrics::counter(
+            "auth_import_users_total{result=\"invalid\"}", "Users processed by bulk imports, by outcome");
+    };
+
+    ImportMetrics& import_metrics() {
+        static ImportMetrics m;
+        return m;
+    }
+
+    std::uint32_t get_u32(const char* p) {
+        const auto* b = reinterpret_cast<const unsigned char*>(p);
+        return std::uint32_t{b[0]} | std::uint32_t{b[1]} << 8 | std::uint32_t{b[2]} << 16 |
+               std::uint32_t{b[3]} << 24;
+    }
+
+    // Size of the binary record at p, or 0 if it runs past end
+    std::size_t binary_record_size(const char* p, const char* end) {
+        std::size_t avail = static_cast<std::size_t>(end - p);
+        if (avail < 5) {
+            return 0;
+        }
+        std::size_t size = 5 + std::size_t{get_u32(p + 1)};
+        if (static_cast<unsigned char>(*p) == kPasswordRecord) {
+            if (avail < size + 4) {
+                return 0;
+            }
+            size += 4 + std::size_t{get_u32(p + size)};
+        } else {
+            size += crypto::kDigestSize;
+        }
+        return size <= avail ? size : 0;
+    }
+
+    // Chunk boundaries (offsets into data), always on record boundaries
+    std::vector<std::size_t> split(std::string_view data, user_import::Format format) {
+        std::vector<std::size_t> bounds;
+        if (format == user_import::Format::Ndjson) {
+            std::size_t at = 0;
+            while (at < data.size()) {
+                bounds.push_back(at);
+                std::size_t next = data.find('\n', std::min(at + kChunkSize, data.size()));
+                at = next == std::string_view::npos ? data.size() : next + 1;
+            }
+        } else {
+            // Length-prefixed records cannot be resynchronised mid-stream,
+            // so walk the framing once; it only reads the length fields
+            const char* begin = data.data();
+            const char* end = begin + data.size();
+            const char* p = begin + sizeof(kMagic);
+            const char* chunk_start = p;
+            bounds.push_back(p - begin);
+            while (p < end) {
+                std::size_t size = binary_record_size(p, end);
+                if (size == 0) {
+                    throw std::runtime_error("truncated import record at offset " +
+                                             std::to_string(p - begin));
+                }
+                p += size;
+                if (static_cast<std::size_t>(p - chunk_start) >= kChunkSize && p < end) {
+                    chunk_start = p;
+                    bounds.push_back(p - begin);
+                }
+            }
+        }
+        bounds.push_back(data.size());
+        return bounds;
+    }
+
+    struct Fields {
+        std::string email;
+        std::string password;
+        std::string digest_hex;
+        bool has_password = false;
+        bool has_digest = false;
+    };
+
+    // Slow path for lines the scanner below does not handle (escapes,
+    // non-string values, unusual whitespace)
+    bool parse_with_dom(std::string_view line, Fields& out) {
+        auto doc = nlohmann::json::parse(line, nullptr, false);
+        if (!doc.is_object()) {
+            return false;
+        }
+        auto get = [&doc](const char* key, std::string& value) {
+            auto it = doc.find(key);
+            if (it == doc.end() || !it->is_string()) {
+                return false;
+            }
+            value = it->get<std::string>();
+            return true;
+        };
+        if (!get("email", out.email)) {
+            return false;
+        }
+        out.has_password = get("password", out.password);
+        out.has_digest = get("digest", out.digest_hex);
+        return true;
+    }
+
+    // Flat scan of {"key":"value",...} with no escapes, which covers what
+    // exports normally contain without building a DOM per line
+    bool parse_line(std::string_view line, Fields& out) {
+        if (line.find('\\') != std::string_view::npos) {
+            return parse_with_dom(line, out);
+        }
+
+        std::size_t i = 0;
+        auto skip_ws = [&] {
+            while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) {
+                ++i;
+            }
+        };
+        auto read_string = [&](std::string_view& s) {
+            if (i >= line.size() || line[i] != '"') {
+                return false;
+            }
+            std::size_t close = line.find('"', i + 1);
+            if (close == std::string_view::npos) {
+                return false;
+            }
+            s = line.substr(i + 1, close - i - 1);
+            i = close + 1;
+            return true;
+        };
+
+        skip_ws();
+        if (i >= line.size() || line[i++] != '{') {
+            return false;
+        }
+        bool has_email = false;
+        for (;;) {
+            skip_ws();
+            std::string_view key, value;
+            if (!read_string(key)) {
+                return parse_with_dom(line, out);
+            }
+            skip_ws();
+            if (i >= line.size() || line[i++] != ':') {
+                return false;
+            }
+            skip_ws();
+            if (!read_string(value)) {
+                return parse_with_dom(line, out);
+            }
+            if (key == "email") {
+                out.email.assign(value);
+                has_email = true;
+            } else if (key == "password") {
+                out.password.assign(value);
+                out.has_password = true;
+            } else if (key == "digest") {
+                out.digest_hex.assign(value);
+                out.has_digest = true;
+            }
+            skip_ws();
+            if (i < line.size() && line[i] == ',') {
+                ++i;
+                continue;
+            }
+            if (i < line.size() && line[i] == '}') {
+                ++i;
+                skip_ws();
+                return i == line.size() && has_email;
+            }
+            return false;
+        }
+    }
+
+    class Importer {
+    public:
+        Importer(UserStore& store, std::string_view data, user_import::Format format)
+            : store_(store)
+            , data_(data)
+            , format_(format)
+            , bounds_(split(data, format))
+        {
+        }
+
+        user_import::Stats run(unsigned workers) {
+            auto started = Clock::now();
+            std::size_t chunks = bounds_.size() - 1;
+            // No point in more threads than chunks
+            workers = static_cast<unsigned>(std::clamp<std::size_t>(chunks, 1, workers));
+
+            running_ = workers;
+            std::vector<std::thread> threads;
+            threads.reserve(workers);
+            for (unsigned i = 0; i < workers; ++i) {
+                threads.emplace_back([this] { work(); });
+            }
+
+            // Progress report while the workers run
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!done_.wait_for(lock, std::chrono::seconds(1), [this] { return running_ == 0; })) {
+                    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+                    std::size_t imported = imported_.load(std::memory_order_relaxed);
+                    std::cout << "Import: " << imported << " users ("
+                              << chunks_done_.load(std::memory_order_relaxed) << "/" << chunks
+                              << " chunks, " << static_cast<std::uint64_t>(imported / elapsed)
+                              << " users/s)" << std::endl;
+                }
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+
+            user_import::Stats stats;
+            stats.imported = imported_.load();
+            stats.duplicates = duplicates_.load();
+            stats.invalid = invalid_.load();
+            stats.lsn = lsn_.load();
+            stats.seconds = std::chrono::duration<double>(Clock::now() - started).count();
+            return stats;
+        }
+
+    private:
+        void work() {
+            std::vector<UserStore::NewUser> batch;
+            batch.reserve(kBatchSize);
+            Fields fields;
+            std::exception_ptr error;
+            try {
+                for (;;) {
+                    std::size_t chunk = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk + 1 >= bounds_.size()) {
+                        break;
+                    }
+                    std::string_view data = data_.substr(bounds_[chunk], bounds_[chunk + 1] - bounds_[chunk]);
+                    if (format_ == user_import::Format::Ndjson) {
+                        parse_ndjson(data, fields, batch);
+                    } else {
+                        parse_binary(data, batch);
+                    }
+                    chunks_done_.fetch_add(1, std::memory_order_relaxed);
+                }
+                flush(batch);
+            } catch (...) {
+                // Hand out no more chunks; run() rethrows once all stop
+                next_chunk_.store(bounds_.size(), std::memory_order_relaxed);
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (error && !error_) {
+                error_ = error;
+            }
+            if (--running_ == 0) {
+                done_.notify_one();
+            }
+        }
+
+        void parse_ndjson(std::string_view data, Fields& fields, std::vector<UserStore::NewUser>& batch) {
+            while (!data.empty()) {
+                std::size_t eol = data.find('\n');
+                std::string_view line = data.substr(0, eol);
+                data.remove_prefix(eol == std::string_view::npos ? data.size() : eol + 1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                if (line.find_first_not_of(" \t") == std::string_view::npos) {
+                    continue;
+                }
+
+                fields.has_password = fields.has_digest = false;
+                UserStore::NewUser user;
+                bool ok = parse_line(line, fields) && email_limits::acceptable(fields.email);
+                if (ok && fields.has_digest) {
+                    crypto::Digest digest;
+                    ok = crypto::from_hex(fields.digest_hex, digest);
+                    user.credential = crypto::Credential::legacy(digest);
+                } else if (ok && fields.has_password) {
+                    user.credential = crypto::make_credential(fields.password);
+                } else {
+                    ok = false;
+                }
+                if (!ok) {
+                    invalid(1);
+                    continue;
+                }
+                user.email = std::move(fields.email);
+                add(std::move(user), batch);
+            }
+        }
+
+        void parse_binary(std::string_view data, std::vector<UserStore::NewUser>& batch) {
+            // split() has already checked that every record is complete
+            const char* p = data.data();
+            const char* end = p + data.size();
+            while (p < end) {
+                std::size_t size = binary_record_size(p, end);
+                auto kind = static_cast<unsigned char>(*p);
+                std::uint32_t email_size = get_u32(p + 1);
+                const char* rest = p + 5 + email_size;
+
+                UserStore::NewUser user;
+                bool ok = email_limits::acceptable(std::string_view(p + 5, email_size));
+                if (ok) {
+                    user.email.assign(p + 5, email_size);
+                }
+                if (ok && kind == kDigestRecord) {
+                    crypto::Digest digest;
+                    std::memcpy(digest.data(), rest, crypto::kDigestSize);
+                    user.credential = crypto::Credential::legacy(digest);
+                } else if (ok && kind == kPasswordRecord) {
+                    user.credential = crypto::make_credential(std::string_view(rest + 4, get_u32(rest)));
+                } else {
+                    ok = false;
+                }
+                p += size;
+
+                if (!ok) {
+                    invalid(1);
+                    continue;
+                }
+                add(std::move(user), batch);
+            }
+        }
+
+        void add(UserStore::NewUser user, std::vector<UserStore::NewUser>& batch) {
+            batch.push_back(std::move(user));
+            if (batch.size() >= kBatchSize) {
+                flush(batch);
+            }
+        }
+
+        void flush(std::vector<UserStore::NewUser>& batch) {
+            if (batch.empty()) {
+                return;
+            }
+            std::size_t duplicates = 0;
+            std::uint64_t lsn = 0;
+            std::size_t added = store_.add_users(batch, &duplicates, &lsn);
+            batch.clear();
+
+            imported_.fetch_add(added, std::memory_order_relaxed);
+            duplicates_.fetch_add(duplicates, std::memory_order_relaxed);
+            import_metrics().imported.add(added);
+            import_metrics().duplicates.add(duplicates);
+
+            std::uint64_t seen = lsn_.load(std::memory_order_relaxed);
+            while (lsn > seen && !lsn_.compare_exchange_weak(seen, lsn, std::memory_order_relaxed)) {
+            }
+        }
+
+        void invalid(std::size_t n) {
+            invalid_.fetch_add(n, std::memory_order_relaxed);
+            import_metrics().invalid.add(n);
+        }
+
+        UserStore& store_;
+        std::string_view data_;
+        user_import::Format format_;
+        std::vector<std::size_t> bounds_;
+
+        std::atomic<std::size_t> next_chunk_{0};
+        std::atomic<std::size_t> chunks_done_{0};
+        std::atomic<std::size_t> imported_{0};
+        std::atomic<std::size_t> duplicates_{0};
+        std::atomic<std::size_t> invalid_{0};
+        std::atomic<std::uint64_t> lsn_{0};
+
+        std::mutex mutex_;
+        std::condition_variable done_;
+        unsigned running_ = 0;
+        // First error a worker hit, guarded by mutex_
+        std::exception_ptr error_;
+    };
+}
+
+namespace user_import {
+    Format detect_format(std::string_view data) {
+        if (data.size() >= sizeof(kMagic) && std::memcmp(data.data(), kMagic, sizeof(kMagic)) == 0) {
+            return Format::Binary;
+        }
+        return Format::Ndjson;
+    }
+
+    Stats run(UserStore& store, std::string_view data, unsigned workers) {
+        if (workers == 0) {
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        return Importer(store, data, detect_format(data)).run(workers);
+    }
+
+    Stats run_file(UserStore& store, const std::string& path, unsigned workers) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + path);
+        }
+        auto size = static_cast<std::size_t>(st.st_size);
+        if (size == 0) {
+            ::close(fd);
+            return Stats{};
+        }
+
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            throw std::system_error(err, std::generic_category(), "mmap " + path);
+        }
+        // Each chunk is read once from front to back
+        ::madvise(map, size, MADV_SEQUENTIAL);
+
+        try {
+            Stats stats = run(store, std::string_view(static_cast<const char*>(map), size), workers);
+            ::munmap(map, size);
+            return stats;
+        } catch (...) {
+            ::munmap(map, size);
+            throw;
+        }
+    }
+}
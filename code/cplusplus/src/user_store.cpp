@@ -1,29 +1,507 @@
 #include "user_store.hpp"
 #include "crypto.hpp"
+#include "email_limits.hpp"
+#include "epoch.hpp"
+#include "password_hash.hpp"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
 
-bool UserStore::add_user(const std::string& email, const std::string& password) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (users_.find(email) != users_.end()) {
+namespace {
+    constexpr std::size_t kInitialCapacity = 16;
+
+    // Slots of the previous generation examined per write while a shard
+    // is being resized. Each write also adds at most one entry, so the old
+    // table is always drained long before the new one fills up.
+    constexpr std::size_t kMigrateBudget = 64;
+
+    std::size_t round_up_pow2(std::size_t n) {
+        std::size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    std::size_t hash_email(const std::string& email) {
+        return std::hash<std::string>{}(email);
+    }
+
+    // Marks the shard as being written for the lifetime of the object.
+    // Only called with the shard's write mutex held, so plain loads and
+    // stores of the counter are enough.
+    class WriteSection {
+    public:
+        explicit WriteSection(std::atomic<std::uint64_t>& seq) : seq_(seq) {
+            seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        ~WriteSection() {
+            seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<std::uint64_t>& seq_;
+    };
+}
+
+UserStore::UserStore(std::size_t shard_count) {
+    if (shard_count == 0) {
+        // A few shards per thread keeps the odds of two writers landing on
+        // the same shard low without wasting memory on idle partitions
+        shard_count = std::max<std::size_t>(64, std::thread::hardware_concurrency() * 4);
+    }
+    shard_count = round_up_pow2(shard_count);
+    shards_ = std::make_unique<Shard[]>(shard_count);
+    shard_mask_ = shard_count - 1;
+
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        shards_[i].table.store(new FlatUserTable(kInitialCapacity), std::memory_order_relaxed);
+    }
+}
+
+UserStore::~UserStore() {
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        for (FlatUserTable* table : {shards_[i].table.load(std::memory_order_relaxed),
+                                     shards_[i].previous.load(std::memory_order_relaxed)}) {
+            if (!table) {
+                continue;
+            }
+            table->for_each([](const FlatUserTable::EmailKey* key, const crypto::Credential&) {
+                FlatUserTable::EmailKey::destroy(const_cast<FlatUserTable::EmailKey*>(key));
+            });
+            delete table;
+        }
+    }
+}
+
+std::size_t UserStore::shard_index(std::size_t hash) const {
+    // Tables use the low bits of the hash for the home slot and the top
+    // seven for control bytes, so pick the shard from the middle of a
+    // multiplicative mix
+    std::uint64_t h = static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+    return (h >> 32) & shard_mask_;
+}
+
+UserStore::Shard& UserStore::shard_for(std::size_t hash) {
+    return shards_[shard_index(hash)];
+}
+
+// Seqlock read: the table may be mutated while we probe it, so retry until
+// a probe completes without any writer having entered the shard. Callers
+// hold an epoch::Guard, which keeps any key we dereference alive.
+const FlatUserTable::EmailKey* UserStore::find(Shard& shard, std::size_t hash, const std::string& email,
+                                               crypto::Credential* credential) {
+    for (;;) {
+        std::uint64_t before = shard.seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        const FlatUserTable* table = shard.table.load(std::memory_order_acquire);
+        const FlatUserTable* previous = shard.previous.load(std::memory_order_acquire);
+        const FlatUserTable::EmailKey* key = table->find(hash, email, credential);
+        if (!key && previous) {
+            key = previous->find(hash, email, credential);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shard.seq.load(std::memory_order_relaxed) == before) {
+            return key;
+        }
+    }
+}
+
+// Writer side; the caller holds the shard's write mutex
+const FlatUserTable::EmailKey* UserStore::find_locked(Shard& shard, std::size_t hash,
+                                                      const std::string& email) {
+    const FlatUserTable::EmailKey* key =
+        shard.table.load(std::memory_order_relaxed)->find(hash, email, nullptr);
+    FlatUserTable* previous = shard.previous.load(std::memory_order_relaxed);
+    if (!key && previous) {
+        key = previous->find(hash, email, nullptr);
+    }
+    return key;
+}
+
+// Writer side, inside a WriteSection; returns the removed key for retiring
+const FlatUserTable::EmailKey* UserStore::erase_locked(Shard& shard, std::size_t hash,
+                                                       const std::string& email) {
+    const FlatUserTable::EmailKey* removed =
+        shard.table.load(std::memory_order_relaxed)->erase(hash, email);
+    FlatUserTable* previous = shard.previous.load(std::memory_order_relaxed);
+    if (!removed && previous) {
+        removed = previous->erase(hash, email);
+    }
+    return removed;
+}
+
+// Makes sure one more entry fits in the current generation. Entries still
+// waiting in the previous generation will land there too, so they count
+// against its capacity.
+void UserStore::make_room(Shard& shard) {
+    FlatUserTable* table = shard.table.load(std::memory_order_relaxed);
+    FlatUserTable* previous = shard.previous.load(std::memory_order_relaxed);
+    if (table->size() + (previous ? previous->size() : 0) >= table->max_size()) {
+        grow(shard, table->capacity() * 2);
+    }
+}
+
+// Starts a new generation of the given capacity. Allocating it does not
+// touch the live tables, so readers carry on undisturbed; the entries move
+// over a few at a time in migrate().
+void UserStore::grow(Shard& shard, std::size_t capacity) {
+    // Only two generations at a time; finish the running resize first
+    finish_migration(shard);
+
+    auto* new_table = new FlatUserTable(capacity);
+    WriteSection write(shard.seq);
+    shard.previous.store(shard.table.load(std::memory_order_relaxed), std::memory_order_release);
+    shard.table.store(new_table, std::memory_order_release);
+    shard.migrate_cursor = 0;
+}
+
+void UserStore::migrate(Shard& shard, std::size_t budget) {
+    FlatUserTable* previous = shard.previous.load(std::memory_order_relaxed);
+    if (!previous) {
+        return;
+    }
+
+    bool drained;
+    {
+        WriteSection write(shard.seq);
+        drained = previous->drain_into(*shard.table.load(std::memory_order_relaxed),
+                                       &shard.migrate_cursor, budget);
+        if (drained) {
+            shard.previous.store(nullptr, std::memory_order_release);
+        }
+    }
+    if (drained) {
+        epoch::retire(previous);
+    }
+}
+
+// Drains the previous generation in bounded steps so readers can still
+// get through between them
+void UserStore::finish_migration(Shard& shard) {
+    while (shard.previous.load(std::memory_order_relaxed)) {
+        migrate(shard, kMigrateBudget);
+    }
+}
+
+void UserStore::reserve(std::size_t users) {
+    // Leave headroom for shards that end up with more than their share
+    std::size_t per_shard = users / shard_count();
+    per_shard += per_shard / 16 + 16;
+    std::size_t capacity = FlatUserTable::capacity_for(per_shard);
+
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        Shard& shard = shards_[i];
+        std::lock_guard<std::mutex> lock(shard.write_mutex);
+        if (shard.table.load(std::memory_order_relaxed)->capacity() < capacity) {
+            grow(shard, capacity);
+            finish_migration(shard);
+        }
+    }
+}
+
+bool UserStore::add_user(const std::string& email, const std::string& password,
+                         std::uint64_t* lsn) {
+    if (!email_limits::acceptable(email)) {
+        throw std::length_error("email is empty or too long");
+    }
+    // The credential may take a KDF to derive, so do not derive one for
+    // an email that is already taken. insert checks again under the lock.
+    crypto::Credential existing;
+    if (lookup_credential(email, existing)) {
+        return false;
+    }
+    return insert(email, crypto::make_credential(password), false, lsn);
+}
+
+void UserStore::restore_user(const std::string& email, const crypto::Credential& credential) {
+    insert(email, credential, true, nullptr);
+}
+
+bool UserStore::insert(const std::string& email, const crypto::Credential& credential, bool replace,
+                       std::uint64_t* lsn) {
+    std::size_t hash = hash_email(email);
+
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    return insert_locked(shard, hash, email, credential, replace, lsn);
+}
+
+std::size_t UserStore::add_users(const std::vector<NewUser>& users, std::size_t* duplicates,
+                                 std::uint64_t* lsn) {
+    for (const NewUser& user : users) {
+        if (!email_limits::acceptable(user.email)) {
+            throw std::length_error("email is empty or too long");
+        }
+    }
+
+    // Bucket the batch by shard so each shard lock is taken once
+    std::vector<std::size_t> hashes(users.size());
+    std::vector<std::size_t> starts(shard_count() + 1, 0);
+    for (std::size_t i = 0; i < users.size(); ++i) {
+        hashes[i] = hash_email(users[i].email);
+        ++starts[shard_index(hashes[i]) + 1];
+    }
+    for (std::size_t s = 0; s < shard_count(); ++s) {
+        starts[s + 1] += starts[s];
+    }
+    std::vector<std::size_t> order(users.size());
+    {
+        std::vector<std::size_t> next(starts.begin(), starts.end() - 1);
+        for (std::size_t i = 0; i < users.size(); ++i) {
+            order[next[shard_index(hashes[i])]++] = i;
+        }
+    }
+
+    std::size_t added = 0;
+    std::uint64_t last = 0;
+    for (std::size_t s = 0; s < shard_count(); ++s) {
+        if (starts[s] == starts[s + 1]) {
+            continue;
+        }
+        Shard& shard = shards_[s];
+        std::lock_guard<std::mutex> lock(shard.write_mutex);
+        for (std::size_t j = starts[s]; j < starts[s + 1]; ++j) {
+            const NewUser& user = users[order[j]];
+            std::uint64_t at = 0;
+            if (insert_locked(shard, hashes[order[j]], user.email, user.credential, false, &at)) {
+                ++added;
+                last = std::max(last, at);
+            }
+        }
+    }
+
+    if (duplicates) {
+        *duplicates = users.size() - added;
+    }
+    if (lsn) {
+        *lsn = last;
+    }
+    return added;
+}
+
+bool UserStore::insert_locked(Shard& shard, std::size_t hash, const std::string& email,
+                              const crypto::Credential& credential, bool replace, std::uint64_t* lsn) {
+    // An erased key hides a snapshot user, so it counts as absent here
+    const FlatUserTable::EmailKey* existing = find_locked(shard, hash, email);
+    bool exists = existing ? !existing->erased : (base_ && base_->find(email, nullptr));
+    if (exists && !replace) {
         return false;
     }
-    
-    users_[email] = crypto::hash_password(password);
+
+    make_room(shard);
+    const FlatUserTable::EmailKey* key = FlatUserTable::EmailKey::create(hash, email);
+    const FlatUserTable::EmailKey* removed = nullptr;
+    {
+        WriteSection write(shard.seq);
+        if (existing) {
+            removed = erase_locked(shard, hash, email);
+        }
+        shard.table.load(std::memory_order_relaxed)->insert(key, credential);
+    }
+    if (log_) {
+        std::uint64_t at = log_->log_add(email, credential);
+        if (lsn) {
+            *lsn = at;
+        }
+    }
+    migrate(shard, kMigrateBudget);
+
+    if (removed) {
+        epoch::retire(const_cast<FlatUserTable::EmailKey*>(removed), &FlatUserTable::EmailKey::destroy);
+    }
     return true;
 }
 
 bool UserStore::authenticate_user(const std::string& email, const std::string& password) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = users_.find(email);
-    if (it == users_.end()) {
+    // The stored credential is a private copy, so hashing runs outside
+    // the epoch guard and holds nothing back from reclamation
+    crypto::Credential stored;
+    return lookup_credential(email, stored) && crypto::verify_credential(password, stored);
+}
+
+bool UserStore::lookup_credential(const std::string& email, crypto::Credential& credential) {
+    std::size_t hash = hash_email(email);
+    Shard& shard = shard_for(hash);
+
+    epoch::Guard guard;
+    const FlatUserTable::EmailKey* key = find(shard, hash, email, &credential);
+    return key ? !key->erased : base_ && base_->find(email, &credential);
+}
+
+bool UserStore::delete_user(const std::string& email, std::uint64_t* lsn) {
+    std::size_t hash = hash_email(email);
+
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+
+    const FlatUserTable::EmailKey* existing = find_locked(shard, hash, email);
+    bool in_base = base_ && base_->find(email, nullptr);
+    if (existing ? existing->erased : !in_base) {
         return false;
     }
-    
-    return crypto::verify_password(password, it->second);
+
+    // A snapshot user stays hidden behind an erased key; anyone else can
+    // simply be removed
+    const FlatUserTable::EmailKey* marker = nullptr;
+    if (in_base) {
+        make_room(shard);
+        marker = FlatUserTable::EmailKey::create(hash, email, true);
+    }
+
+    const FlatUserTable::EmailKey* removed = nullptr;
+    {
+        WriteSection write(shard.seq);
+        if (existing) {
+            removed = erase_locked(shard, hash, email);
+        }
+        if (marker) {
+            shard.table.load(std::memory_order_relaxed)->insert(marker, crypto::Credential{});
+        }
+    }
+    if (log_) {
+        std::uint64_t at = log_->log_delete(email);
+        if (lsn) {
+            *lsn = at;
+        }
+    }
+    migrate(shard, kMigrateBudget);
+
+    if (removed) {
+        epoch::retire(const_cast<FlatUserTable::EmailKey*>(removed), &FlatUserTable::EmailKey::destroy);
+    }
+    return true;
+}
+
+void UserStore::log_revocation(std::string_view email, std::int64_t revoked_through, std::uint64_t* lsn) {
+    if (log_) {
+        *lsn = log_->log_revoke(email, revoked_through);
+    }
+}
+
+void UserStore::when_durable(std::uint64_t lsn, std::function<void()> done) {
+    if (!log_ || lsn == 0) {
+        done();
+        return;
+    }
+    log_->when_durable(lsn, std::move(done));
+}
+
+std::size_t UserStore::save_snapshot(const std::string& path) {
+    std::uint64_t wal_lsn = log_position();
+    SnapshotWriter writer(path);
+    write_users(writer, true, nullptr);
+    writer.commit(wal_lsn);
+    return writer.user_count();
+}
+
+void UserStore::pause_writers(const std::function<void()>& f) {
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        shards_[i].write_mutex.lock();
+    }
+    try {
+        f();
+    } catch (...) {
+        for (std::size_t i = 0; i <= shard_mask_; ++i) {
+            shards_[i].write_mutex.unlock();
+        }
+        throw;
+    }
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        shards_[i].write_mutex.unlock();
+    }
+}
+
+std::size_t UserStore::write_frozen_snapshot(SnapshotWriter& writer,
+                                             std::atomic<std::uint64_t>* progress) {
+    write_users(writer, false, progress);
+    return writer.user_count();
+}
+
+std::uint64_t UserStore::log_position() const {
+    return log_ ? log_->appended_lsn() : 0;
+}
+
+std::size_t UserStore::approximate_size() const {
+    std::size_t total = base_ ? base_->user_count() : 0;
+    // A resize may retire either table while we read its size
+    epoch::Guard guard;
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        const FlatUserTable* table = shards_[i].table.load(std::memory_order_acquire);
+        const FlatUserTable* previous = shards_[i].previous.load(std::memory_order_acquire);
+        total += table->size() + (previous ? previous->size() : 0);
+    }
+    return total;
 }
 
-bool UserStore::delete_user(const std::string& email) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return users_.erase(email) > 0;
+// Shards first, then whatever is still current in the base snapshot.
+// lock_shards is false only when nothing can modify the store, in which
+// case the shard mutexes may well be held by the caller.
+void UserStore::write_users(SnapshotWriter& writer, bool lock_shards,
+                            std::atomic<std::uint64_t>* progress) {
+    auto report = [&writer, progress] {
+        if (progress && writer.user_count() % 4096 == 0) {
+            progress->store(writer.user_count(), std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::pair<const FlatUserTable::EmailKey*, crypto::Credential>> batch;
+    for (std::size_t i = 0; i <= shard_mask_; ++i) {
+        Shard& shard = shards_[i];
+        batch.clear();
+
+        // Keys copied out of the shard stay valid until we have written
+        // them, even if they are erased in the meantime
+        epoch::Guard guard;
+        {
+            std::unique_lock<std::mutex> lock(shard.write_mutex, std::defer_lock);
+            if (lock_shards) {
+                lock.lock();
+            }
+            for (FlatUserTable* table : {shard.table.load(std::memory_order_relaxed),
+                                         shard.previous.load(std::memory_order_relaxed)}) {
+                if (!table) {
+                    continue;
+                }
+                table->for_each([&batch](const FlatUserTable::EmailKey* key,
+                                         const crypto::Credential& credential) {
+                    if (!key->erased) {
+                        batch.emplace_back(key, credential);
+                    }
+                });
+            }
+        }
+        for (const auto& entry : batch) {
+            writer.add(entry.first->view(), entry.second);
+            report();
+        }
+    }
+
+    // Base users are only still current if no shard holds a newer version
+    // or an erased key for them
+    if (base_) {
+        std::string email;
+        base_->for_each([&](std::string_view base_email, const crypto::Credential& credential) {
+            email.assign(base_email);
+            std::size_t hash = hash_email(email);
+            epoch::Guard guard;
+            if (!find(shard_for(hash), hash, email, nullptr)) {
+                writer.add(base_email, credential);
+                report();
+            }
+        });
+    }
+
+    if (progress) {
+        progress->store(writer.user_count(), std::memory_order_relaxed);
+    }
 }
@@ -0,0 +1,422 @@
+#include "wal.hpp"
+#include "crc32c.hpp"
+#include "email_limits.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr char kMagic[8] = {'A', 'U', 'T', 'H', 'W', 'A', 'L', 1};
+
+    // crc32c + type + email length
+    constexpr std::size_t kRecordHeaderSize = 4 + 1 + 4;
+    // On-disk type bytes. Adds are written with a full credential; logs
+    // from before credentials carry a bare HMAC digest and still replay.
+    constexpr char kTypeAddDigest = 1;
+    constexpr char kTypeDelete = 2;
+    constexpr char kTypeAddCredential = 3;
+    constexpr char kTypeRevoke = 4;
+    constexpr std::size_t kRevokePayloadSize = 8;
+    // Replay treats anything longer as corruption rather than allocating
+    // it. Far above what appends accept, so older logs still replay.
+    constexpr std::uint32_t kMaxReplayEmailSize = 1 << 20;
+    static_assert(email_limits::kMaxEmailSize <= kMaxReplayEmailSize,
+                  "every email that can be logged must replay");
+    // The flusher stops waiting for stragglers once a batch is this big
+    constexpr std::size_t kMaxBatchBytes = 1 << 20;
+
+    void put_u32(char* p, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) {
+            p[i] = static_cast<char>(v >> (8 * i));
+        }
+    }
+
+    std::uint32_t get_u32(const char* p) {
+        std::uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        }
+        return v;
+    }
+
+    std::system_error os_error(const std::string& what) {
+        return std::system_error(errno, std::generic_category(), what);
+    }
+
+    // A durability promise we cannot keep is not recoverable
+    [[noreturn]] void fatal(const char* what) {
+        std::cerr << "WAL " << what << " failed: " << std::strerror(errno) << std::endl;
+        std::abort();
+    }
+
+    void write_all(int fd, const char* data, std::size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fatal("write");
+            }
+            data += n;
+            len -= static_cast<std::size_t>(n);
+        }
+    }
+
+    void sync_parent_dir(const std::string& path) {
+        auto slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+}
+
+WriteAheadLog::WriteAheadLog(Options options)
+    : options_(std::move(options))
+{
+    fd_ = ::open(options_.path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        throw os_error("open " + options_.path);
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        ::close(fd_);
+        throw os_error("stat " + options_.path);
+    }
+
+    if (st.st_size == 0) {
+        write_all(fd_, kMagic, sizeof(kMagic));
+        if (::fdatasync(fd_) != 0) {
+            fatal("fdatasync");
+        }
+        sync_parent_dir(options_.path);
+        st.st_size = sizeof(kMagic);
+    }
+
+    appended_lsn_ = durable_lsn_ = static_cast<std::uint64_t>(st.st_size);
+
+    if (options_.durability != Durability::Sync) {
+        flusher_ = std::thread([this] { run_flusher(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    pending_cv_.notify_all();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+    flush();
+    ::close(fd_);
+}
+
+bool WriteAheadLog::parse_durability(std::string_view name, Durability& out) {
+    if (name == "sync") {
+        out = Durability::Sync;
+    } else if (name == "group") {
+        out = Durability::Group;
+    } else if (name == "async") {
+        out = Durability::Async;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::size_t WriteAheadLog::replay(const std::string& path,
+                                  const std::function<void(const Record&)>& apply,
+                                  std::uint64_t from_lsn) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        throw os_error("open " + path);
+    }
+
+    std::vector<char> buf(1 << 20);
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    bool eof = false;
+
+    // Makes sure at least `want` unparsed bytes are buffered, unless the
+    // file ends first
+    auto fill = [&](std::size_t want) {
+        if (end - begin >= want || eof) {
+            return end - begin >= want;
+        }
+        std::memmove(buf.data(), buf.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+        if (buf.size() < want) {
+            buf.resize(want);
+        }
+        while (end < want && !eof) {
+            ssize_t n = ::read(fd, buf.data() + end, buf.size() - end);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ::close(fd);
+                throw os_error("read " + path);
+            }
+            if (n == 0) {
+                eof = true;
+            }
+            end += static_cast<std::size_t>(n);
+        }
+        return end - begin >= want;
+    };
+
+    if (!fill(sizeof(kMagic))) {
+        // Crashed before the header was durable; start over
+        ::ftruncate(fd, 0);
+        ::close(fd);
+        return 0;
+    }
+    if (std::memcmp(buf.data(), kMagic, sizeof(kMagic)) != 0) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a write-ahead log");
+    }
+    begin += sizeof(kMagic);
+
+    std::uint64_t good_offset = sizeof(kMagic);
+    if (from_lsn > good_offset) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::uint64_t>(st.st_size) < from_lsn) {
+            ::close(fd);
+            throw std::runtime_error(path + " is shorter than the snapshot it continues");
+        }
+        if (::lseek(fd, static_cast<off_t>(from_lsn), SEEK_SET) < 0) {
+            ::close(fd);
+            throw os_error("seek " + path);
+        }
+        begin = end = 0;
+        eof = false;
+        good_offset = from_lsn;
+    }
+    std::size_t count = 0;
+
+    while (fill(kRecordHeaderSize)) {
+        const char* p = buf.data() + begin;
+        char type = p[4];
+        std::uint32_t email_size = get_u32(p + 5);
+        std::size_t payload_size;
+        if (type == kTypeAddDigest) {
+            payload_size = crypto::kDigestSize;
+        } else if (type == kTypeAddCredential) {
+            payload_size = crypto::kCredentialSize;
+        } else if (type == kTypeDelete) {
+            payload_size = 0;
+        } else if (type == kTypeRevoke) {
+            payload_size = kRevokePayloadSize;
+        } else {
+            break;
+        }
+        if (email_size > kMaxReplayEmailSize) {
+            break;
+        }
+
+        std::size_t size = kRecordHeaderSize + email_size + payload_size;
+        if (!fill(size)) {
+            break;
+        }
+        p = buf.data() + begin;
+        if (crc32c(p + 4, size - 4) != get_u32(p)) {
+            break;
+        }
+
+        const auto* payload = reinterpret_cast<const unsigned char*>(p + kRecordHeaderSize + email_size);
+        Record record{type == kTypeDelete   ? RecordType::DeleteUser
+                      : type == kTypeRevoke ? RecordType::RevokeTokens
+                                            : RecordType::AddUser,
+                      std::string_view(p + kRecordHeaderSize, email_size), {}};
+        if (type == kTypeRevoke) {
+            const char* at = p + kRecordHeaderSize + email_size;
+            std::uint64_t through = get_u32(at) | std::uint64_t{get_u32(at + 4)} << 32;
+            record.revoked_through = static_cast<std::int64_t>(through);
+        } else if (type == kTypeAddDigest) {
+            crypto::Digest digest;
+            std::memcpy(digest.data(), payload, crypto::kDigestSize);
+            record.credential = crypto::Credential::legacy(digest);
+        } else if (type == kTypeAddCredential && !crypto::decode_credential(payload, record.credential)) {
+            // Intact but written by a newer build; refuse rather than cut
+            // it off as a torn tail
+            ::close(fd);
+            throw std::runtime_error("WAL " + path + ": unknown password scheme at offset " +
+                                     std::to_string(good_offset));
+        }
+        apply(record);
+
+        begin += size;
+        good_offset += size;
+        ++count;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<std::uint64_t>(st.st_size) > good_offset) {
+        std::cerr << "WAL " << path << ": discarding " << (st.st_size - good_offset)
+                  << " bytes of torn or corrupt tail" << std::endl;
+        if (::ftruncate(fd, static_cast<off_t>(good_offset)) != 0 || ::fsync(fd) != 0) {
+            ::close(fd);
+            throw os_error("truncate " + path);
+        }
+    }
+    ::close(fd);
+    return count;
+}
+
+std::uint64_t WriteAheadLog::log_add(std::string_view email, const crypto::Credential& credential) {
+    return append(RecordType::AddUser, email, &credential);
+}
+
+std::uint64_t WriteAheadLog::log_delete(std::string_view email) {
+    return append(RecordType::DeleteUser, email, nullptr);
+}
+
+std::uint64_t WriteAheadLog::log_revoke(std::string_view email, std::int64_t revoked_through) {
+    return append(RecordType::RevokeTokens, email, nullptr, revoked_through);
+}
+
+std::uint64_t WriteAheadLog::append(RecordType type, std::string_view email,
+                                    const crypto::Credential* credential, std::int64_t revoked_through) {
+    // UserStore checks first; this keeps a record replay would cut off
+    // out of the log. Deletes and revocations name stored users, which
+    // may predate the limit but are still within what replay reads.
+    if (email.size() > (type == RecordType::AddUser ? email_limits::kMaxEmailSize : kMaxReplayEmailSize)) {
+        throw std::length_error("email too long for the write-ahead log");
+    }
+    std::size_t payload_size = type == RecordType::AddUser        ? crypto::kCredentialSize
+                               : type == RecordType::RevokeTokens ? kRevokePayloadSize
+                                                                  : 0;
+    std::size_t size = kRecordHeaderSize + email.size() + payload_size;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool was_empty = pending_.empty();
+    std::size_t at = pending_.size();
+    pending_.resize(at + size);
+
+    char* p = pending_.data() + at;
+    p[4] = type == RecordType::AddUser        ? kTypeAddCredential
+           : type == RecordType::RevokeTokens ? kTypeRevoke
+                                              : kTypeDelete;
+    put_u32(p + 5, static_cast<std::uint32_t>(email.size()));
+    std::memcpy(p + kRecordHeaderSize, email.data(), email.size());
+    char* payload = p + kRecordHeaderSize + email.size();
+    if (type == RecordType::AddUser) {
+        crypto::encode_credential(*credential, reinterpret_cast<unsigned char*>(payload));
+    } else if (type == RecordType::RevokeTokens) {
+        auto through = static_cast<std::uint64_t>(revoked_through);
+        put_u32(payload, static_cast<std::uint32_t>(through));
+        put_u32(payload + 4, static_cast<std::uint32_t>(through >> 32));
+    }
+    put_u32(p, crc32c(p + 4, size - 4));
+
+    appended_lsn_ += size;
+    std::uint64_t lsn = appended_lsn_;
+    bool wake = was_empty || pending_.size() >= kMaxBatchBytes;
+    lock.unlock();
+
+    if (wake) {
+        pending_cv_.notify_one();
+    }
+    return lsn;
+}
+
+std::uint64_t WriteAheadLog::appended_lsn() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appended_lsn_;
+}
+
+void WriteAheadLog::when_durable(std::uint64_t lsn, std::function<void()> done) {
+    if (options_.durability == Durability::Async) {
+        done();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (lsn <= durable_lsn_) {
+            lock.unlock();
+            done();
+            return;
+        }
+        if (options_.durability == Durability::Group) {
+            waiters_.emplace_back(lsn, std::move(done));
+            return;
+        }
+    }
+
+    // Sync mode: the caller pays for its own fdatasync. If another flush
+    // already picked up lsn, this waits for it and finds nothing to write.
+    flush();
+    done();
+}
+
+void WriteAheadLog::flush() {
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+
+    std::vector<char> batch;
+    std::uint64_t batch_end;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return;
+        }
+        batch.swap(pending_);
+        batch_end = appended_lsn_;
+    }
+
+    write_all(fd_, batch.data(), batch.size());
+    if (::fdatasync(fd_) != 0) {
+        fatal("fdatasync");
+    }
+
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        durable_lsn_ = batch_end;
+        auto keep = waiters_.begin();
+        for (auto& waiter : waiters_) {
+            if (waiter.first <= batch_end) {
+                ready.push_back(std::move(waiter.second));
+            } else {
+                *keep++ = std::move(waiter);
+            }
+        }
+        waiters_.erase(keep, waiters_.end());
+    }
+
+    for (auto& done : ready) {
+        done();
+    }
+}
+
+void WriteAheadLog::run_flusher() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        pending_cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+
+        // Give concurrent writers a chance to join this batch
+        pending_cv_.wait_for(lock, options_.group_delay, [this] {
+            return stopping_ || pending_.size() >= kMaxBatchBytes;
+        });
+
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
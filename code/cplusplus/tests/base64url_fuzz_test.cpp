@@ -0,0 +1,163 @@
+#include "check.hpp"
+#include "base64url.hpp"
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+// base64url against the byte-at-a-time codec JWT used to have, on random
+// inputs of every length up to a few hundred bytes. The AVX2 kernel hands
+// what is left of its input to the SSSE3 one and that to the scalar tail,
+// so varying the length covers all three on a machine with AVX2.
+
+namespace {
+    const std::string kAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+    // The old JWT::base64_encode
+    std::string reference_encode(const std::string& input) {
+        std::string ret;
+        unsigned char group[3];
+        int i = 0;
+        for (unsigned char c : input) {
+            group[i++] = c;
+            if (i == 3) {
+                ret += kAlphabet[group[0] >> 2];
+                ret += kAlphabet[(group[0] & 0x03) << 4 | group[1] >> 4];
+                ret += kAlphabet[(group[1] & 0x0f) << 2 | group[2] >> 6];
+                ret += kAlphabet[group[2] & 0x3f];
+                i = 0;
+            }
+        }
+        if (i) {
+            for (int j = i; j < 3; ++j) {
+                group[j] = 0;
+            }
+            unsigned char chars[3] = {
+                static_cast<unsigned char>(group[0] >> 2),
+                static_cast<unsigned char>((group[0] & 0x03) << 4 | group[1] >> 4),
+                static_cast<unsigned char>((group[1] & 0x0f) << 2 | group[2] >> 6),
+            };
+            for (int j = 0; j < i + 1; ++j) {
+                ret += kAlphabet[chars[j]];
+            }
+        }
+        return ret;
+    }
+
+    // Reads like the old JWT::base64_decode, which stopped at the first
+    // character outside the alphabet
+    std::string reference_decode(const std::string& encoded) {
+        std::string ret;
+        std::uint32_t bits = 0;
+        int count = 0;
+        for (char c : encoded) {
+            std::size_t value = kAlphabet.find(c);
+            if (value == std::string::npos) {
+                break;
+            }
+            bits = bits << 6 | static_cast<std::uint32_t>(value);
+            count += 6;
+            if (count >= 8) {
+                count -= 8;
+                ret += static_cast<char>(bits >> count & 0xff);
+            }
+        }
+        return ret;
+    }
+
+    // What the new decoder accepts: only alphabet characters, no length
+    // that leaves a lone character, and zero bits past the last byte
+    bool canonical(const std::string& encoded) {
+        if (encoded.size() % 4 == 1) {
+            return false;
+        }
+        for (char c : encoded) {
+            if (kAlphabet.find(c) == std::string::npos) {
+                return false;
+            }
+        }
+        std::size_t rest = encoded.size() % 4;
+        if (rest == 0) {
+            return true;
+        }
+        std::size_t last = kAlphabet.find(encoded.back());
+        return (last & (rest == 2 ? 0x0f : 0x03)) == 0;
+    }
+
+    std::string encode(const std::string& input) {
+        std::string out(base64url::encoded_size(input.size()), '\0');
+        base64url::encode(input.data(), input.size(), out.data());
+        return out;
+    }
+
+    // Decodes into a buffer with guard bytes after the expected size, so
+    // a kernel writing past it is caught
+    bool decode(const std::string& encoded, std::string& out) {
+        std::size_t size = base64url::decoded_size(encoded.size());
+        std::vector<unsigned char> buffer(size + 64, 0xa5);
+        std::ptrdiff_t n = base64url::decode(encoded, buffer.data(), size);
+        for (std::size_t i = size; i < buffer.size(); ++i) {
+            if (buffer[i] != 0xa5) {
+                CHECK(!"decode wrote past its capacity");
+                break;
+            }
+        }
+        if (n < 0) {
+            return false;
+        }
+        CHECK(static_cast<std::size_t>(n) == size);
+        out.assign(reinterpret_cast<const char*>(buffer.data()), size);
+        return true;
+    }
+}
+
+int main() {
+    std::mt19937_64 rng(20240611);
+    constexpr std::size_t kMaxLength = 400;
+    std::size_t mismatches = 0;
+
+    for (int round = 0; round < 40; ++round) {
+        for (std::size_t length = 0; length <= kMaxLength; ++length) {
+            std::string input(length, '\0');
+            for (char& c : input) {
+                c = static_cast<char>(rng());
+            }
+
+            std::string encoded = encode(input);
+            mismatches += encoded != reference_encode(input);
+
+            std::string decoded;
+            mismatches += !decode(encoded, decoded) || decoded != input;
+
+            // One character replaced by an arbitrary byte: accepted
+            // exactly when still canonical, and then as the old decoder
+            // read it
+            if (!encoded.empty()) {
+                std::string mutated = encoded;
+                mutated[rng() % mutated.size()] = static_cast<char>(rng());
+                bool accepted = decode(mutated, decoded);
+                mismatches += accepted != canonical(mutated);
+                mismatches += accepted && decoded != reference_decode(mutated);
+            }
+
+            // Random strings of alphabet characters, which are mostly
+            // valid, at every length including the impossible ones
+            std::string text(length, 'A');
+            for (char& c : text) {
+                c = kAlphabet[rng() % kAlphabet.size()];
+            }
+            bool accepted = decode(text, decoded);
+            mismatches += accepted != canonical(text);
+            mismatches += accepted && decoded != reference_decode(text);
+        }
+    }
+
+    // A buffer too small by one byte is refused rather than overrun
+    std::string encoded = encode(std::string(100, 'x'));
+    unsigned char small[99];
+    CHECK(base64url::decode(encoded, small, sizeof(small)) == -1);
+
+    CHECK(mismatches == 0);
+    std::cout << "kernel: " << base64url::implementation() << std::endl;
+    return check::exit_code();
+}
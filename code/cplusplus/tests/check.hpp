@@ -0,0 +1,30 @@
+#pragma once
+#include <iostream>
+
+// Minimal assertions for the test executables. A failed CHECK prints the
+// expression and carries on; main returns check::exit_code() so ctest
+// sees the failure.
+namespace check {
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    inline bool report(bool ok, const char* expr, const char* file, int line) {
+        if (!ok) {
+            std::cerr << file << ":" << line << ": CHECK(" << expr << ") failed" << std::endl;
+            ++failures();
+        }
+        return ok;
+    }
+
+    inline int exit_code() {
+        if (failures() != 0) {
+            std::cerr << failures() << " check(s) failed" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+}
+
+#define CHECK(expr) ::check::report(static_cast<bool>(expr), #expr, __FILE__, __LINE__)
@@ -0,0 +1,269 @@
+#include "check.hpp"
+#include "credentials_body.hpp"
+#include <nlohmann/json.hpp>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// credentials_body::parse against nlohmann::json on generated bodies and
+// random mutations of them. Both must agree on whether a body is
+// acceptable and, when it is, on the email and password it holds.
+// Strings are built around the 16- and 32-byte blocks the SIMD scanners
+// work in, with escapes, surrogates, raw control bytes and broken UTF-8
+// landing anywhere in them.
+
+namespace {
+    using json = nlohmann::json;
+
+    // What the handlers used to do with a body
+    bool reference(const std::string& body, std::string& email, std::string& password) {
+        try {
+            json data = json::parse(body);
+            if (!data.is_object()) {
+                return false;
+            }
+            auto e = data.find("email");
+            auto p = data.find("password");
+            if (e == data.end() || p == data.end() || !e->is_string() || !p->is_string()) {
+                return false;
+            }
+            email = e->get<std::string>();
+            password = p->get<std::string>();
+            return true;
+        } catch (const json::exception&) {
+            return false;
+        }
+    }
+
+    class Generator {
+    public:
+        explicit Generator(std::uint64_t seed) : rng_(seed) {}
+
+        std::size_t below(std::size_t n) {
+            return static_cast<std::size_t>(rng_() % n);
+        }
+
+        bool chance(unsigned percent) {
+            return below(100) < percent;
+        }
+
+        // A quoted JSON string whose length lands near the SIMD block sizes
+        std::string string_literal() {
+            static const std::size_t kLengths[] = {0, 1, 2, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 100};
+            std::size_t length = kLengths[below(std::size(kLengths))] + (chance(30) ? below(8) : 0);
+            bool hostile = chance(10);
+            std::string s = "\"";
+            while (s.size() < length + 1) {
+                s += string_piece(hostile);
+            }
+            s += '"';
+            return s;
+        }
+
+        // A body shaped like a credentials object, often with something off
+        std::string body() {
+            std::vector<std::string> members;
+            if (!chance(5)) {
+                members.push_back(key("email") + ws() + ":" + ws() + field_value());
+            }
+            if (!chance(5)) {
+                members.push_back(key("password") + ws() + ":" + ws() + field_value());
+            }
+            std::size_t extra = chance(40) ? below(4) : 0;
+            for (std::size_t i = 0; i < extra; ++i) {
+                std::string name = chance(30) ? (chance(50) ? "email" : "password") : "x" + std::to_string(i);
+                members.push_back(key(name) + ws() + ":" + ws() + value(3));
+            }
+            for (std::size_t i = members.size(); i > 1; --i) {
+                std::swap(members[i - 1], members[below(i)]);
+            }
+            std::string s = ws() + "{" + ws();
+            for (std::size_t i = 0; i < members.size(); ++i) {
+                if (i) {
+                    s += ws() + "," + ws();
+                }
+                s += members[i];
+            }
+            s += ws() + "}" + ws();
+            if (chance(3)) {
+                s = chance(50) ? "[" + s + "]" : s + s;
+            }
+            return s;
+        }
+
+        // One random byte-level edit
+        std::string mutate(std::string s) {
+            if (s.empty()) {
+                return std::string(1, static_cast<char>(rng_()));
+            }
+            std::size_t at = below(s.size());
+            switch (below(5)) {
+            case 0:
+                s[at] = static_cast<char>(rng_());
+                break;
+            case 1:
+                s.insert(at, 1, "\"\\{}[]:,u0aZ \x01\x7f\xc3\xed\xff"[below(19)]);
+                break;
+            case 2:
+                s.erase(at, 1);
+                break;
+            case 3:
+                s.resize(at);
+                break;
+            default:
+                s[at] ^= static_cast<char>(1u << below(8));
+                break;
+            }
+            return s;
+        }
+
+    private:
+        std::string ws() {
+            static const char* kSpaces[] = {"", "", "", " ", "\n", "\t ", "\r\n  "};
+            return kSpaces[below(std::size(kSpaces))];
+        }
+
+        std::string key(const std::string& name) {
+            if (chance(5)) {
+                // The same name spelled with an escape
+                return "\"\\u00" + std::string(name[0] == 'e' ? "65" : "70") + name.substr(1) + "\"";
+            }
+            return "\"" + name + "\"";
+        }
+
+        std::string field_value() {
+            return chance(90) ? string_literal() : value(2);
+        }
+
+        std::string value(int depth) {
+            switch (below(depth > 0 ? 8 : 6)) {
+            case 0:
+                return string_literal();
+            case 1:
+                return number();
+            case 2:
+                return "true";
+            case 3:
+                return "false";
+            case 4:
+                return "null";
+            case 5:
+                return chance(50) ? "[]" : "{}";
+            case 6: {
+                std::string s = "[";
+                for (std::size_t i = 0, n = below(4); i < n; ++i) {
+                    s += (i ? "," : "") + ws() + value(depth - 1);
+                }
+                return s + "]";
+            }
+            default: {
+                std::string s = "{";
+                for (std::size_t i = 0, n = below(3); i < n; ++i) {
+                    s += (i ? "," : "") + key("k" + std::to_string(i)) + ":" + value(depth - 1);
+                }
+                return s + "}";
+            }
+            }
+        }
+
+        std::string number() {
+            static const char* kNumbers[] = {
+                "0", "-0", "1", "-17", "3.25", "1e5", "1E+5", "-2.5e-3", "123456789012345678901234567890",
+                "1e400", "-1e400", "1e-400", "01", "1.", ".5", "-", "+1", "1e", "0x10", "NaN",
+            };
+            return kNumbers[below(std::size(kNumbers))];
+        }
+
+        // Mostly characters and escapes that are valid; with hostile set,
+        // also broken escapes and UTF-8 and raw control bytes
+        std::string string_piece(bool hostile) {
+            static const char* kEscapes[] = {
+                "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t", "\\u0041", "\\u00e9",
+                "\\u20ac", "\\uD83D\\uDE00", "\\u0000",
+            };
+            static const char* kBadEscapes[] = {"\\uD83D", "\\uDE00", "\\uD83Dx", "\\u12", "\\x", "\\U0041"};
+            static const char* kUtf8[] = {"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+            static const char* kBadUtf8[] = {
+                "\xc3", "\xe2\x82", "\x80", "\xff", "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+            };
+            switch (below(hostile ? 40 : 20)) {
+            case 0:
+                return kEscapes[below(std::size(kEscapes))];
+            case 1:
+                return kUtf8[below(std::size(kUtf8))];
+            case 20:
+                return kBadEscapes[below(std::size(kBadEscapes))];
+            case 21:
+                return kBadUtf8[below(std::size(kBadUtf8))];
+            case 22:
+                return std::string(1, static_cast<char>(below(0x20)));
+            default: {
+                char c = static_cast<char>(0x20 + below(0x5f));
+                return std::string(1, c == '"' || c == '\\' ? 'q' : c);
+            }
+            }
+        }
+
+        std::mt19937_64 rng_;
+    };
+
+    struct Outcome {
+        bool ok = false;
+        std::string email;
+        std::string password;
+    };
+
+    Outcome scanned(const std::string& body) {
+        // A copy sized to the body, so a scanner reading past the end is
+        // caught under -fsanitize=address
+        std::vector<char> bytes(body.begin(), body.end());
+        credentials_body::Fields fields;
+        std::string scratch;
+        Outcome out;
+        out.ok = credentials_body::parse(std::string_view(bytes.data(), bytes.size()), fields, scratch);
+        if (out.ok) {
+            out.email.assign(fields.email);
+            out.password.assign(fields.password);
+        }
+        return out;
+    }
+}
+
+int main() {
+    Generator gen(20240612);
+    std::size_t bodies = 0, accepted = 0, disagreements = 0;
+
+    auto compare = [&](const std::string& body) {
+        Outcome expected;
+        expected.ok = reference(body, expected.email, expected.password);
+        Outcome actual = scanned(body);
+        ++bodies;
+        accepted += expected.ok;
+        bool same = actual.ok == expected.ok &&
+                    (!expected.ok || (actual.email == expected.email && actual.password == expected.password));
+        if (!same && ++disagreements <= 10) {
+            std::cerr << "disagreement (nlohmann " << (expected.ok ? "accepts" : "rejects") << "): "
+                      << json(body).dump(-1, ' ', true, json::error_handler_t::replace)
+                      << std::endl;
+        }
+    };
+
+    for (int i = 0; i < 100000; ++i) {
+        std::string body = gen.body();
+        compare(body);
+        for (int m = 0; m < 2; ++m) {
+            body = gen.mutate(std::move(body));
+            compare(body);
+        }
+    }
+
+    CHECK(disagreements == 0);
+    // The generator must produce both outcomes in quantity to mean anything
+    CHECK(accepted > bodies / 10);
+    CHECK(accepted < bodies * 9 / 10);
+    std::cout << bodies << " bodies, " << accepted << " accepted, kernel "
+              << credentials_body::implementation() << std::endl;
+    return check::exit_code();
+}
@@ -0,0 +1,179 @@
+#include "check.hpp"
+#include "http_session.hpp"
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Answering a request with a canned error (404, 405, the 401s and 400s)
+// must not touch the heap once the connection has served one like it.
+// A session runs on its own thread behind a loopback socket; every
+// operator new in the process is counted, and each request is written
+// and its whole response read back between two reads of the count.
+
+namespace {
+    std::atomic<std::size_t> allocations{0};
+
+    std::size_t allocations_during(void (*f)(const void*), const void* arg) {
+        std::size_t before = allocations.load();
+        f(arg);
+        return allocations.load() - before;
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    namespace net = boost::asio;
+    using tcp = net::ip::tcp;
+
+    struct Case {
+        const char* name;
+        std::string request;
+        std::string_view status;
+    };
+
+    int client = -1;
+    char response[4096];
+    bool answered;
+
+    std::string request(std::string_view method, std::string_view target, std::string_view headers = {},
+                        std::string_view body = {}) {
+        std::string r(method);
+        r.append(" ").append(target).append(" HTTP/1.1\r\nHost: localhost\r\nUser-Agent: http_alloc_test\r\n");
+        r.append("Accept: */*\r\n").append(headers);
+        if (!body.empty()) {
+            r.append("Content-Type: application/json\r\nContent-Length: ")
+                .append(std::to_string(body.size())).append("\r\n");
+        }
+        return r.append("\r\n").append(body);
+    }
+
+    // Sends the request and reads until the whole response is in, which
+    // the service sends with a Content-Length
+    void exchange(const void* arg) {
+        const auto* c = static_cast<const Case*>(arg);
+        answered = false;
+        if (::send(client, c->request.data(), c->request.size(), MSG_NOSIGNAL) !=
+            static_cast<ssize_t>(c->request.size())) {
+            return;
+        }
+        std::size_t size = 0;
+        for (;;) {
+            ssize_t n = ::recv(client, response + size, sizeof(response) - size, 0);
+            if (n <= 0) {
+                return;
+            }
+            size += static_cast<std::size_t>(n);
+            std::string_view got(response, size);
+            std::size_t header_end = got.find("\r\n\r\n");
+            std::size_t length_at = got.find("Content-Length: ");
+            if (header_end == std::string_view::npos || length_at == std::string_view::npos) {
+                continue;
+            }
+            std::size_t length = std::strtoul(response + length_at + 16, nullptr, 10);
+            if (size >= header_end + 4 + length) {
+                answered = got.substr(9, 3) == c->status;
+                return;
+            }
+        }
+    }
+}
+
+int main() {
+    auto services = std::make_shared<Services>();
+    services->user_store = std::make_shared<UserStore>();
+    services->revocations = std::make_shared<RevocationList>(-1);
+    services->user_store->add_user("alloc@example.com", "correct horse");
+
+    net::io_context ioc{1};
+    tcp::acceptor acceptor(ioc, tcp::endpoint(net::ip::make_address("127.0.0.1"), 0));
+    client = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(acceptor.local_endpoint().port());
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(client, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "cannot connect to the test listener" << std::endl;
+        return 1;
+    }
+    serve_http(acceptor.accept(), services);
+    std::thread io([&ioc] { ioc.run(); });
+
+    std::vector<Case> cases = {
+        {"404 unknown path", request("GET", "/nowhere"), "404"},
+        {"405 wrong method", request("GET", "/login"), "405"},
+        {"401 missing authorization", request("DELETE", "/delete"), "401"},
+        {"401 malformed authorization", request("DELETE", "/delete", "Authorization: Basic Zm9vOmJhcg==\r\n"),
+         "401"},
+        {"401 invalid token", request("DELETE", "/delete", "Authorization: Bearer not.a.token\r\n"), "401"},
+        {"401 wrong password",
+         request("POST", "/login", {}, R"({"email":"alloc@example.com","password":"battery staple"})"), "401"},
+        {"401 unknown user",
+         request("POST", "/login", {}, R"({"email":"nobody-here@example.com","password":"correct horse"})"),
+         "401"},
+        {"400 missing field", request("POST", "/login", {}, R"({"email":"alloc@example.com"})"), "400"},
+        {"400 not json", request("POST", "/register", {}, "email=alloc@example.com&password=x"), "400"},
+        {"400 escaped fields",
+         request("POST", "/login", {}, R"({"email":"alloc@example.com","password":"p\"w","x":)"), "400"},
+        {"400 user exists",
+         request("POST", "/register", {}, R"({"email":"alloc@example.com","password":"correct horse"})"), "400"},
+    };
+
+    // The first requests grow the session's buffers, set up the signing
+    // key and format the Date header
+    for (int round = 0; round < 3; ++round) {
+        for (const Case& c : cases) {
+            exchange(&c);
+        }
+    }
+
+    for (const Case& c : cases) {
+        for (int i = 0; i < 50; ++i) {
+            std::size_t n = allocations_during(exchange, &c);
+            if (!CHECK(answered) || !CHECK(n == 0)) {
+                std::cerr << c.name << ": " << n << " allocation(s)" << std::endl;
+                break;
+            }
+        }
+    }
+
+    ::close(client);
+    io.join();
+    return check::exit_code();
+}
@@ -0,0 +1,131 @@
+#include "check.hpp"
+#include "jwt.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// JWT::verify, and JWT::create into a caller's buffer, must not touch the
+// heap whether the token is good or bad. Every operator new in the
+// process is counted; the calls under test run between two reads of the
+// count.
+
+namespace {
+    std::atomic<std::size_t> allocations{0};
+
+    std::size_t allocations_during(void (*f)(const void*), const void* arg) {
+        std::size_t before = allocations.load();
+        f(arg);
+        return allocations.load() - before;
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    struct Case {
+        std::string token;
+        bool valid;
+        std::string email;
+    };
+
+    // Claims is about 4 KiB, so keep one rather than one per call
+    JWT::Claims claims;
+    bool verified;
+
+    void verify_case(const void* arg) {
+        verified = JWT::verify(static_cast<const Case*>(arg)->token, claims);
+    }
+
+    void create_into_buffer(const void* arg) {
+        const auto* email = static_cast<const std::string*>(arg);
+        static char out[16384];
+        JWT::create(*email, out);
+    }
+}
+
+int main() {
+    std::vector<std::string> emails = {
+        "a@b.c",
+        "user@example.com",
+        "quote\"and\\backslash@example.com",
+        "control\x01\x1f" "chars@example.com",
+        "unicode-\xc3\xa9\xe2\x82\xac@example.com",
+        std::string(254, 'x'),
+        // Longer than the encoder's stack buffer, so it has to stream
+        std::string(3000, 'y'),
+    };
+
+    std::vector<Case> cases;
+    for (const std::string& email : emails) {
+        std::string token = JWT::create(email);
+        cases.push_back({token, true, email});
+
+        std::string bad_signature = token;
+        bad_signature.back() = bad_signature.back() == 'A' ? 'B' : 'A';
+        cases.push_back({bad_signature, false, email});
+
+        std::string bad_payload = token;
+        bad_payload[token.find('.') + 3] ^= 1;
+        cases.push_back({bad_payload, false, email});
+
+        cases.push_back({token.substr(0, token.rfind('.')), false, email});
+        cases.push_back({token + ".extra", false, email});
+
+        std::string not_base64 = token;
+        not_base64[token.find('.') + 1] = '*';
+        cases.push_back({not_base64, false, email});
+
+        std::int64_t long_ago = JWT::current_second() - 2 * JWT::kTokenLifetime;
+        cases.push_back({JWT::create_at(email, long_ago), false, email});
+    }
+    cases.push_back({"", false, ""});
+    cases.push_back({"..", false, ""});
+    cases.push_back({std::string(3 * JWT::kMaxPayloadSize, 'A') + "." + std::string(10, 'A') + ".AAAA", false, ""});
+
+    // The first calls pick kernels and set up the signing key
+    for (const Case& c : cases) {
+        verify_case(&c);
+    }
+    create_into_buffer(&emails[0]);
+
+    for (const Case& c : cases) {
+        CHECK(allocations_during(verify_case, &c) == 0);
+        CHECK(verified == c.valid);
+        if (c.valid && verified) {
+            CHECK(claims.email == c.email);
+            CHECK(claims.exp == claims.iat + JWT::kTokenLifetime);
+        }
+    }
+    for (const std::string& email : emails) {
+        CHECK(allocations_during(create_into_buffer, &email) == 0);
+    }
+    return check::exit_code();
+}
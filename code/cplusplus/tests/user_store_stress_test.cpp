@@ -0,0 +1,130 @@
+#include "check.hpp"
+#include "epoch.hpp"
+#include "password_hash.hpp"
+#include "user_store.hpp"
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writers delete and re-add a small set of hot emails while readers log
+// in as them. Every password is derived from its email, so a credential
+// read while a writer erases or replaces its slot must either verify
+// against that password or not be found at all; a torn read verifies
+// against neither. Writers also churn through fresh emails so the
+// shards keep growing, which has readers racing resizes and retired
+// tables and keys as well.
+
+namespace {
+    constexpr int kHotEmails = 64;
+    constexpr int kWriters = 2;
+    constexpr int kReaders = 4;
+    constexpr int kOpsPerWriter = 100000;
+
+    std::string hot_email(unsigned i) {
+        return "user" + std::to_string(i) + "@example.com";
+    }
+
+    std::string password_for(const std::string& email) {
+        return "pw:" + email;
+    }
+
+    struct ReaderStats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t torn = 0;
+        std::uint64_t mismatched = 0;
+    };
+}
+
+int main() {
+    // Few shards, so writers and readers meet on the same tables
+    UserStore store(4);
+    std::atomic<bool> writing{true};
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < kWriters; ++w) {
+        writers.emplace_back([&store, w] {
+            std::mt19937 rng(1000 + w);
+            for (int op = 0; op < kOpsPerWriter; ++op) {
+                std::string email = hot_email(rng() % kHotEmails);
+                if (rng() & 1) {
+                    store.add_user(email, password_for(email));
+                } else {
+                    store.delete_user(email);
+                }
+                if (op % 4 == 0) {
+                    std::string fresh = "churn" + std::to_string(w) + "-" + std::to_string(op) + "@example.com";
+                    store.add_user(fresh, password_for(fresh));
+                    if (op % 8 == 0) {
+                        store.delete_user(fresh);
+                    }
+                }
+            }
+        });
+    }
+
+    std::vector<ReaderStats> stats(kReaders);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < kReaders; ++r) {
+        readers.emplace_back([&store, &writing, &stats, r] {
+            std::mt19937 rng(2000 + r);
+            ReaderStats& s = stats[r];
+            do {
+                unsigned i = rng() % kHotEmails;
+                std::string email = hot_email(i);
+                crypto::Credential credential;
+                if (store.lookup_credential(email, credential)) {
+                    ++s.hits;
+                    s.torn += !crypto::verify_credential(password_for(email), credential);
+                } else {
+                    ++s.misses;
+                }
+                // Someone else's password never logs in, mid-change or not
+                std::string other = hot_email((i + 1 + rng() % (kHotEmails - 1)) % kHotEmails);
+                s.mismatched += store.authenticate_user(email, password_for(other));
+                store.authenticate_user(email, password_for(email));
+            } while (writing.load(std::memory_order_relaxed));
+        });
+    }
+
+    for (std::thread& t : writers) {
+        t.join();
+    }
+    writing.store(false, std::memory_order_relaxed);
+    for (std::thread& t : readers) {
+        t.join();
+    }
+
+    ReaderStats total;
+    for (const ReaderStats& s : stats) {
+        total.hits += s.hits;
+        total.misses += s.misses;
+        total.torn += s.torn;
+        total.mismatched += s.mismatched;
+    }
+    CHECK(total.torn == 0);
+    CHECK(total.mismatched == 0);
+    // Both outcomes must have happened for the race to have been run
+    CHECK(total.hits > 0);
+    CHECK(total.misses > 0);
+
+    // Once quiet, lookups and logins agree for every hot email
+    for (unsigned i = 0; i < kHotEmails; ++i) {
+        std::string email = hot_email(i);
+        crypto::Credential credential;
+        bool found = store.lookup_credential(email, credential);
+        CHECK(found == store.authenticate_user(email, password_for(email)));
+        CHECK(!found || crypto::verify_credential(password_for(email), credential));
+    }
+    // Free what is still waiting out its epochs, so a leak check only
+    // sees real leaks
+    for (int i = 0; i < 3; ++i) {
+        epoch::collect();
+    }
+
+    std::cout << "lookups: " << total.hits << " hits, " << total.misses << " misses" << std::endl;
+    return check::exit_code();
+}